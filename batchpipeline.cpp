@@ -0,0 +1,276 @@
+#include "batchpipeline.h"
+#include "boundedqueue.h"
+#include "shardedclustering.h"
+#include "tracing.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QBuffer>
+#include <QMutex>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+using namespace Qt::StringLiterals;
+
+namespace {
+
+// The unit of work flowing through the pipeline, each stage consumes its input and fills in its output.
+struct BatchItem final {
+    qsizetype index{ -1 };
+    QString filePath{};
+    UserOptions options{}; // May differ from the pipeline's options to stay within the memory budget.
+    MemoryPlan memoryPlan{};
+    QByteArray fileData{};
+    QImage image{};
+    PixelData pixelData{};
+    ColorItemList colorList{};
+    QString errorMessage{}; // Once set, the remaining stages let the item pass through untouched.
+};
+
+// The pixel buffers the clusterers are done with, for the extractors to fill again. There are never more of them
+// than items in flight between these two stages, so once the pipeline has warmed up, extracting the pixels of an
+// image no larger than the ones before doesn't allocate anything.
+class PixelDataPool final {
+    Q_DISABLE_COPY_MOVE(PixelDataPool)
+
+public:
+    explicit PixelDataPool() = default;
+    ~PixelDataPool() = default;
+
+    // Empty buffers if there is nothing to reuse (yet).
+    [[nodiscard]] PixelData take() {
+        const QMutexLocker locker(&m_mutex);
+        if (m_pixelDataList.empty()) {
+            return {};
+        }
+        PixelData pixelData{ std::move(m_pixelDataList.back()) };
+        m_pixelDataList.pop_back();
+        return pixelData;
+    }
+
+    void give(PixelData&& pixelData) {
+        // Eg. the items clustered straight from their images, nothing worth keeping.
+        if (pixelData.pixelList.capacity() <= 0) {
+            return;
+        }
+        const QMutexLocker locker(&m_mutex);
+        m_pixelDataList.push_back(std::move(pixelData));
+    }
+
+private:
+    QMutex m_mutex{};
+    std::vector<PixelData> m_pixelDataList{};
+};
+
+using BatchQueue = BoundedQueue<BatchItem>;
+using ThreadList = std::vector<std::unique_ptr<QThread>>;
+
+// Starts "workerCount" threads which take items out of "input", process them and put them into "output".
+// The last worker to finish closes "output", so that the end of the input propagates down the pipeline.
+// Each worker has its own analysis workspace, reused for all the items it processes.
+template <typename Function>
+void startStage(ThreadList& threadList, const QString& name, const int workerCount, BatchQueue& input, BatchQueue& output, Function function) {
+    Q_ASSERT(workerCount > 0);
+    const auto remainingWorkerCount{ std::make_shared<std::atomic_int>(workerCount) };
+    for (int index{ 0 }; index < workerCount; ++index) {
+        std::unique_ptr<QThread> thread{ QThread::create([&input, &output, function, remainingWorkerCount](){
+            AnalysisWorkspace workspace{};
+            BatchItem item{};
+            while (input.pop(item)) {
+                if (item.errorMessage.isEmpty()) {
+                    function(item, workspace);
+                }
+                if (!output.push(std::move(item))) {
+                    break;
+                }
+            }
+            if (remainingWorkerCount->fetch_sub(1) == 1) {
+                output.close();
+            }
+        }) };
+        thread->setObjectName(u"%1Thread%2"_s.arg(name, QString::number(index)));
+        thread->start();
+        threadList.push_back(std::move(thread));
+    }
+}
+
+[[nodiscard]] int resolveWorkerCount(const int count) {
+    return count > 0 ? count : qMax(QThread::idealThreadCount(), 1);
+}
+
+} // namespace
+
+BatchPipeline::BatchPipeline(const UserOptions& options, const BatchPipelineOptions& pipelineOptions) : m_options{ options }, m_pipelineOptions{ pipelineOptions } {}
+
+BatchPipeline::~BatchPipeline() = default;
+
+void BatchPipeline::run(const QStringList& filePathList, const std::function<void(BatchResult)>& sink) {
+    Q_ASSERT(sink);
+    if (filePathList.isEmpty()) {
+        return;
+    }
+    const TraceSpan span{ "Batch pipeline", filePathList.size() };
+    QElapsedTimer timer{};
+    timer.start();
+    const qsizetype capacity{ m_pipelineOptions.queueCapacity };
+    BatchQueue decodeQueue{ capacity };
+    BatchQueue extractQueue{ capacity };
+    BatchQueue clusterQueue{ capacity };
+    BatchQueue resultQueue{ capacity };
+    ThreadList threadList{};
+    PixelDataPool pixelDataPool{};
+
+    // Stage 1: read the raw file contents. The readers pick the next file by themselves,
+    // there is no need for an input queue.
+    {
+        const int readerCount{ resolveWorkerCount(m_pipelineOptions.readerCount) };
+        const auto nextIndex{ std::make_shared<std::atomic<qsizetype>>(0) };
+        const auto remainingReaderCount{ std::make_shared<std::atomic_int>(readerCount) };
+        for (int index{ 0 }; index < readerCount; ++index) {
+            std::unique_ptr<QThread> thread{ QThread::create([&filePathList, &decodeQueue, nextIndex, remainingReaderCount](){
+                while (true) {
+                    const qsizetype fileIndex{ nextIndex->fetch_add(1) };
+                    if (fileIndex >= filePathList.size()) {
+                        break;
+                    }
+                    BatchItem item{};
+                    item.index = fileIndex;
+                    item.filePath = filePathList[fileIndex];
+                    {
+                        const TraceSpan span{ "Read file" };
+                        QFile file(item.filePath);
+                        if (file.open(QFile::ReadOnly)) {
+                            item.fileData = file.readAll();
+                        } else {
+                            item.errorMessage = u"Cannot open the file: %1"_s.arg(file.errorString());
+                        }
+                    }
+                    if (!decodeQueue.push(std::move(item))) {
+                        break;
+                    }
+                }
+                if (remainingReaderCount->fetch_sub(1) == 1) {
+                    decodeQueue.close();
+                }
+            }) };
+            thread->setObjectName(u"ReaderThread%1"_s.arg(QString::number(index)));
+            thread->start();
+            threadList.push_back(std::move(thread));
+        }
+    }
+    // Stage 2: decode and shrink.
+    startStage(threadList, u"Decoder"_s, resolveWorkerCount(m_pipelineOptions.decoderCount), decodeQueue, extractQueue, [this](BatchItem& item, AnalysisWorkspace&){
+        std::optional<TraceSpan> decodeSpan{ std::in_place, "Decode image" };
+        QBuffer buffer(&item.fileData);
+        buffer.open(QBuffer::ReadOnly);
+        // Give the reader a hint about the format, the content is still checked.
+        QImageReader reader(&buffer, QFileInfo(item.filePath).suffix().toLatin1());
+        reader.setDecideFormatFromContent(true);
+        item.options = m_options;
+        applyRegionOfInterest(reader, item.options);
+        QString errorMessage{};
+        if (!applyMemoryBudget(reader, item.options, item.memoryPlan, true, &errorMessage)) {
+            item.fileData = {};
+            item.errorMessage = errorMessage;
+            return;
+        }
+        QImage image{ reader.read() };
+        buffer.close();
+        item.fileData = {};
+        decodeSpan.reset();
+        if (image.isNull()) {
+            item.errorMessage = u"Cannot decode the image: %1"_s.arg(reader.errorString());
+            return;
+        }
+        item.image = prepareImage(std::move(image), item.options);
+    });
+    // Stage 3: build the pixel lists (skipped in multi-resolution mode and when tiling).
+    startStage(threadList, u"Extractor"_s, resolveWorkerCount(m_pipelineOptions.extractorCount), extractQueue, clusterQueue, [&pixelDataPool](BatchItem& item, AnalysisWorkspace& workspace){
+        if (item.options.multiResolution || item.memoryPlan.strategy == MemoryStrategy::Tiling) {
+            // The clusterers need the image itself to build the mip pyramid or to cut it into bands.
+            return;
+        }
+        item.pixelData = pixelDataPool.take();
+        const bool ok{ extractPixels(item.pixelData, item.image, item.options, &workspace) };
+        item.image = {};
+        if (!ok) {
+            item.errorMessage = u"No valid pixels found."_s;
+        }
+    });
+    // Stage 4: k-means.
+    startStage(threadList, u"Clusterer"_s, resolveWorkerCount(m_pipelineOptions.clustererCount), clusterQueue, resultQueue, [&pixelDataPool](BatchItem& item, AnalysisWorkspace& workspace){
+        bool ok{ false };
+        if (item.memoryPlan.strategy == MemoryStrategy::Tiling) {
+            ok = clusterImageInTiles(item.colorList, item.image, item.options, item.memoryPlan.tileHeight, &workspace);
+        } else if (item.options.multiResolution) {
+            ok = clusterImage(item.colorList, item.image, item.options, &workspace);
+        } else {
+            ok = clusterPixels(item.colorList, item.pixelData, item.options, &workspace);
+        }
+        if (!ok) {
+            item.errorMessage = u"Failed to analyze the image colors."_s;
+        }
+        item.image = {};
+        pixelDataPool.give(std::exchange(item.pixelData, {}));
+    });
+    // Stage 5: the result sink, on the calling thread.
+    qsizetype resultCount{ 0 };
+    BatchItem item{};
+    while (resultQueue.pop(item)) {
+        BatchResult result{};
+        result.index = item.index;
+        result.filePath = std::move(item.filePath);
+        result.colorList = std::move(item.colorList);
+        result.errorMessage = std::move(item.errorMessage);
+        sink(std::move(result));
+        ++resultCount;
+    }
+    for (auto&& thread : threadList) {
+        thread->wait();
+    }
+    Q_ASSERT(resultCount == filePathList.size());
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Batch of" << resultCount << "file(s) done in" << timer.elapsed() << "milliseconds.";
+    }
+}
+
+QString formatColorList(const ColorItemList& colorList) {
+    QString result{};
+    for (auto it{ colorList.crbegin() }; it != colorList.crend(); ++it) {
+        result += u'\t' + it->color.name().toUpper() + u' ' + QString::number(it->ratio * qreal(100), 'f', 2) + u'%';
+    }
+    return result;
+}
+
+QStringList collectImageFilePaths(const QStringList& pathList) {
+    QStringList nameFilterList{};
+    {
+        const QList<QByteArray> formatList{ QImageReader::supportedImageFormats() };
+        for (auto&& format : std::as_const(formatList)) {
+            nameFilterList.push_back(u"*."_s + QString::fromLatin1(format));
+        }
+    }
+    QStringList filePathList{};
+    for (auto&& path : std::as_const(pathList)) {
+        const QFileInfo fileInfo(path);
+        if (fileInfo.isDir()) {
+            const QDir dir(fileInfo.absoluteFilePath());
+            const QStringList fileNameList{ dir.entryList(nameFilterList, QDir::Files | QDir::Readable) };
+            for (auto&& fileName : std::as_const(fileNameList)) {
+                filePathList.push_back(dir.absoluteFilePath(fileName));
+            }
+        } else {
+            filePathList.push_back(fileInfo.absoluteFilePath());
+        }
+    }
+    filePathList.sort();
+    filePathList.removeDuplicates();
+    return filePathList;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "coloranalyzer.h"
+#include <functional>
+
+struct BatchPipelineOptions final {
+    // Each stage has its own worker threads, the numbers below are per stage. Any value <= 0 means
+    // one worker per logical CPU core.
+    int readerCount{ 2 }; // Reading the file contents is I/O bound, a few readers are enough to hide the latency of network storage.
+    int decoderCount{ 0 }; // Decoding and shrinking the images.
+    int extractorCount{ 1 }; // Building the pixel lists, cheap compared to the other stages.
+    int clustererCount{ 0 }; // Running k-means.
+    qsizetype queueCapacity{ 4 }; // How many items may wait between two stages, bounds the memory usage together with the worker counts.
+};
+
+struct BatchResult final {
+    qsizetype index{ -1 }; // Index into the input file path list.
+    QString filePath{};
+    ColorItemList colorList{};
+    QString errorMessage{}; // Empty on success.
+};
+
+// Analyzes many files at once with a staged pipeline: read bytes -> decode & shrink -> extract pixels
+// -> cluster -> result sink. The stages are connected by bounded queues, so they all run at the same
+// time and the throughput is limited by the slowest stage instead of the sum of all stages, while a
+// fast stage can never run too far ahead of the others.
+class BatchPipeline final {
+    Q_DISABLE_COPY_MOVE(BatchPipeline)
+
+public:
+    explicit BatchPipeline(const UserOptions& options, const BatchPipelineOptions& pipelineOptions = {});
+    ~BatchPipeline();
+
+    // Blocks until all the files have been processed. "sink" is called on the calling thread,
+    // exactly once per file, in completion order (not necessarily the input order).
+    void run(const QStringList& filePathList, const std::function<void(BatchResult)>& sink);
+
+private:
+    UserOptions m_options{};
+    BatchPipelineOptions m_pipelineOptions{};
+};
+
+// The colors from the most dominant one to the least dominant one, each of them as "\t#RRGGBB xx.xx%".
+[[nodiscard]] extern QString formatColorList(const ColorItemList& colorList);
+
+// Expands the directories in "pathList" into the image files they contain (non-recursively),
+// plain file paths are kept as-is. The result is sorted and contains no duplicates.
+[[nodiscard]] extern QStringList collectImageFilePaths(const QStringList& pathList);
@@ -0,0 +1,137 @@
+#include "coloranalyzer.h"
+#include <QTest>
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+// Measures the assignment step (one "accumulateClusters()" call) with each nearest centroid search.
+// Everything is generated from a fixed seed, so every run measures exactly the same work.
+
+static constexpr const quint64 RANDOM_SEED{ 20240601 };
+static constexpr const qsizetype PIXEL_COUNT{ 200000 };
+static constexpr const int COLOR_CENTER_COUNT{ 40 }; // Of the clustered pixel distribution.
+
+[[nodiscard]] static inline Pixel randomPixel(std::mt19937_64& engine) {
+    std::uniform_int_distribution<int> dist(0, 255);
+    return Pixel{ static_cast<quint8>(dist(engine)), static_cast<quint8>(dist(engine)), static_cast<quint8>(dist(engine)) };
+}
+
+// Either uniformly distributed over the whole RGB cube, or scattered around a few random colors,
+// which is much closer to a real photo.
+[[nodiscard]] static inline QList<Pixel> generatePixels(std::mt19937_64& engine, const bool clustered) {
+    QList<Pixel> pixelList{};
+    pixelList.reserve(PIXEL_COUNT);
+    if (!clustered) {
+        for (qsizetype index{ 0 }; index < PIXEL_COUNT; ++index) {
+            pixelList.push_back(randomPixel(engine));
+        }
+        return pixelList;
+    }
+    QList<Pixel> centerList{};
+    for (int index{ 0 }; index < COLOR_CENTER_COUNT; ++index) {
+        centerList.push_back(randomPixel(engine));
+    }
+    std::uniform_int_distribution<qsizetype> centerDist(0, centerList.size() - 1);
+    std::normal_distribution<qreal> noiseDist(0, 16);
+    const auto& jitter{ [&engine, &noiseDist](const quint8 channel){
+        return static_cast<quint8>(std::clamp(qRound(qreal(channel) + noiseDist(engine)), 0, 255));
+    } };
+    for (qsizetype index{ 0 }; index < PIXEL_COUNT; ++index) {
+        const Pixel center{ centerList[centerDist(engine)] };
+        const quint8 r{ jitter(center.r) };
+        const quint8 g{ jitter(center.g) };
+        const quint8 b{ jitter(center.b) };
+        pixelList.push_back(Pixel{ r, g, b });
+    }
+    return pixelList;
+}
+
+// The sum of the squared distances between the pixels and their closest centroids. Unlike the cluster sizes,
+// it doesn't depend on how the searches break ties, so it must be exactly the same for all of them.
+[[nodiscard]] static inline quint64 totalInertia(const QList<ClusterAccumulator>& clusterList) {
+    return std::accumulate(clusterList.cbegin(), clusterList.cend(), quint64(0), [](const quint64 sum, const ClusterAccumulator& cluster){ return sum + cluster.inertia; });
+}
+
+class AssignmentBenchmark final : public QObject {
+    Q_OBJECT
+
+private Q_SLOTS:
+    void crossover_data();
+    void crossover();
+    void fixedK_data();
+    void fixedK();
+
+private:
+    void measure(const int k, const NearestCentroidSearch search, const bool clustered);
+};
+
+void AssignmentBenchmark::measure(const int k, const NearestCentroidSearch search, const bool clustered) {
+    std::mt19937_64 engine(RANDOM_SEED);
+    PixelData pixelData{};
+    pixelData.pixelList = generatePixels(engine, clustered);
+    pixelData.imagePixelCount = pixelData.pixelList.size();
+    QList<Pixel> centroidList{};
+    for (int index{ 0 }; index < k; ++index) {
+        centroidList.push_back(randomPixel(engine));
+    }
+    QList<ClusterAccumulator> expectedClusterList{};
+    {
+        AnalysisWorkspace referenceWorkspace{};
+        referenceWorkspace.setNearestCentroidSearch(NearestCentroidSearch::LinearScan);
+        QVERIFY(accumulateClusters(expectedClusterList, pixelData, centroidList, &referenceWorkspace));
+    }
+    AnalysisWorkspace workspace{};
+    workspace.setNearestCentroidSearch(search);
+    QList<ClusterAccumulator> clusterList{};
+    QBENCHMARK {
+        QVERIFY(accumulateClusters(clusterList, pixelData, centroidList, &workspace));
+    }
+    QCOMPARE(totalInertia(clusterList), totalInertia(expectedClusterList));
+}
+
+// Linear scan vs k-d tree around "KD_TREE_MIN_K".
+void AssignmentBenchmark::crossover_data() {
+    QTest::addColumn<int>("k");
+    QTest::addColumn<int>("search");
+    QTest::addColumn<bool>("clustered");
+    for (const bool clustered : { false, true }) {
+        for (const int k : { 32, 64, 96, 128, 256, 1024 }) {
+            const char* distribution{ clustered ? "clustered" : "uniform" };
+            QTest::addRow("%s k=%d linear", distribution, k) << k << int(NearestCentroidSearch::LinearScan) << clustered;
+            QTest::addRow("%s k=%d tree", distribution, k) << k << int(NearestCentroidSearch::CentroidTree) << clustered;
+        }
+    }
+}
+
+void AssignmentBenchmark::crossover() {
+    QFETCH(int, k);
+    QFETCH(int, search);
+    QFETCH(bool, clustered);
+    measure(k, NearestCentroidSearch(search), clustered);
+}
+
+// Generic loop vs the kernels specialized for small k, see "FIXED_K_MIN" and "FIXED_K_MAX". There is no kernel
+// for k=2 and k=3, both of their rows run the generic loop until "FIXED_K_MIN" is lowered again.
+void AssignmentBenchmark::fixedK_data() {
+    QTest::addColumn<int>("k");
+    QTest::addColumn<int>("search");
+    QTest::addColumn<bool>("clustered");
+    for (const bool clustered : { false, true }) {
+        for (int k{ 2 }; k <= 16; ++k) {
+            const char* distribution{ clustered ? "clustered" : "uniform" };
+            QTest::addRow("%s k=%d linear", distribution, k) << k << int(NearestCentroidSearch::LinearScan) << clustered;
+            QTest::addRow("%s k=%d fixed", distribution, k) << k << int(NearestCentroidSearch::FixedK) << clustered;
+        }
+    }
+}
+
+void AssignmentBenchmark::fixedK() {
+    QFETCH(int, k);
+    QFETCH(int, search);
+    QFETCH(bool, clustered);
+    measure(k, NearestCentroidSearch(search), clustered);
+}
+
+QTEST_GUILESS_MAIN(AssignmentBenchmark)
+
+#include "assignmentbenchmark.moc"
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <QMutex>
+#include <QQueue>
+#include <QWaitCondition>
+
+// A blocking FIFO queue with a fixed capacity, used to connect the stages of a pipeline.
+// The producer blocks while the queue is full, which keeps the memory usage bounded no
+// matter how much faster it is than the consumer.
+template <typename T>
+class BoundedQueue final {
+    Q_DISABLE_COPY_MOVE(BoundedQueue)
+
+public:
+    explicit BoundedQueue(const qsizetype capacity) : m_capacity{ qMax(capacity, qsizetype(1)) } {}
+    ~BoundedQueue() = default;
+
+    // Blocks until there is room for the new item. Returns false (and drops the item)
+    // if the queue has been closed in the meantime.
+    [[nodiscard]] bool push(T value) {
+        QMutexLocker locker(&m_mutex);
+        while (!m_closed && m_queue.size() >= m_capacity) {
+            m_notFull.wait(&m_mutex);
+        }
+        if (m_closed) {
+            return false;
+        }
+        m_queue.enqueue(std::move(value));
+        m_notEmpty.wakeOne();
+        return true;
+    }
+
+    // Blocks until an item is available. Returns false once the queue has been closed
+    // and all the remaining items have been taken out.
+    [[nodiscard]] bool pop(T& valueOut) {
+        QMutexLocker locker(&m_mutex);
+        while (!m_closed && m_queue.isEmpty()) {
+            m_notEmpty.wait(&m_mutex);
+        }
+        if (m_queue.isEmpty()) {
+            return false;
+        }
+        valueOut = std::move(m_queue.dequeue());
+        m_notFull.wakeOne();
+        return true;
+    }
+
+    // No more items will be accepted, wakes up everyone who is waiting. The items
+    // already in the queue can still be taken out.
+    void close() {
+        const QMutexLocker locker(&m_mutex);
+        m_closed = true;
+        m_notEmpty.wakeAll();
+        m_notFull.wakeAll();
+    }
+
+    [[nodiscard]] bool isClosed() const {
+        const QMutexLocker locker(&m_mutex);
+        return m_closed;
+    }
+
+private:
+    mutable QMutex m_mutex{};
+    QWaitCondition m_notEmpty{};
+    QWaitCondition m_notFull{};
+    QQueue<T> m_queue{};
+    const qsizetype m_capacity{ 1 };
+    bool m_closed{ false };
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QtGlobal>
+#include <atomic>
+#include <memory>
+
+// A cheap, copyable handle to a "please stop" flag shared by the submitter of a task and the task itself.
+// Cancelling is cooperative: the task checks the token at convenient points and returns early. A default
+// constructed token can never be cancelled, so it's a valid "don't care" argument.
+class CancellationToken final {
+public:
+    [[nodiscard]] static CancellationToken create() {
+        CancellationToken token{};
+        token.m_state = std::make_shared<std::atomic_bool>(false);
+        return token;
+    }
+
+    // Thread safe, may be called any number of times.
+    void cancel() const {
+        if (m_state) {
+            m_state->store(true, std::memory_order_relaxed);
+        }
+    }
+
+    [[nodiscard]] bool isCancelled() const {
+        return m_state && m_state->load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool isCancellable() const {
+        return bool(m_state);
+    }
+
+private:
+    std::shared_ptr<std::atomic_bool> m_state{};
+};
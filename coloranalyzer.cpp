@@ -0,0 +1,1299 @@
+#include "coloranalyzer.h"
+#include "boundedqueue.h"
+#include "tracing.h"
+#include <QElapsedTimer>
+#include <QtMath>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QRegularExpression>
+#include <QScopeGuard>
+#include <QThread>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <tuple>
+#include <utility>
+
+using namespace Qt::StringLiterals;
+
+static constexpr const auto INVALID_COLOR_DISTANCE{ std::numeric_limits<qreal>::max() };
+
+// Below this k, a plain linear scan over all the centroids is faster than querying the k-d tree:
+// the scan is branch-light, while the tree pays for its recursion and its poor memory locality.
+// Measured with the "crossover" rows of benchmarks/assignmentbenchmark.cpp (200k pixels, median time
+// per pass): the scan wins at k=32 (by ~25%), both are even at k=64 on uniformly distributed pixels,
+// and the tree already wins by ~25% at k=64 on pixels clustered around a few colors, which is what
+// photos look like. Re-measure when touching either path.
+static constexpr const qsizetype KD_TREE_MIN_K{ 64 };
+
+// Multi-resolution mode: the image is halved until its longer side doesn't exceed this size, k-means
+// converges on that smallest level, and each larger level only gets a few iterations to refine the
+// centroids it inherited, they are already close to their final positions by then.
+static constexpr const int MULTI_RESOLUTION_BASE_SIZE{ 64 };
+static constexpr const qsizetype MULTI_RESOLUTION_REFINE_ITERATIONS{ 2 };
+
+// Memory budget: every clustered pixel costs its entry in the pixel list plus its entry in the index list
+// "clusterPixels()" shuffles to pick the initial centroids. The weights of palette images are negligible.
+static constexpr const qint64 CLUSTERED_PIXEL_BYTES{ qint64(sizeof(Pixel) + sizeof(qsizetype)) };
+// Below these, the budget is refused instead of producing a meaningless result.
+static constexpr const qsizetype MEMORY_BUDGET_MIN_SAMPLE_COUNT{ 1000 };
+static constexpr const int MEMORY_BUDGET_MIN_IMAGE_SIZE{ 32 };
+
+[[nodiscard]] static inline qreal colorDistance(Pixel lhs, Pixel rhs) {
+    const auto dr{ lhs.r - rhs.r };
+    const auto dg{ lhs.g - rhs.g };
+    const auto db{ lhs.b - rhs.b };
+    return qSqrt(qreal(dr * dr) + qreal(dg * dg) + qreal(db * db));
+}
+
+[[nodiscard]] static inline int squaredColorDistance(Pixel lhs, Pixel rhs) {
+    const int dr{ lhs.r - rhs.r };
+    const int dg{ lhs.g - rhs.g };
+    const int db{ lhs.b - rhs.b };
+    return dr * dr + dg * dg + db * db;
+}
+
+// A balanced k-d tree over the current centroids, stored implicitly in a flat array: the root of
+// the range [begin, end) is always at its middle. It's rebuilt once per iteration, which costs
+// O(k*log(k)) and is negligible compared to the O(N*log(k)) queries.
+class CentroidTree final {
+public:
+    void build(const QList<Pixel>& centroidList, qsizetype& allocationCount) {
+        if (m_nodeList.capacity() < centroidList.size()) {
+            ++allocationCount;
+        }
+        m_nodeList.resize(centroidList.size());
+        for (qsizetype index{ 0 }; index < centroidList.size(); ++index) {
+            m_nodeList[index] = Node{ centroidList[index], index, 0 };
+        }
+        buildRange(0, m_nodeList.size());
+    }
+
+    // Returns the same index as a linear scan would, including the tie-break rule (the lowest index wins).
+    [[nodiscard]] qsizetype nearest(const Pixel pixel) const {
+        Q_ASSERT(!m_nodeList.isEmpty());
+        int minimumDistance{ std::numeric_limits<int>::max() };
+        qsizetype closestIndex{ -1 };
+        searchRange(0, m_nodeList.size(), pixel, minimumDistance, closestIndex);
+        return closestIndex;
+    }
+
+    [[nodiscard]] qint64 memoryUsage() const {
+        return qint64(m_nodeList.capacity()) * qint64(sizeof(Node));
+    }
+
+private:
+    struct Node final {
+        Pixel centroid{};
+        qsizetype index{ -1 }; // Index into the original centroid list.
+        quint8 axis{ 0 }; // 0: red, 1: green, 2: blue.
+    };
+
+    [[nodiscard]] static inline int channel(const Pixel pixel, const quint8 axis) {
+        return axis == 0 ? pixel.r : (axis == 1 ? pixel.g : pixel.b);
+    }
+
+    void buildRange(const qsizetype begin, const qsizetype end) {
+        if (end - begin <= 0) {
+            return;
+        }
+        // Split along the channel with the largest spread.
+        int minimum[3]{ 255, 255, 255 };
+        int maximum[3]{ 0, 0, 0 };
+        for (qsizetype index{ begin }; index < end; ++index) {
+            for (quint8 axis{ 0 }; axis < 3; ++axis) {
+                const int value{ channel(m_nodeList[index].centroid, axis) };
+                minimum[axis] = qMin(minimum[axis], value);
+                maximum[axis] = qMax(maximum[axis], value);
+            }
+        }
+        quint8 splitAxis{ 0 };
+        for (quint8 axis{ 1 }; axis < 3; ++axis) {
+            if (maximum[axis] - minimum[axis] > maximum[splitAxis] - minimum[splitAxis]) {
+                splitAxis = axis;
+            }
+        }
+        const qsizetype middle{ begin + (end - begin) / 2 };
+        std::nth_element(m_nodeList.begin() + begin, m_nodeList.begin() + middle, m_nodeList.begin() + end,
+                         [splitAxis](const Node& lhs, const Node& rhs){
+                             return channel(lhs.centroid, splitAxis) < channel(rhs.centroid, splitAxis);
+                         });
+        m_nodeList[middle].axis = splitAxis;
+        buildRange(begin, middle);
+        buildRange(middle + 1, end);
+    }
+
+    void searchRange(const qsizetype begin, const qsizetype end, const Pixel pixel, int& minimumDistance, qsizetype& closestIndex) const {
+        if (end - begin <= 0) {
+            return;
+        }
+        const qsizetype middle{ begin + (end - begin) / 2 };
+        const Node& node{ m_nodeList[middle] };
+        const int distance{ squaredColorDistance(pixel, node.centroid) };
+        if (distance < minimumDistance || (distance == minimumDistance && node.index < closestIndex)) {
+            minimumDistance = distance;
+            closestIndex = node.index;
+        }
+        const int difference{ channel(pixel, node.axis) - channel(node.centroid, node.axis) };
+        // "<=" instead of "<" so that equally distant centroids on the far side are still visited for the tie-break.
+        if (difference < 0) {
+            searchRange(begin, middle, pixel, minimumDistance, closestIndex);
+            if (difference * difference <= minimumDistance) {
+                searchRange(middle + 1, end, pixel, minimumDistance, closestIndex);
+            }
+        } else {
+            searchRange(middle + 1, end, pixel, minimumDistance, closestIndex);
+            if (difference * difference <= minimumDistance) {
+                searchRange(begin, middle, pixel, minimumDistance, closestIndex);
+            }
+        }
+    }
+
+    QList<Node> m_nodeList{};
+};
+
+// Assignment kernels specialized for small k, which covers almost all the real world usages (4~8 is
+// the recommended range). The centroids are copied into a fixed size array and the scan over them is
+// fully unrolled at compile time. The squared distance and the centroid index are packed into a single
+// integer, so the minimum of them is the closest centroid (the lowest index on ties, same as the generic
+// loop) and it's found without any branch. Measured with the "fixedK" rows of benchmarks/assignmentbenchmark.cpp,
+// it takes about 30% less time than the generic loop from k=4 up to k=16, but up to 15% more for k=2 and k=3,
+// where the generic loop is already short and the packing doesn't pay for itself. Re-measure before changing
+// either of them.
+static constexpr const qsizetype FIXED_K_MIN{ 4 };
+static constexpr const int FIXED_K_INDEX_BITS{ 4 };
+static constexpr const qsizetype FIXED_K_MAX{ qsizetype(1) << FIXED_K_INDEX_BITS };
+
+using AssignKernel = void(*)(const QList<Pixel>& pixelList, const QList<qsizetype>& weightList, const QList<Pixel>& centroidList, QList<ClusterAccumulator>& clusterListOut);
+
+template <qsizetype K>
+static void assignPixelsFixedK(const QList<Pixel>& pixelList, const QList<qsizetype>& weightList, const QList<Pixel>& centroidList, QList<ClusterAccumulator>& clusterListOut) {
+    static_assert(K >= FIXED_K_MIN && K <= FIXED_K_MAX);
+    Q_ASSERT(centroidList.size() == K);
+    Q_ASSERT(clusterListOut.size() == K);
+    std::array<Pixel, K> centroidArray{};
+    std::copy_n(centroidList.cbegin(), K, centroidArray.begin());
+    std::array<ClusterAccumulator, K> clusterArray{};
+    const bool isWeighted{ !weightList.isEmpty() };
+    constexpr const int indexMask{ (1 << FIXED_K_INDEX_BITS) - 1 };
+    for (qsizetype pixelIndex{ 0 }; pixelIndex < pixelList.size(); ++pixelIndex) {
+        const Pixel pixel{ pixelList[pixelIndex] };
+        int key{ std::numeric_limits<int>::max() };
+        [&key, &pixel, &centroidArray]<std::size_t... Index>(std::index_sequence<Index...>){
+            ((key = std::min(key, (squaredColorDistance(pixel, centroidArray[Index]) << FIXED_K_INDEX_BITS) | int(Index))), ...);
+        }(std::make_index_sequence<std::size_t(K)>{});
+        const qsizetype weight{ isWeighted ? weightList[pixelIndex] : qsizetype(1) };
+        clusterArray[key & indexMask].add(pixel, weight, key >> FIXED_K_INDEX_BITS);
+    }
+    std::copy(clusterArray.cbegin(), clusterArray.cend(), clusterListOut.begin());
+}
+
+template <std::size_t K>
+[[nodiscard]] static consteval AssignKernel fixedKAssignKernel() {
+    if constexpr (qsizetype(K) >= FIXED_K_MIN) {
+        return &assignPixelsFixedK<qsizetype(K)>;
+    } else {
+        return nullptr;
+    }
+}
+
+static constexpr const auto FIXED_K_ASSIGN_KERNELS{ []<std::size_t... K>(std::index_sequence<K...>){
+    return std::array<AssignKernel, sizeof...(K)>{ fixedKAssignKernel<K>()... };
+}(std::make_index_sequence<std::size_t(FIXED_K_MAX + 1)>{}) };
+
+// Returns null if there is no specialized kernel for this k, the generic loop should be used instead.
+[[nodiscard]] static inline AssignKernel findFixedKAssignKernel(const qsizetype k) {
+    if (k < FIXED_K_MIN || k > FIXED_K_MAX) {
+        return nullptr;
+    }
+    return FIXED_K_ASSIGN_KERNELS[k];
+}
+
+struct AnalysisWorkspacePrivate final {
+    PixelData pixelData{};
+    QList<Pixel> centroidList{};
+    QList<Pixel> newCentroidList{};
+    QList<ClusterAccumulator> clusterList{};
+    QList<qsizetype> indexList{}; // Shuffled to pick the initial centroids, then used to sort the clusters.
+    QList<qsizetype> weightList{}; // The remaining weights while picking the initial centroids.
+    CentroidTree centroidTree{};
+    std::mt19937_64 randomEngine{ std::random_device{}() };
+    qsizetype allocationCount{ 0 };
+    NearestCentroidSearch nearestCentroidSearch{ NearestCentroidSearch::Automatic };
+
+    // Never shrinks the capacity, so the buffers stay at their high-water mark.
+    template <typename T>
+    void ensureSize(QList<T>& list, const qsizetype size) {
+        if (list.capacity() < size) {
+            ++allocationCount;
+            list.reserve(size);
+        }
+        list.resize(size);
+    }
+};
+
+AnalysisWorkspace::AnalysisWorkspace() : d_ptr{ std::make_unique<AnalysisWorkspacePrivate>() } {}
+
+AnalysisWorkspace::~AnalysisWorkspace() = default;
+
+qsizetype AnalysisWorkspace::allocationCount() const {
+    return d_ptr->allocationCount;
+}
+
+qint64 AnalysisWorkspace::memoryUsage() const {
+    const auto& bytes{ []<typename T>(const QList<T>& list){ return qint64(list.capacity()) * qint64(sizeof(T)); } };
+    const AnalysisWorkspacePrivate& ws{ *d_ptr };
+    return bytes(ws.pixelData.pixelList) + bytes(ws.pixelData.weightList) + bytes(ws.centroidList) + bytes(ws.newCentroidList)
+           + bytes(ws.clusterList) + bytes(ws.indexList) + bytes(ws.weightList) + ws.centroidTree.memoryUsage();
+}
+
+void AnalysisWorkspace::release() {
+    const qsizetype allocationCount{ d_ptr->allocationCount };
+    const NearestCentroidSearch nearestCentroidSearch{ d_ptr->nearestCentroidSearch };
+    *d_ptr = AnalysisWorkspacePrivate{};
+    d_ptr->allocationCount = allocationCount;
+    d_ptr->nearestCentroidSearch = nearestCentroidSearch;
+}
+
+void AnalysisWorkspace::setNearestCentroidSearch(const NearestCentroidSearch search) {
+    d_ptr->nearestCentroidSearch = search;
+}
+
+AnalysisWorkspacePrivate* AnalysisWorkspace::d_func() {
+    return d_ptr.get();
+}
+
+// Assigns every pixel to its closest centroid and accumulates the clusters, through the fastest path available for this k.
+static inline void assignPixelsToClusters(AnalysisWorkspacePrivate& ws, const QList<Pixel>& pixelList, const QList<qsizetype>& weightList, const QList<Pixel>& centroidList, QList<ClusterAccumulator>& clusterList) {
+    const qsizetype k{ centroidList.size() };
+    Q_ASSERT(clusterList.size() == k);
+    const bool isWeighted{ !weightList.isEmpty() };
+    const NearestCentroidSearch search{ ws.nearestCentroidSearch };
+    const bool useCentroidTree{ search == NearestCentroidSearch::CentroidTree || (search == NearestCentroidSearch::Automatic && k >= KD_TREE_MIN_K) };
+    if (!useCentroidTree && search != NearestCentroidSearch::LinearScan) {
+        if (const AssignKernel fixedKAssignKernel{ findFixedKAssignKernel(k) }) {
+            fixedKAssignKernel(pixelList, weightList, centroidList, clusterList);
+            return;
+        }
+    }
+    clusterList.fill(ClusterAccumulator{});
+    CentroidTree& centroidTree{ ws.centroidTree };
+    if (useCentroidTree) {
+        centroidTree.build(centroidList, ws.allocationCount);
+    }
+    for (qsizetype pixelIndex{ 0 }; pixelIndex < pixelList.size(); ++pixelIndex) {
+        const Pixel pixel{ pixelList[pixelIndex] };
+        qsizetype closestIndex{ -1 };
+        if (useCentroidTree) {
+            closestIndex = centroidTree.nearest(pixel);
+        } else {
+            auto minimumDistance{ INVALID_COLOR_DISTANCE };
+            for (qsizetype index{ 0 }; index < k; ++index) {
+                const auto distance{ colorDistance(pixel, centroidList[index]) };
+                Q_ASSERT(qFuzzyIsNull(distance) || distance > qreal(0));
+                Q_ASSERT(distance < INVALID_COLOR_DISTANCE);
+                if (distance < minimumDistance) {
+                    minimumDistance = distance;
+                    closestIndex = index;
+                }
+            }
+        }
+        Q_ASSERT(closestIndex >= 0);
+        Q_ASSERT(closestIndex < k);
+        const qsizetype weight{ isWeighted ? weightList[pixelIndex] : qsizetype(1) };
+        clusterList[closestIndex].add(pixel, weight, squaredColorDistance(pixel, centroidList[closestIndex]));
+    }
+}
+
+[[nodiscard]] static inline bool isPixelAccepted(const QRgb rgba, const int alphaThreshold) {
+    return alphaThreshold <= std::numeric_limits<quint8>::min() || alphaThreshold >= std::numeric_limits<quint8>::max() || qAlpha(rgba) >= alphaThreshold;
+}
+
+[[nodiscard]] static inline Pixel toPixel(const QRgb rgba) {
+    return Pixel{ static_cast<quint8>(qRed(rgba)), static_cast<quint8>(qGreen(rgba)), static_cast<quint8>(qBlue(rgba)) };
+}
+
+static inline void samplePixels(QList<Pixel>& pixelListOut, const QImage& image, const UserOptions& options, std::mt19937_64& mt64) {
+    Q_ASSERT(!image.isNull());
+    Q_ASSERT(options.samplingMethod != SamplingMethod::None);
+    Q_ASSERT(options.sampleBudget > 0);
+    const int width{ image.width() };
+    const int height{ image.height() };
+    const qsizetype budget{ qMin(options.sampleBudget, qsizetype(width) * qsizetype(height)) };
+    pixelListOut.reserve(budget);
+    switch (options.samplingMethod) {
+    case SamplingMethod::None:
+        Q_UNREACHABLE();
+        break;
+    case SamplingMethod::Uniform: {
+        // Sampling with replacement, the pixels rejected by the alpha threshold simply don't count,
+        // so that the sample stays unbiased with regard to the accepted pixels.
+        std::uniform_int_distribution<int> xDist(0, width - 1);
+        std::uniform_int_distribution<int> yDist(0, height - 1);
+        for (qsizetype index{ 0 }; index < budget; ++index) {
+            const QRgb rgba{ image.pixel(xDist(mt64), yDist(mt64)) };
+            if (isPixelAccepted(rgba, options.alphaThreshold)) {
+                pixelListOut.push_back(toPixel(rgba));
+            }
+        }
+    } break;
+    case SamplingMethod::Stratified: {
+        // Roughly square tiles, one sample from each of them. The tiles on the right and bottom edges
+        // may be a little smaller than the others, that's fine for our purpose. The row count is rounded
+        // down, so that we never take more samples than the budget (but up to one row less).
+        const int columnCount{ qBound(1, qCeil(qSqrt(qreal(budget) * qreal(width) / qreal(height))), int(qMin(qsizetype(width), budget))) };
+        const int rowCount{ qBound(1, int(budget / columnCount), height) };
+        Q_ASSERT(qsizetype(columnCount) * qsizetype(rowCount) <= budget);
+        for (int row{ 0 }; row < rowCount; ++row) {
+            const int top{ int(qint64(row) * height / rowCount) };
+            const int bottom{ int(qint64(row + 1) * height / rowCount) - 1 };
+            for (int column{ 0 }; column < columnCount; ++column) {
+                const int left{ int(qint64(column) * width / columnCount) };
+                const int right{ int(qint64(column + 1) * width / columnCount) - 1 };
+                const int x{ std::uniform_int_distribution<int>(left, qMax(left, right))(mt64) };
+                const int y{ std::uniform_int_distribution<int>(top, qMax(top, bottom))(mt64) };
+                const QRgb rgba{ image.pixel(x, y) };
+                if (isPixelAccepted(rgba, options.alphaThreshold)) {
+                    pixelListOut.push_back(toPixel(rgba));
+                }
+            }
+        }
+    } break;
+    case SamplingMethod::Reservoir: {
+        // Algorithm R: every accepted pixel ends up in the sample with the same probability,
+        // and we never hold more than "budget" pixels at the same time.
+        qsizetype seenCount{ 0 };
+        for (int y{ 0 }; y < height; ++y) {
+            for (int x{ 0 }; x < width; ++x) {
+                const QRgb rgba{ image.pixel(x, y) };
+                if (!isPixelAccepted(rgba, options.alphaThreshold)) {
+                    continue;
+                }
+                ++seenCount;
+                if (pixelListOut.size() < budget) {
+                    pixelListOut.push_back(toPixel(rgba));
+                    continue;
+                }
+                const auto replaceIndex{ std::uniform_int_distribution<qsizetype>(0, seenCount - 1)(mt64) };
+                if (replaceIndex < budget) {
+                    pixelListOut[replaceIndex] = toPixel(rgba);
+                }
+            }
+        }
+    } break;
+    }
+}
+
+[[nodiscard]] static inline bool isPalettizedFormat(const QImage::Format format) {
+    // Grayscale images are palettized images in disguise: 256 implicit palette entries.
+    return format == QImage::Format_Indexed8 || format == QImage::Format_Grayscale8;
+}
+
+[[nodiscard]] static inline bool isPalettized(const QImage& image) {
+    return isPalettizedFormat(image.format());
+}
+
+// Palette images are handled without expanding them to per-pixel RGB: one byte-wise pass over the
+// pixel indices to build a histogram, then each used (and accepted) palette entry becomes a single
+// weighted point. Entries sharing the same color are merged, so that all points are distinct.
+static inline void collectPaletteHistogram(QList<Pixel>& pixelListOut, QList<qsizetype>& weightListOut, const QImage& image, const UserOptions& options) {
+    Q_ASSERT(isPalettized(image));
+    pixelListOut.reserve(256);
+    weightListOut.reserve(256);
+    std::array<qsizetype, 256> histogram{};
+    const int width{ image.width() };
+    for (int y{ 0 }; y < image.height(); ++y) {
+        const uchar* const line{ image.constScanLine(y) };
+        for (int x{ 0 }; x < width; ++x) {
+            ++histogram[line[x]];
+        }
+    }
+    const bool isGrayscale{ image.format() == QImage::Format_Grayscale8 };
+    const qsizetype colorCount{ isGrayscale ? qsizetype(histogram.size()) : qsizetype(image.colorCount()) };
+    for (qsizetype index{ 0 }; index < qsizetype(histogram.size()); ++index) {
+        const qsizetype count{ histogram[index] };
+        if (count <= 0) {
+            continue;
+        }
+        // Broken files may reference entries beyond the color table, Qt treats them as transparent black.
+        const QRgb rgba{ isGrayscale ? qRgb(int(index), int(index), int(index)) : (index < colorCount ? image.color(int(index)) : QRgb(0)) };
+        // The alpha threshold is applied once per palette entry instead of once per pixel.
+        if (!isPixelAccepted(rgba, options.alphaThreshold)) {
+            continue;
+        }
+        const Pixel pixel{ toPixel(rgba) };
+        // At most 256 entries, a linear search is cheap enough and doesn't allocate.
+        const auto it{ std::find(pixelListOut.cbegin(), pixelListOut.cend(), pixel) };
+        if (it == pixelListOut.cend()) {
+            pixelListOut.push_back(pixel);
+            weightListOut.push_back(count);
+        } else {
+            weightListOut[std::distance(pixelListOut.cbegin(), it)] += count;
+        }
+    }
+}
+
+// The Wilson score interval (95% confidence) of a proportion estimated from a random sample.
+// Unlike the plain normal approximation, it behaves well for tiny clusters and small samples.
+[[nodiscard]] static inline std::pair<qreal, qreal> wilsonScoreInterval(const qsizetype successCount, const qsizetype sampleCount) {
+    Q_ASSERT(sampleCount > 0);
+    Q_ASSERT(successCount >= 0 && successCount <= sampleCount);
+    static constexpr const qreal z{ 1.959964 };
+    const auto n{ qreal(sampleCount) };
+    const qreal p{ qreal(successCount) / n };
+    const qreal denominator{ qreal(1) + z * z / n };
+    const qreal center{ (p + z * z / (qreal(2) * n)) / denominator };
+    const qreal halfWidth{ z * qSqrt(p * (qreal(1) - p) / n + z * z / (qreal(4) * n * n)) / denominator };
+    return { qMax(qreal(0), center - halfWidth), qMin(qreal(1), center + halfWidth) };
+}
+
+[[nodiscard]] static inline bool isOptionsValid(const UserOptions& options) {
+    Q_ASSERT(options.k > 1);
+    Q_ASSERT(options.maxIterations > 0);
+    Q_ASSERT(options.samplingMethod == SamplingMethod::None || options.sampleBudget > 0);
+    return options.k > 1 && options.maxIterations > 0 && (options.samplingMethod == SamplingMethod::None || options.sampleBudget > 0);
+}
+
+// Halves both dimensions with a 2x2 box filter. The colors are weighted by their alpha, so that
+// (nearly) transparent pixels don't bleed into their opaque neighbours. Odd edges reuse their last
+// row/column. "image" MUST be in the non-premultiplied ARGB32 format.
+[[nodiscard]] static inline QImage downsampleImage(const QImage& image) {
+    Q_ASSERT(image.format() == QImage::Format_ARGB32);
+    const int width{ image.width() };
+    const int height{ image.height() };
+    QImage result(qMax((width + 1) / 2, 1), qMax((height + 1) / 2, 1), QImage::Format_ARGB32);
+    for (int y{ 0 }; y < result.height(); ++y) {
+        const auto topLine{ reinterpret_cast<const QRgb*>(image.constScanLine(qMin(y * 2, height - 1))) };
+        const auto bottomLine{ reinterpret_cast<const QRgb*>(image.constScanLine(qMin(y * 2 + 1, height - 1))) };
+        const auto resultLine{ reinterpret_cast<QRgb*>(result.scanLine(y)) };
+        for (int x{ 0 }; x < result.width(); ++x) {
+            const int left{ qMin(x * 2, width - 1) };
+            const int right{ qMin(x * 2 + 1, width - 1) };
+            const std::array<QRgb, 4> sourceArray{ topLine[left], topLine[right], bottomLine[left], bottomLine[right] };
+            int a{ 0 };
+            int r{ 0 };
+            int g{ 0 };
+            int b{ 0 };
+            for (auto&& rgba : std::as_const(sourceArray)) {
+                const int alpha{ qAlpha(rgba) };
+                a += alpha;
+                r += qRed(rgba) * alpha;
+                g += qGreen(rgba) * alpha;
+                b += qBlue(rgba) * alpha;
+            }
+            resultLine[x] = a > 0 ? qRgba(r / a, g / a, b / a, (a + 2) / 4) : qRgba(0, 0, 0, 0);
+        }
+    }
+    return result;
+}
+
+// The size "prepareImage()" shrinks a (not palettized, not sampled) image of "size" to.
+[[nodiscard]] static inline QSize shrinkedSize(const QSize& size, const UserOptions& options) {
+    QSize result{ size };
+    if (options.maxWidth > 0) {
+        result.setWidth(qMin(result.width(), options.maxWidth));
+    }
+    if (options.maxHeight > 0) {
+        result.setHeight(qMin(result.height(), options.maxHeight));
+    }
+    return result;
+}
+
+void setImageFilePath(UserOptions& options, const QString& filePath) {
+    // Different spellings of the same path (relative, through symbolic links and so on) are still the same file.
+    const QString canonicalFilePath{ QFileInfo(filePath).canonicalFilePath() };
+    const bool isSameFile{ canonicalFilePath.isEmpty() ? filePath == options.filePath : canonicalFilePath == QFileInfo(options.filePath).canonicalFilePath() };
+    if (!isSameFile && options.regionOfInterest.isValid()) {
+        if constexpr (IS_DEBUG_BUILD) {
+            qDebug() << "The image file has changed, its region of interest" << options.regionOfInterest << "is dropped.";
+        }
+        options.regionOfInterest = QRect{};
+    }
+    options.filePath = filePath;
+}
+
+void applyRegionOfInterest(QImageReader& reader, const UserOptions& options) {
+    if (!options.regionOfInterest.isValid()) {
+        return;
+    }
+    QRect clipRect{ options.regionOfInterest };
+    // Some decoders don't clip natively, the generic fallback would pad the out of bounds area
+    // with (transparent) black pixels, which must not be counted.
+    const QSize imageSize{ reader.size() };
+    if (imageSize.isValid()) {
+        clipRect &= QRect(QPoint(0, 0), imageSize);
+    }
+    if (clipRect.isEmpty()) {
+        qWarning() << "The region of interest" << options.regionOfInterest << "lies outside of the image, the whole image will be analyzed.";
+        return;
+    }
+    reader.setClipRect(clipRect);
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Only the region of interest will be decoded:" << clipRect;
+    }
+}
+
+QImage readImage(const UserOptions& options, QString* errorMessageOut) {
+    const TraceSpan span{ "Decode image" };
+    QImageReader reader(options.filePath);
+    applyRegionOfInterest(reader, options);
+    QImage image{ reader.read() };
+    if (image.isNull() && errorMessageOut) {
+        *errorMessageOut = reader.errorString();
+    }
+    return image;
+}
+
+QImage readImage(UserOptions& options, MemoryPlan& planOut, const bool allowTiling, QString* errorMessageOut) {
+    const TraceSpan span{ "Decode image" };
+    QImageReader reader(options.filePath);
+    applyRegionOfInterest(reader, options);
+    if (!applyMemoryBudget(reader, options, planOut, allowTiling, errorMessageOut)) {
+        return {};
+    }
+    QImage image{ reader.read() };
+    if (image.isNull() && errorMessageOut) {
+        *errorMessageOut = reader.errorString();
+    }
+    return image;
+}
+
+qint64 estimateMemoryUsage(const QSize& imageSize, const QImage::Format format, const UserOptions& options, const int tileHeight) {
+    Q_ASSERT(imageSize.isValid());
+    if (Q_UNLIKELY(!imageSize.isValid())) {
+        return -1;
+    }
+    // Most decoders produce 32 bits per pixel, which is also what we assume if the handler can't tell in advance.
+    const qint64 bytesPerPixel{ format == QImage::Format_Invalid ? 4 : qMax(qint64(QImage::toPixelFormat(format).bitsPerPixel() / 8), qint64(1)) };
+    const qint64 decodedBytes{ qint64(imageSize.width()) * qint64(imageSize.height()) * bytesPerPixel };
+    const bool isPalette{ isPalettizedFormat(format) };
+    const bool isSampling{ options.samplingMethod != SamplingMethod::None };
+    const QSize preparedSize{ (isPalette || isSampling) ? imageSize : shrinkedSize(imageSize, options) };
+    const qint64 preparedPixelCount{ qint64(preparedSize.width()) * qint64(preparedSize.height()) };
+    const bool isShrinked{ preparedSize != imageSize };
+    // "prepareImage()" frees the decoded image once its shrinked copy exists, so these two are the peak of the first phase.
+    const qint64 shrinkBytes{ decodedBytes + (isShrinked ? preparedPixelCount * 4 : 0) };
+    qint64 clusterBytes{ isShrinked ? preparedPixelCount * 4 : decodedBytes };
+    if (isPalette) {
+        clusterBytes += 256 * qint64(sizeof(Pixel) + sizeof(qsizetype) * 3);
+    } else if (tileHeight > 0) {
+        // Only one band of pixels exists at a time, and no index list is needed.
+        clusterBytes += qint64(preparedSize.width()) * qint64(qMin(tileHeight, preparedSize.height())) * qint64(sizeof(Pixel));
+    } else {
+        clusterBytes += (isSampling ? qMin(qint64(options.sampleBudget), preparedPixelCount) : preparedPixelCount) * CLUSTERED_PIXEL_BYTES;
+        if (options.multiResolution && !isSampling && qMax(preparedSize.width(), preparedSize.height()) > MULTI_RESOLUTION_BASE_SIZE) {
+            // All the smaller levels (a quarter of the previous one each). Plus the temporary ARGB32 copy of level 0 the
+            // first box filter needs, unless the image already is in that format (smooth shrinking premultiplies it).
+            const bool needsConversion{ isShrinked || format != QImage::Format_ARGB32 };
+            clusterBytes += preparedPixelCount * 4 / 3 + (needsConversion ? preparedPixelCount * 4 : 0);
+        }
+    }
+    return qMax(shrinkBytes, clusterBytes);
+}
+
+bool applyMemoryBudget(QImageReader& reader, UserOptions& options, MemoryPlan& planOut, const bool allowTiling, QString* errorMessageOut) {
+    planOut = {};
+    const QSize imageSize{ reader.clipRect().isValid() ? reader.clipRect().size() : reader.size() };
+    if (!imageSize.isValid()) {
+        // Some handlers don't know the size before decoding, there is nothing we can plan then.
+        return true;
+    }
+    const QImage::Format format{ reader.imageFormat() };
+    planOut.decodeSize = imageSize;
+    planOut.estimatedBytes = estimateMemoryUsage(imageSize, format, options);
+    const qint64 budget{ options.memoryBudget };
+    if (budget <= 0 || planOut.estimatedBytes <= budget) {
+        return true;
+    }
+    const qint64 fullEstimatedBytes{ planOut.estimatedBytes };
+    const bool canScale{ reader.supportsOption(QImageIOHandler::ScaledSize) };
+    const bool isPalette{ isPalettizedFormat(format) };
+    const bool isSampling{ options.samplingMethod != SamplingMethod::None };
+    const auto& decodeAt{ [&reader, &planOut](const QSize& size, const qint64 estimatedBytes){
+        reader.setScaledSize(size);
+        planOut.strategy = MemoryStrategy::DecoderDownscale;
+        planOut.decodeSize = size;
+        planOut.estimatedBytes = estimatedBytes;
+    } };
+    // 1. The same pixels are analyzed, the full size image simply never exists.
+    if (canScale && !isPalette && !isSampling) {
+        const QSize targetSize{ shrinkedSize(imageSize, options) };
+        const qint64 estimatedBytes{ estimateMemoryUsage(targetSize, format, options) };
+        if (targetSize != imageSize && estimatedBytes <= budget) {
+            decodeAt(targetSize, estimatedBytes);
+        }
+    }
+    // 2. Still exact: only one band of pixels at a time. Pointless if the decoded image alone is too large.
+    if (planOut.strategy == MemoryStrategy::Full && allowTiling && !isPalette && !isSampling) {
+        UserOptions tilingOptions{ options };
+        tilingOptions.multiResolution = false;
+        const qint64 fixedBytes{ estimateMemoryUsage(imageSize, format, tilingOptions, 1) };
+        if (fixedBytes <= budget) {
+            const QSize preparedSize{ shrinkedSize(imageSize, options) };
+            const qint64 rowBytes{ qint64(preparedSize.width()) * qint64(sizeof(Pixel)) };
+            planOut.strategy = MemoryStrategy::Tiling;
+            planOut.tileHeight = int(qMin(qint64(1) + (budget - fixedBytes) / rowBytes, qint64(preparedSize.height())));
+            planOut.estimatedBytes = estimateMemoryUsage(imageSize, format, tilingOptions, planOut.tileHeight);
+            options.multiResolution = false;
+        }
+    }
+    // 3. As many samples of the full size image as the budget allows.
+    if (planOut.strategy == MemoryStrategy::Full && !isPalette) {
+        UserOptions samplingOptions{ options };
+        samplingOptions.samplingMethod = isSampling ? options.samplingMethod : SamplingMethod::Stratified;
+        samplingOptions.sampleBudget = 1;
+        const qint64 fixedBytes{ estimateMemoryUsage(imageSize, format, samplingOptions) };
+        const qint64 sampleCount{ fixedBytes <= budget ? (budget - fixedBytes) / CLUSTERED_PIXEL_BYTES : 0 };
+        if (sampleCount >= MEMORY_BUDGET_MIN_SAMPLE_COUNT) {
+            samplingOptions.sampleBudget = qsizetype(qMin(sampleCount, isSampling ? qint64(options.sampleBudget) : qint64(imageSize.width()) * qint64(imageSize.height())));
+            planOut.strategy = MemoryStrategy::Sampling;
+            planOut.estimatedBytes = estimateMemoryUsage(imageSize, format, samplingOptions);
+            options = std::move(samplingOptions);
+        }
+    }
+    // 4. Lossy: a smaller image than asked for, as large as the budget allows.
+    if (planOut.strategy == MemoryStrategy::Full && canScale) {
+        int lower{ 0 };
+        int upper{ qMax(imageSize.width(), imageSize.height()) };
+        while (lower < upper) {
+            const int middle{ lower + (upper - lower + 1) / 2 };
+            if (estimateMemoryUsage(imageSize.scaled(middle, middle, Qt::KeepAspectRatio).expandedTo(QSize(1, 1)), format, options) <= budget) {
+                lower = middle;
+            } else {
+                upper = middle - 1;
+            }
+        }
+        if (lower >= MEMORY_BUDGET_MIN_IMAGE_SIZE) {
+            const QSize targetSize{ imageSize.scaled(lower, lower, Qt::KeepAspectRatio).expandedTo(QSize(1, 1)) };
+            decodeAt(targetSize, estimateMemoryUsage(targetSize, format, options));
+        }
+    }
+    if (planOut.strategy == MemoryStrategy::Full) {
+        if (errorMessageOut) {
+            *errorMessageOut = u"The analysis needs about %1 MiB, which exceeds the memory budget of %2 MiB."_s.arg(
+                QString::number(fullEstimatedBytes / 1048576), QString::number(budget / 1048576));
+        }
+        return false;
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug().nospace() << "The analysis would need about " << fullEstimatedBytes << " bytes, exceeding the memory budget of " << budget
+                           << " bytes. Strategy: " << static_cast<int>(planOut.strategy) << ", decode size: " << planOut.decodeSize
+                           << ", tile height: " << planOut.tileHeight << ", sample budget: " << options.sampleBudget
+                           << ", estimated usage: " << planOut.estimatedBytes << " bytes.";
+    }
+    return true;
+}
+
+QImage prepareImage(QImage image, const UserOptions& options) {
+    const TraceSpan span{ "Prepare image" };
+    Q_ASSERT(!image.isNull());
+    if (Q_UNLIKELY(image.isNull())) {
+        return {};
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug().nospace() << "Image information: size: " << image.width() << "x" << image.height();
+        qDebug() << "Checking whether we need to shrink the image size to speed up the whole process ...";
+    }
+    // Palette images don't need to be shrinked (nor sampled): building the histogram is a single
+    // byte-wise pass, and we only need to cluster the palette entries afterwards.
+    // When sampling, the cost is already bounded by the sample budget, and we want to draw
+    // the samples from the original pixels, not the interpolated ones.
+    if (isPalettized(image) || options.samplingMethod != SamplingMethod::None || (options.maxWidth <= 0 && options.maxHeight <= 0)) {
+        if constexpr (IS_DEBUG_BUILD) {
+            qDebug() << "The image size is not shrinked, we will process the original image as-is.";
+        }
+        return image;
+    }
+    const QSize targetSize{ shrinkedSize(image.size(), options) };
+    const int targetWidth{ targetSize.width() };
+    const int targetHeight{ targetSize.height() };
+    if (Q_LIKELY(targetSize != image.size())) {
+        image = std::move(image.scaled(targetWidth, targetHeight, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+        Q_ASSERT(!image.isNull());
+        if constexpr (IS_DEBUG_BUILD) {
+            qDebug().nospace() << "Image size shrinked to: " << targetWidth << "x" << targetHeight;
+        }
+    } else if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "The image size is not shrinked, we will process the original image as-is.";
+    }
+    return image;
+}
+
+bool extractPixels(PixelData& pixelDataOut, const QImage& image, const UserOptions& options, AnalysisWorkspace* workspace) {
+    const TraceSpan span{ "Extract pixels" };
+    Q_ASSERT(!image.isNull());
+    if (Q_UNLIKELY(image.isNull() || !isOptionsValid(options))) {
+        qWarning() << "Function parameter not valid, algorithm forcely exited. Please try again with appropriate ones.";
+        return false;
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Preparing the pixel list ...";
+    }
+    const qsizetype imagePixelCount{ qsizetype(image.width()) * qsizetype(image.height()) };
+    const bool usePaletteHistogram{ isPalettized(image) };
+    const bool isSampling{ options.samplingMethod != SamplingMethod::None };
+    QList<Pixel>& pixelList{ pixelDataOut.pixelList };
+    QList<qsizetype>& weightList{ pixelDataOut.weightList };
+    // Counted on every way out, whichever of the paths below made the buffers grow.
+    const qsizetype initialPixelCapacity{ pixelList.capacity() };
+    const qsizetype initialWeightCapacity{ weightList.capacity() };
+    const auto growthCounter{ qScopeGuard([workspace, initialPixelCapacity, initialWeightCapacity, &pixelList, &weightList](){
+        if (!workspace) {
+            return;
+        }
+        AnalysisWorkspacePrivate& ws{ *workspace->d_func() };
+        if (pixelList.capacity() > initialPixelCapacity) {
+            ++ws.allocationCount;
+        }
+        if (weightList.capacity() > initialWeightCapacity) {
+            ++ws.allocationCount;
+        }
+    }) };
+    pixelList.clear();
+    weightList.clear();
+    if (usePaletteHistogram) {
+        collectPaletteHistogram(pixelList, weightList, image, options);
+    } else if (isSampling) {
+        // A workspace keeps its engine, seeding a new one costs a trip to the operating system on every image.
+        if (workspace) {
+            samplePixels(pixelList, image, options, workspace->d_func()->randomEngine);
+        } else {
+            std::mt19937_64 mt64{ std::random_device{}() };
+            samplePixels(pixelList, image, options, mt64);
+        }
+    } else {
+        pixelList.reserve(imagePixelCount);
+        for (int y{ 0 }; y < image.height(); ++y) {
+            for (int x{ 0 }; x < image.width(); ++x) {
+                const QRgb rgba{ image.pixel(x, y) };
+                if (Q_LIKELY(isPixelAccepted(rgba, options.alphaThreshold))) {
+                    // The Pixel struct is VERY small (only 3 bytes in total), move or copy doesn't have much difference in reality.
+                    pixelList.push_back(toPixel(rgba));
+                }
+            }
+        }
+    }
+    pixelDataOut.imagePixelCount = imagePixelCount;
+    // The palette histogram counts every pixel, so the ratios are exact even if sampling was requested.
+    pixelDataOut.isSampled = isSampling && !usePaletteHistogram;
+    // Not an assertion: a fully transparent image (or band, or frame) is perfectly valid input.
+    if (Q_UNLIKELY(pixelList.isEmpty())) {
+        qWarning() << "No valid pixels found, please check the image file and/or the alpha threshold.";
+        return false;
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        const qsizetype totalValidPixelCount{ pixelDataOut.totalWeight() };
+        qDebug() << "Pixel list generated.";
+        if (usePaletteHistogram) {
+            qDebug() << "Palette image detected, clustering" << pixelList.size() << "distinct palette entries instead of the pixels.";
+        } else if (isSampling) {
+            qDebug().nospace() << "Sampled " << totalValidPixelCount << " valid pixels out of " << imagePixelCount << " pixels.";
+        }
+        const qsizetype invalidPixelCount{ imagePixelCount - totalValidPixelCount };
+        qDebug().nospace() << "Total pixel count: " << imagePixelCount << ", valid pixel count: " << totalValidPixelCount << " ("
+                           << qreal(totalValidPixelCount) / qreal(imagePixelCount) * qreal(100)
+                           << "%), invalid pixel count: " << invalidPixelCount << " ("
+                           << qreal(invalidPixelCount) / qreal(imagePixelCount) * qreal(100) << "%)";
+    }
+    return true;
+}
+
+bool clusterPixels(ColorItemList& resultOut, const PixelData& pixelData, const UserOptions& options, AnalysisWorkspace* workspace, const ColorItemList& warmStartList, AnalysisStatistics* statisticsOut) {
+    const TraceSpan span{ "Cluster pixels", pixelData.pixelList.size() };
+    QElapsedTimer timer{};
+    timer.start();
+    if (Q_UNLIKELY(pixelData.pixelList.isEmpty() || !isOptionsValid(options))) {
+        qWarning() << "Function parameter not valid, algorithm forcely exited. Please try again with appropriate ones.";
+        return false;
+    }
+    std::unique_ptr<AnalysisWorkspace> temporaryWorkspace{};
+    if (!workspace) {
+        temporaryWorkspace = std::make_unique<AnalysisWorkspace>();
+        workspace = temporaryWorkspace.get();
+    }
+    AnalysisWorkspacePrivate& ws{ *workspace->d_func() };
+    [[maybe_unused]] const qsizetype initialAllocationCount{ ws.allocationCount };
+    const QList<Pixel>& pixelList{ pixelData.pixelList };
+    const QList<qsizetype>& weightList{ pixelData.weightList };
+    const bool isWeighted{ !weightList.isEmpty() };
+    Q_ASSERT(!isWeighted || weightList.size() == pixelList.size());
+    const bool isSampled{ pixelData.isSampled };
+    const qsizetype totalValidPixelCount{ pixelData.totalWeight() };
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Start building random centroid list ...";
+    }
+    QList<Pixel>& centroidList{ ws.centroidList };
+    ws.ensureSize(centroidList, options.k);
+    const auto& generateRandomCentroidList{ [isWeighted, totalValidPixelCount, &pixelList, &weightList, &centroidList, &options, &ws](){
+        std::mt19937_64& mt64{ ws.randomEngine };
+        if (isWeighted) {
+            // Pick the weighted points with the same probability as picking one of the pixels they
+            // stand for, without picking the same point twice.
+            QList<qsizetype>& remainingWeightList{ ws.weightList };
+            ws.ensureSize(remainingWeightList, weightList.size());
+            std::copy(weightList.cbegin(), weightList.cend(), remainingWeightList.begin());
+            qsizetype remainingTotalWeight{ totalValidPixelCount };
+            for (qsizetype index{ 0 }; index < options.k && index < pixelList.size(); ++index) {
+                qsizetype target{ std::uniform_int_distribution<qsizetype>(0, remainingTotalWeight - 1)(mt64) };
+                qsizetype randomIndex{ 0 };
+                while (target >= remainingWeightList[randomIndex]) {
+                    target -= remainingWeightList[randomIndex];
+                    ++randomIndex;
+                }
+                centroidList[index] = pixelList[randomIndex];
+                remainingTotalWeight -= remainingWeightList[randomIndex];
+                remainingWeightList[randomIndex] = 0;
+            }
+            return;
+        }
+        // A partial Fisher-Yates shuffle, we only need the first k indices to be random.
+        QList<qsizetype>& indiceList{ ws.indexList };
+        ws.ensureSize(indiceList, pixelList.size());
+        std::iota(indiceList.begin(), indiceList.end(), qsizetype(0));
+        for (qsizetype index{ 0 }; index < options.k && index < pixelList.size(); ++index) {
+            const auto randomIndex{ std::uniform_int_distribution<qsizetype>(index, indiceList.size() - 1)(mt64) };
+            std::swap(indiceList[index], indiceList[randomIndex]);
+            centroidList[index] = pixelList[indiceList[index]];
+        }
+    } };
+    if (warmStartList.size() == options.k) {
+        // Usually the result of a very similar image (eg. the previous frame of an animation),
+        // so we are already close to convergence.
+        for (qsizetype index{ 0 }; index < options.k; ++index) {
+            const QColor& color{ warmStartList[index].color };
+            centroidList[index] = Pixel{ static_cast<quint8>(color.red()), static_cast<quint8>(color.green()), static_cast<quint8>(color.blue()) };
+        }
+    } else {
+        generateRandomCentroidList();
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Initial centroid list generated.";
+        qDebug() << "Start building cluster list ...";
+    }
+    QList<ClusterAccumulator>& clusterList{ ws.clusterList };
+    ws.ensureSize(clusterList, options.k);
+    if constexpr (IS_DEBUG_BUILD) {
+        if (options.k >= KD_TREE_MIN_K) {
+            qDebug() << "k is large, the nearest centroids will be looked up through a k-d tree.";
+        } else if (findFixedKAssignKernel(options.k)) {
+            qDebug() << "Using the assignment kernel specialized for k =" << options.k;
+        }
+    }
+    const auto& assignPixels{ [&pixelList, &weightList, &centroidList, &clusterList, &ws](){
+        assignPixelsToClusters(ws, pixelList, weightList, centroidList, clusterList);
+    } };
+    const auto& hasEmptyCluster{ [&clusterList](){
+        return std::any_of(clusterList.cbegin(), clusterList.cend(), [](const ClusterAccumulator& cluster){ return cluster.count <= 0; });
+    } };
+    // Moves the centroid of each empty cluster onto the farthest member of the cluster with the largest
+    // spread, which effectively splits that cluster into two. Much cheaper than throwing away all the
+    // progress and starting over with new random centroids. Returns the number of repaired clusters,
+    // zero means no cluster has anything left to split: every cluster only contains a single color.
+    const auto& repairEmptyClusters{ [&clusterList, &centroidList, &options](){
+        qsizetype repairedCount{ 0 };
+        for (qsizetype index{ 0 }; index < options.k; ++index) {
+            if (clusterList[index].count > 0) {
+                continue;
+            }
+            const auto donor{ std::max_element(clusterList.begin(), clusterList.end(), [](const ClusterAccumulator& lhs, const ClusterAccumulator& rhs){
+                return lhs.farthestDistance < rhs.farthestDistance;
+            }) };
+            if (donor->farthestDistance <= 0) {
+                break;
+            }
+            centroidList[index] = donor->farthestPixel;
+            // Each donor can only give away one member per round, the others will be handled in the next iteration.
+            donor->farthestDistance = 0;
+            ++repairedCount;
+        }
+        return repairedCount;
+    } };
+    AnalysisStatistics statistics{};
+    while (true) {
+        Q_ASSERT(statistics.restartCount <= 10);
+        if (statistics.restartCount > 10) {
+            // Critical message, always output, no matter whether this is a debug build or not.
+            qCritical() << "Failed too many times, algorithm forcely exited. Please try again.";
+            return false;
+        }
+        if constexpr (IS_DEBUG_BUILD) {
+            qDebug() << "Start iterating.";
+        }
+        bool badClusterDetected{ false };
+        bool converged{ false };
+        for (qsizetype iteration{ 0 }; iteration < options.maxIterations; ++iteration) {
+            if constexpr (IS_DEBUG_BUILD) {
+                qDebug() << "Current iteration:" << iteration + 1;
+            }
+            ++statistics.iterationCount;
+            const TraceSpan iterationSpan{ "K-means iteration", statistics.iterationCount };
+            assignPixels();
+            if (hasEmptyCluster()) {
+                const qsizetype repairedCount{ repairEmptyClusters() };
+                if (repairedCount <= 0) {
+                    // Restarting won't help either, there are simply not enough distinct colors.
+                    qWarning() << "The image contains less than" << options.k << "distinct colors, please try again with a smaller k.";
+                    return false;
+                }
+                statistics.clusterRepairCount += repairedCount;
+                if constexpr (IS_DEBUG_BUILD) {
+                    qDebug() << "Found empty cluster(s), re-seeded" << repairedCount << "of them in place.";
+                }
+                continue;
+            }
+            bool changed{ false };
+            QList<Pixel>& newCentroidList{ ws.newCentroidList };
+            ws.ensureSize(newCentroidList, options.k);
+            for (qsizetype index{ 0 }; index < options.k; ++index) {
+                const auto& cluster{ clusterList[index] };
+                Q_ASSERT(cluster.count > 0);
+                Q_ASSERT(cluster.count < totalValidPixelCount);
+                const auto totalPixelCount{ qreal(cluster.count) };
+                const quint64 r = qRound64(qreal(cluster.r) / totalPixelCount);
+                Q_ASSERT(r >= std::numeric_limits<quint8>::min() && r <= std::numeric_limits<quint8>::max());
+                const quint64 g = qRound64(qreal(cluster.g) / totalPixelCount);
+                Q_ASSERT(g >= std::numeric_limits<quint8>::min() && g <= std::numeric_limits<quint8>::max());
+                const quint64 b = qRound64(qreal(cluster.b) / totalPixelCount);
+                Q_ASSERT(b >= std::numeric_limits<quint8>::min() && b <= std::numeric_limits<quint8>::max());
+                newCentroidList[index] = Pixel{ static_cast<quint8>(r), static_cast<quint8>(g), static_cast<quint8>(b) };
+                if (colorDistance(centroidList[index], newCentroidList[index]) > qreal(1)) {
+                    changed = true;
+                }
+            }
+            if (!changed) {
+                converged = true;
+                if constexpr (IS_DEBUG_BUILD) {
+                    qDebug() << "Result seems to be stable enough now. Iteration ended normally. Final iteration count:" << iteration + 1;
+                }
+                break;
+            }
+            centroidList.swap(newCentroidList);
+        }
+        if (!converged) {
+            // We ran out of iterations, the cluster sizes we have belong to the previous centroids,
+            // so assign the pixels one last time to make them match the final ones.
+            assignPixels();
+            badClusterDetected = hasEmptyCluster();
+        }
+        if (badClusterDetected) {
+            ++statistics.restartCount;
+            generateRandomCentroidList();
+            if constexpr (IS_DEBUG_BUILD) {
+                qWarning() << "Found bad cluster after the last iteration.";
+                qDebug() << "Centroid list regenerated. Re-starting iteration now ...";
+            }
+            continue;
+        }
+        break;
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug().nospace() << "Total iteration count: " << statistics.iterationCount << ", repaired clusters: "
+                           << statistics.clusterRepairCount << ", restarts: " << statistics.restartCount;
+    }
+    if (statisticsOut) {
+        *statisticsOut = statistics;
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Cluster list stablized, start re-ordering them by their pixel count ...";
+    }
+    QList<qsizetype>& clusterIndexList{ ws.indexList };
+    ws.ensureSize(clusterIndexList, options.k);
+    std::iota(clusterIndexList.begin(), clusterIndexList.end(), qsizetype(0));
+    std::sort(clusterIndexList.begin(), clusterIndexList.end(),
+              [&clusterList](qsizetype indexLHS, qsizetype indexRHS){
+                  return clusterList[indexLHS].count < clusterList[indexRHS].count;
+              });
+    const auto& generateResultForIndex{ [totalValidPixelCount, isSampled, &centroidList, &clusterList, &options](const qsizetype clusterIndex){
+        Q_ASSERT(clusterIndex >= 0);
+        Q_ASSERT(clusterIndex < options.k);
+        const Pixel pixel{ centroidList[clusterIndex] };
+        ColorItem result{};
+        result.color = std::move(QColor::fromRgb(static_cast<int>(pixel.r), static_cast<int>(pixel.g), static_cast<int>(pixel.b)));
+        const qsizetype clusterSize{ clusterList[clusterIndex].count };
+        Q_ASSERT(clusterSize > 0);
+        Q_ASSERT(clusterSize < totalValidPixelCount);
+        result.ratio = qreal(clusterSize) / qreal(totalValidPixelCount);
+        if (isSampled) {
+            std::tie(result.ratioLowerBound, result.ratioUpperBound) = wilsonScoreInterval(clusterSize, totalValidPixelCount);
+        } else {
+            result.ratioLowerBound = result.ratio;
+            result.ratioUpperBound = result.ratio;
+        }
+        return std::move(result);
+    } };
+    if constexpr (IS_DEBUG_BUILD) {
+        const qsizetype clusterIndex{ clusterIndexList.constLast() };
+        const auto result{ generateResultForIndex(clusterIndex) };
+        qDebug().noquote().nospace() << "Re-ordering done. The most dominant color is: " << std::move(result.color.name().toUpper()) << ", ratio: " << result.ratio * qreal(100) << "%"
+                                     << " [" << result.ratioLowerBound * qreal(100) << "%, " << result.ratioUpperBound * qreal(100) << "%]";
+        qDebug() << "Start generating result ...";
+    }
+    resultOut.resize(options.k);
+    for (qsizetype index{ 0 }; index < options.k; ++index) {
+        const qsizetype clusterIndex{ clusterIndexList[index] };
+        auto result{ generateResultForIndex(clusterIndex) };
+        resultOut[index] = std::move(result);
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Result ready. Everything DONE now.";
+        qDebug() << "Clustering elapsed time:" << timer.elapsed() << "milliseconds.";
+        qDebug() << "Workspace buffers grown during this run:" << ws.allocationCount - initialAllocationCount;
+        qDebug() << "Workspace memory usage:" << workspace->memoryUsage() << "bytes.";
+    }
+    return true;
+}
+
+bool accumulateClusters(QList<ClusterAccumulator>& clusterListOut, const PixelData& pixelData, const QList<Pixel>& centroidList, AnalysisWorkspace* workspace) {
+    Q_ASSERT(!centroidList.isEmpty());
+    if (Q_UNLIKELY(centroidList.isEmpty())) {
+        qWarning() << "Function parameter not valid, algorithm forcely exited. Please try again with appropriate ones.";
+        return false;
+    }
+    std::unique_ptr<AnalysisWorkspace> temporaryWorkspace{};
+    if (!workspace) {
+        temporaryWorkspace = std::make_unique<AnalysisWorkspace>();
+        workspace = temporaryWorkspace.get();
+    }
+    clusterListOut.resize(centroidList.size());
+    assignPixelsToClusters(*workspace->d_func(), pixelData.pixelList, pixelData.weightList, centroidList, clusterListOut);
+    return true;
+}
+
+bool clusterImage(ColorItemList& resultOut, const QImage& image, const UserOptions& options, AnalysisWorkspace* workspace, const ColorItemList& warmStartList, AnalysisStatistics* statisticsOut) {
+    Q_ASSERT(!image.isNull());
+    if (Q_UNLIKELY(image.isNull() || !isOptionsValid(options))) {
+        qWarning() << "Function parameter not valid, algorithm forcely exited. Please try again with appropriate ones.";
+        return false;
+    }
+    std::unique_ptr<AnalysisWorkspace> temporaryWorkspace{};
+    if (!workspace) {
+        temporaryWorkspace = std::make_unique<AnalysisWorkspace>();
+        workspace = temporaryWorkspace.get();
+    }
+    PixelData& pixelData{ workspace->d_func()->pixelData };
+    // Palette images and samples are already cheap to cluster, there is nothing to gain from a pyramid for them.
+    const bool useMultiResolution{ options.multiResolution && !isPalettized(image) && options.samplingMethod == SamplingMethod::None
+                                   && qMax(image.width(), image.height()) > MULTI_RESOLUTION_BASE_SIZE };
+    if (!useMultiResolution) {
+        return extractPixels(pixelData, image, options, workspace) && clusterPixels(resultOut, pixelData, options, workspace, warmStartList, statisticsOut);
+    }
+    // Built once up front: each level is a box filtered copy of the previous one, level 0 is the image itself.
+    // Only the box filter needs ARGB32, so level 0 is not copied, its converted copy only lives while the first
+    // smaller level is being built.
+    QList<QImage> levelList{ image };
+    {
+        const TraceSpan span{ "Build pyramid" };
+        while (qMax(levelList.constLast().width(), levelList.constLast().height()) > MULTI_RESOLUTION_BASE_SIZE) {
+            const QImage& previousLevel{ levelList.constLast() };
+            QImage level{ downsampleImage(previousLevel.format() == QImage::Format_ARGB32 ? previousLevel : previousLevel.convertToFormat(QImage::Format_ARGB32)) };
+            levelList.push_back(std::move(level));
+        }
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug().nospace() << "Multi-resolution mode: " << levelList.size() << " levels, the smallest one is "
+                           << levelList.constLast().width() << "x" << levelList.constLast().height();
+    }
+    ColorItemList levelResult{ warmStartList };
+    bool hasConverged{ false };
+    AnalysisStatistics totalStatistics{};
+    UserOptions levelOptions{ options };
+    for (qsizetype level{ levelList.size() - 1 }; level >= 0; --level) {
+        // The first successful level starts from scratch (or from the caller's warm start) and runs to
+        // convergence, all the following ones only refine the centroids they inherited.
+        const TraceSpan span{ "Pyramid level", level };
+        levelOptions.maxIterations = hasConverged ? qMin(options.maxIterations, MULTI_RESOLUTION_REFINE_ITERATIONS) : options.maxIterations;
+        ColorItemList result{};
+        AnalysisStatistics statistics{};
+        const bool ok{ extractPixels(pixelData, levelList[level], options, workspace) && clusterPixels(result, pixelData, levelOptions, workspace, levelResult, &statistics) };
+        levelList[level] = {};
+        totalStatistics.iterationCount += statistics.iterationCount;
+        totalStatistics.clusterRepairCount += statistics.clusterRepairCount;
+        totalStatistics.restartCount += statistics.restartCount;
+        if (!ok) {
+            if (level == 0) {
+                return false;
+            }
+            // The small levels may have less than k distinct colors, or no accepted pixel at all when the alpha
+            // averaged below the threshold, simply try again one level up.
+            if constexpr (IS_DEBUG_BUILD) {
+                qDebug() << "Failed to cluster level" << level << ", moving on to the next larger level.";
+            }
+            continue;
+        }
+        levelResult = std::move(result);
+        hasConverged = true;
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Multi-resolution mode: total iteration count:" << totalStatistics.iterationCount;
+    }
+    if (statisticsOut) {
+        *statisticsOut = totalStatistics;
+    }
+    resultOut = std::move(levelResult);
+    return true;
+}
+
+bool extractColorsFromImage(ColorItemList& resultOut, QImage imageIn, const UserOptions& options, AnalysisWorkspace* workspace, const ColorItemList& warmStartList, AnalysisStatistics* statisticsOut) {
+    const TraceSpan span{ "Extract colors from image" };
+    QElapsedTimer timer{};
+    timer.start();
+    if constexpr (IS_DEBUG_BUILD) {
+        qInfo() << "------------------------------------------------------";
+        qDebug() << "Checking whether there are any in-appropriate function parameters ...";
+        qDebug().nospace() << "k=" << options.k << ", maxIterations=" << options.maxIterations << ", maxWidth=" << options.maxWidth << ", maxHeight=" << options.maxHeight << ", alphaThreshold=" << options.alphaThreshold
+                           << ", samplingMethod=" << static_cast<int>(options.samplingMethod) << ", sampleBudget=" << options.sampleBudget << ", multiResolution=" << options.multiResolution;
+    }
+    Q_ASSERT(!imageIn.isNull());
+    if (Q_UNLIKELY(imageIn.isNull() || !isOptionsValid(options))) {
+        qWarning() << "Function parameter not valid, algorithm forcely exited. Please try again with appropriate ones.";
+        return false;
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "All function parameters seems to be valid.";
+    }
+    if (!clusterImage(resultOut, prepareImage(std::move(imageIn), options), options, workspace, warmStartList, statisticsOut)) {
+        return false;
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Total elapsed time:" << timer.elapsed() << "milliseconds.";
+    }
+    return true;
+}
+
+QStringList findImageSequenceFilePaths(const QString& filePath) {
+    Q_ASSERT(!filePath.isEmpty());
+    const QFileInfo fileInfo(filePath);
+    // "frame_0001.png" -> "frame_", "0001", ".png"
+    static const QRegularExpression numberedFileNameRegex{ u"^(.*?)(\\d+)(\\.[^.]+)?$"_s };
+    const QRegularExpressionMatch match{ numberedFileNameRegex.match(fileInfo.fileName()) };
+    if (!match.hasMatch()) {
+        return { filePath };
+    }
+    const QString prefix{ match.captured(1) };
+    const QString suffix{ match.captured(3) };
+    const QRegularExpression siblingRegex{ u"^%1(\\d+)%2$"_s.arg(QRegularExpression::escape(prefix), QRegularExpression::escape(suffix)) };
+    const QDir dir{ fileInfo.absoluteDir() };
+    QList<std::pair<qulonglong, QString>> frameList{};
+    const QStringList fileNameList{ dir.entryList({ prefix + u'*' + suffix }, QDir::Files | QDir::Readable) };
+    for (auto&& fileName : std::as_const(fileNameList)) {
+        const QRegularExpressionMatch siblingMatch{ siblingRegex.match(fileName) };
+        if (siblingMatch.hasMatch()) {
+            frameList.push_back({ siblingMatch.captured(1).toULongLong(), dir.absoluteFilePath(fileName) });
+        }
+    }
+    if (frameList.size() <= 1) {
+        return { filePath };
+    }
+    std::sort(frameList.begin(), frameList.end());
+    QStringList filePathList{};
+    filePathList.reserve(frameList.size());
+    for (auto&& frame : std::as_const(frameList)) {
+        filePathList.push_back(frame.second);
+    }
+    return filePathList;
+}
+
+bool analyzeImageSequence(QList<ColorItemList>& timelineOut, const UserOptions& options, AnalysisWorkspace* workspace, const CancellationToken& cancellationToken) {
+    const TraceSpan span{ "Analyze image sequence" };
+    QElapsedTimer timer{};
+    timer.start();
+    Q_ASSERT(!options.filePath.isEmpty());
+    if (Q_UNLIKELY(options.filePath.isEmpty())) {
+        return false;
+    }
+    const QStringList filePathList{ findImageSequenceFilePaths(options.filePath) };
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Analyzing the image sequence of" << filePathList.size() << "file(s).";
+    }
+    // The frames of a sequence share their size, so the memory budget is planned once, from the first file.
+    // Tiling is not available here: it can't warm start from the previous frame. The budget applies to the
+    // frame being analyzed, the few frames waiting in the queue come on top of it.
+    UserOptions frameOptions{ options };
+    QSize frameDecodeSize{};
+    if (options.memoryBudget > 0) {
+        QImageReader reader(filePathList.constFirst());
+        applyRegionOfInterest(reader, frameOptions);
+        MemoryPlan memoryPlan{};
+        QString errorMessage{};
+        if (!applyMemoryBudget(reader, frameOptions, memoryPlan, false, &errorMessage)) {
+            qWarning().noquote() << errorMessage;
+            return false;
+        }
+        if (memoryPlan.strategy == MemoryStrategy::DecoderDownscale) {
+            frameDecodeSize = memoryPlan.decodeSize;
+        }
+    }
+    // Decoding is done on a separate thread so that it overlaps with the clustering of the previous
+    // frames. The queue is kept short: we only need to stay a little ahead of the consumer, and the
+    // decoded frames may be huge.
+    BoundedQueue<QImage> frameQueue{ 4 };
+    const std::unique_ptr<QThread> readerThread{ QThread::create([&frameQueue, &filePathList, &options, frameDecodeSize](){
+        for (auto&& filePath : std::as_const(filePathList)) {
+            QImageReader reader(filePath);
+            applyRegionOfInterest(reader, options);
+            if (frameDecodeSize.isValid()) {
+                reader.setScaledSize(frameDecodeSize);
+            }
+            while (true) {
+                QImage frame{};
+                {
+                    const TraceSpan span{ "Decode frame" };
+                    if (!reader.read(&frame)) {
+                        break;
+                    }
+                }
+                if (!frameQueue.push(std::move(frame))) {
+                    return; // Canceled by the consumer.
+                }
+                // Animation handlers (GIF, WebP, etc.) advance to the next frame by themselves,
+                // multi-page formats (eg. TIFF) need an explicit jump.
+                if (reader.supportsAnimation() ? !reader.canRead() : !reader.jumpToNextImage()) {
+                    break;
+                }
+            }
+        }
+        frameQueue.close();
+    }) };
+    readerThread->setObjectName(u"FrameReaderThread"_s);
+    readerThread->start();
+    timelineOut.clear();
+    ColorItemList previousResult{};
+    std::unique_ptr<AnalysisWorkspace> temporaryWorkspace{};
+    if (!workspace) {
+        temporaryWorkspace = std::make_unique<AnalysisWorkspace>();
+        workspace = temporaryWorkspace.get();
+    }
+    qsizetype successCount{ 0 };
+    qsizetype totalIterationCount{ 0 };
+    QImage frame{};
+    while (frameQueue.pop(frame)) {
+        if (cancellationToken.isCancelled() || QThread::currentThread()->isInterruptionRequested()) {
+            break;
+        }
+        ColorItemList result{};
+        AnalysisStatistics statistics{};
+        if (extractColorsFromImage(result, std::move(frame), frameOptions, workspace, previousResult, &statistics)) {
+            previousResult = result;
+            ++successCount;
+        } else {
+            // Keep the frame indices aligned, a failed frame (eg. a fully transparent one) simply has no colors.
+            result.clear();
+        }
+        totalIterationCount += statistics.iterationCount;
+        timelineOut.push_back(std::move(result));
+    }
+    frameQueue.close();
+    readerThread->wait();
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug().nospace() << "Image sequence analyzed: " << timelineOut.size() << " frame(s), " << successCount << " succeeded, "
+                           << qreal(totalIterationCount) / qreal(qMax(timelineOut.size(), qsizetype(1))) << " iterations per frame on average, "
+                           << timer.elapsed() << " milliseconds in total.";
+    }
+    return successCount > 0;
+}
+
@@ -0,0 +1,252 @@
+#pragma once
+
+#include "cancellationtoken.h"
+#include <QColor>
+#include <QImage>
+#include <QRect>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QHashFunctions>
+#include <memory>
+#include <numeric>
+
+QT_BEGIN_NAMESPACE
+class QImageReader;
+QT_END_NAMESPACE
+
+#ifdef _DEBUG
+inline constexpr const bool IS_DEBUG_BUILD{ true };
+#else
+inline constexpr const bool IS_DEBUG_BUILD{ false };
+#endif
+
+struct Pixel final {
+    quint8 r{ 0 };
+    quint8 g{ 0 };
+    quint8 b{ 0 };
+
+    friend bool operator==(Pixel lhs, Pixel rhs);
+    friend bool operator!=(Pixel lhs, Pixel rhs);
+
+    friend std::size_t qHash(Pixel key, std::size_t seed);
+};
+
+[[nodiscard]] inline bool operator==(Pixel lhs, Pixel rhs) {
+    return lhs.r == rhs.r && lhs.g == rhs.g && lhs.b == rhs.b;
+}
+
+[[nodiscard]] inline bool operator!=(Pixel lhs, Pixel rhs) {
+    return !operator==(lhs, rhs);
+}
+
+[[nodiscard]] inline std::size_t qHash(Pixel key, std::size_t seed = 0) {
+    return qHashMulti(seed, key.r, key.g, key.b);
+}
+
+struct ColorItem final {
+    QColor color{};
+    qreal ratio{ 0 };
+    // The 95% confidence interval of "ratio". Only meaningful when the result is estimated from
+    // a random sample of the image, otherwise both bounds are equal to "ratio".
+    qreal ratioLowerBound{ 0 };
+    qreal ratioUpperBound{ 0 };
+};
+using ColorItemList = QList<ColorItem>;
+
+enum class SamplingMethod : quint8 {
+    None, // Use every (valid) pixel of the (possibly shrinked) image.
+    Uniform, // Pick pixels at random positions of the whole image.
+    Stratified, // Split the image into tiles and pick one random pixel from each of them.
+    Reservoir // Scan all the pixels line by line and keep a uniformly distributed subset of them.
+};
+
+struct UserOptions final {
+    QString filePath{}; // MUST be a local file path, not an URL.
+    qsizetype k{ 5 }; // 4~8 is best, don't be too large (eg. > 20)! We want to get the most "attractive" color, if k is too large, the result would be distracted!
+    qsizetype maxIterations{ 50 }; // Most of the time the iteration will stop at around 20 or so.
+    int maxWidth{ 100 }; // If > 0, the image size will be shrinked to not exceed this width. The image width won't be changed if this value <= 0.
+    int maxHeight{ 100 }; // Same as above, just only applied to height.
+    int alphaThreshold{ 180 }; // If > 0 and < 255, only the pixels whose alpha >= this value are accepted.
+    SamplingMethod samplingMethod{ SamplingMethod::None }; // If not "None", the image won't be shrinked, we sample the original image directly instead.
+    qsizetype sampleBudget{ 10000 }; // How many pixels to sample, only used when "samplingMethod" is not "None".
+    bool analyzeAllFrames{ false }; // Analyze all frames of an animated image or a numbered image sequence instead of the first image only.
+    QRect regionOfInterest{}; // In the original image's pixel coordinates. If valid, only this part of the image is decoded and analyzed, see "applyRegionOfInterest()".
+    bool multiResolution{ false }; // Converge on a small copy of the (possibly shrinked) image first, then refine with a few iterations on larger and larger copies, see "clusterImage()".
+    qint64 memoryBudget{ 0 }; // In bytes, per analysis. If > 0, a cheaper strategy is picked when the analysis would need more than this, see "applyMemoryBudget()".
+};
+
+struct AnalysisStatistics final {
+    qsizetype iterationCount{ 0 }; // Including the ones thrown away by restarts.
+    qsizetype clusterRepairCount{ 0 }; // How many empty clusters have been re-seeded in place.
+    qsizetype restartCount{ 0 }; // How many times all the progress has been thrown away to start over with new random centroids.
+};
+
+// The pixels to be clustered, as produced by "extractPixels()".
+struct PixelData final {
+    QList<Pixel> pixelList{};
+    QList<qsizetype> weightList{}; // Empty means every pixel has the same weight of 1.
+    qsizetype imagePixelCount{ 0 }; // How many pixels the source image had, including the rejected ones.
+    bool isSampled{ false }; // The pixels are a random sample of the image, so the ratios are only estimations.
+
+    [[nodiscard]] qsizetype totalWeight() const {
+        return weightList.isEmpty() ? pixelList.size() : std::accumulate(weightList.cbegin(), weightList.cend(), qsizetype(0));
+    }
+};
+
+// Everything we need to know about a cluster to move its centroid. Keeping the member pixels themselves
+// around would cost O(N*k) memory when every cluster is reserved for the worst case. These are also the
+// sufficient statistics of the cluster: the accumulators of different parts of the same image (assigned
+// to the same centroids) can be merged, and the result is the same as accumulating the whole image at once.
+struct ClusterAccumulator final {
+    quint64 r{ 0 };
+    quint64 g{ 0 };
+    quint64 b{ 0 };
+    qsizetype count{ 0 };
+    quint64 inertia{ 0 }; // The (weighted) sum of the squared distances between the members and the centroid.
+    // The member which is the farthest away from the centroid, used to re-seed empty clusters.
+    Pixel farthestPixel{};
+    int farthestDistance{ -1 }; // Squared.
+
+    void add(const Pixel pixel, const qsizetype weight, const int squaredDistance) {
+        r += quint64(pixel.r) * quint64(weight);
+        g += quint64(pixel.g) * quint64(weight);
+        b += quint64(pixel.b) * quint64(weight);
+        count += weight;
+        inertia += quint64(squaredDistance) * quint64(weight);
+        updateFarthest(pixel, squaredDistance);
+    }
+
+    void merge(const ClusterAccumulator& other) {
+        r += other.r;
+        g += other.g;
+        b += other.b;
+        count += other.count;
+        inertia += other.inertia;
+        updateFarthest(other.farthestPixel, other.farthestDistance);
+    }
+
+private:
+    // Ties are broken by the color itself instead of by the order the pixels come in, so that splitting the
+    // pixels up and merging the parts in any order always gives the same member.
+    void updateFarthest(const Pixel pixel, const int squaredDistance) {
+        const auto& key{ [](const Pixel value){ return (int(value.r) << 16) | (int(value.g) << 8) | int(value.b); } };
+        if (squaredDistance > farthestDistance || (squaredDistance == farthestDistance && key(pixel) < key(farthestPixel))) {
+            farthestDistance = squaredDistance;
+            farthestPixel = pixel;
+        }
+    }
+};
+
+// How the assignment step finds the closest centroid of each pixel.
+enum class NearestCentroidSearch : quint8 {
+    Automatic, // The fastest one for k, see below.
+    LinearScan, // Compares every pixel with every centroid.
+    FixedK, // Same as above, fully unrolled for 4 <= k <= 16 (falls back to "LinearScan" for any other k).
+    CentroidTree // Looks the centroid up in a k-d tree, pays off for large k only.
+};
+
+struct AnalysisWorkspacePrivate;
+// The scratch buffers of one analysis: the pixel list, the centroids, the cluster accumulators and so on.
+// They are sized on first use and then reused, so once a workspace has seen the largest image/k of a
+// workload, analyzing more images with it doesn't allocate anything apart from the image decoding itself.
+// Not thread safe, give each worker thread its own workspace.
+class AnalysisWorkspace final {
+    Q_DISABLE_COPY_MOVE(AnalysisWorkspace)
+
+public:
+    explicit AnalysisWorkspace();
+    ~AnalysisWorkspace();
+
+    // How many times a buffer had to grow so far. Stays the same once the workspace has warmed up,
+    // which is an easy way to check that the steady state doesn't allocate.
+    [[nodiscard]] qsizetype allocationCount() const;
+
+    // Gives the memory back to the system, eg. after analyzing an unusually large image.
+    void release();
+
+    // How many bytes the buffers hold right now (their capacity, not their size).
+    [[nodiscard]] qint64 memoryUsage() const;
+
+    // Internal use only (benchmarks): forces one of the searches instead of picking the fastest one for k.
+    void setNearestCentroidSearch(const NearestCentroidSearch search);
+
+    // Internal use only.
+    [[nodiscard]] AnalysisWorkspacePrivate* d_func();
+
+private:
+    const std::unique_ptr<AnalysisWorkspacePrivate> d_ptr;
+};
+
+// Points "options" to the image "filePath". The region of interest has been selected on the previous image,
+// it's dropped unless "filePath" is the very same file.
+extern void setImageFilePath(UserOptions& options, const QString& filePath);
+
+// Makes "reader" decode only the region of interest of "options" (clipped to the image bounds), if there is any.
+// Decoders which support clipping natively don't even decode the rest of the image. MUST be called before reading.
+extern void applyRegionOfInterest(QImageReader& reader, const UserOptions& options);
+
+// Reads the (first) image of "options.filePath", restricted to the region of interest.
+[[nodiscard]] extern QImage readImage(const UserOptions& options, QString* errorMessageOut = nullptr);
+
+// How an analysis stays within "UserOptions::memoryBudget".
+enum class MemoryStrategy : quint8 {
+    Full, // Everything fits, the analysis runs exactly as asked for.
+    DecoderDownscale, // The decoder produces a smaller image directly, the full size image never exists in memory.
+    Tiling, // The pixels are clustered band by band instead of all at once (exact, but slower), see "clusterImageInTiles()".
+    Sampling // Only a random sample of the pixels is clustered, the ratios become estimations.
+};
+
+struct MemoryPlan final {
+    MemoryStrategy strategy{ MemoryStrategy::Full };
+    QSize decodeSize{}; // Invalid if the image size is unknown.
+    qint64 estimatedBytes{ -1 }; // The estimated peak memory usage of the analysis, -1 if unknown.
+    int tileHeight{ 0 }; // The height of each band, only used by "MemoryStrategy::Tiling".
+};
+
+// The estimated peak memory usage of analyzing an image of "imageSize" pixels (as decoded, in "format")
+// with "options": the decoded image, its shrinked copy, the pixel buffers of the workspace and the mip
+// pyramid. "tileHeight" > 0 means the pixels are clustered in bands of that many rows.
+[[nodiscard]] extern qint64 estimateMemoryUsage(const QSize& imageSize, const QImage::Format format, const UserOptions& options, const int tileHeight = 0);
+
+// Makes the analysis fit into "options.memoryBudget" (if any), trying the cheaper strategies in this order:
+//   1. Decoding right at the size "prepareImage()" would shrink to, if the decoder can scale.
+//   2. Tiling, if "allowTiling" is set: the caller MUST then use "clusterImageInTiles()".
+//   3. Sampling as many pixels as the budget allows.
+//   4. Decoding at a smaller size than asked for, as large as the budget allows.
+// Adjusts "reader" and "options" accordingly. Returns false (and refuses the analysis) if nothing fits.
+// MUST be called after "applyRegionOfInterest()" and before reading.
+[[nodiscard]] extern bool applyMemoryBudget(QImageReader& reader, UserOptions& options, MemoryPlan& planOut, const bool allowTiling, QString* errorMessageOut = nullptr);
+
+// Same as above, within the memory budget. "options" is adjusted to the plan, analyze the image with it.
+[[nodiscard]] extern QImage readImage(UserOptions& options, MemoryPlan& planOut, const bool allowTiling, QString* errorMessageOut = nullptr);
+
+// The analysis can also be done step by step, which is what "extractColorsFromImage()" does internally:
+//   1. prepareImage(): shrinks the image if the options ask for it.
+//   2. extractPixels(): turns the image into a (possibly sampled or weighted) pixel list.
+//   3. clusterPixels(): runs k-means over the pixel list and generates the result.
+// "clusterImage()" does step 2 and 3 in one go, and runs them level by level over a mip pyramid
+// of the image if "multiResolution" is enabled.
+[[nodiscard]] extern QImage prepareImage(QImage image, const UserOptions& options);
+// If "workspace" is given, the growth of the buffers of "pixelDataOut" counts towards its "allocationCount()".
+[[nodiscard]] extern bool extractPixels(PixelData& pixelDataOut, const QImage& image, const UserOptions& options, AnalysisWorkspace* workspace = nullptr);
+[[nodiscard]] extern bool clusterPixels(ColorItemList& resultOut, const PixelData& pixelData, const UserOptions& options, AnalysisWorkspace* workspace = nullptr, const ColorItemList& warmStartList = {}, AnalysisStatistics* statisticsOut = nullptr);
+// A single assignment step without moving the centroids: accumulates each pixel into the cluster of its
+// closest centroid. "clusterListOut" is resized to the centroid count.
+[[nodiscard]] extern bool accumulateClusters(QList<ClusterAccumulator>& clusterListOut, const PixelData& pixelData, const QList<Pixel>& centroidList, AnalysisWorkspace* workspace = nullptr);
+[[nodiscard]] extern bool clusterImage(ColorItemList& resultOut, const QImage& image, const UserOptions& options, AnalysisWorkspace* workspace = nullptr, const ColorItemList& warmStartList = {}, AnalysisStatistics* statisticsOut = nullptr);
+
+// If "workspace" is null, a temporary one is used, which means allocating all the buffers again for every call.
+// If "warmStartList" contains exactly k items, their colors are used as the initial centroids instead of random ones.
+[[nodiscard]] extern bool extractColorsFromImage(ColorItemList& resultOut, QImage imageIn, const UserOptions& options, AnalysisWorkspace* workspace = nullptr, const ColorItemList& warmStartList = {}, AnalysisStatistics* statisticsOut = nullptr);
+
+// Returns all the files of the numbered sequence "filePath" belongs to (eg. "frame_0001.png", "frame_0002.png", ...),
+// sorted by their numbers. Returns "filePath" alone if it's not part of such a sequence.
+[[nodiscard]] extern QStringList findImageSequenceFilePaths(const QString& filePath);
+
+// Analyzes every frame of an animated image (or every page of a multi-page image, or every file of a numbered
+// image sequence), each frame warm-started from the result of the previous one. Frames that fail to be analyzed
+// are kept in the timeline as empty lists. Returns false if no frame could be analyzed at all. All the frames share
+// "workspace" (or a temporary one if it's null). Stops after the current frame once "cancellationToken" is cancelled.
+[[nodiscard]] extern bool analyzeImageSequence(QList<ColorItemList>& timelineOut, const UserOptions& options, AnalysisWorkspace* workspace = nullptr,
+                                               const CancellationToken& cancellationToken = {});
@@ -0,0 +1,196 @@
+#include "folderwatcher.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QThread>
+#include <QDebug>
+#include <utility>
+
+using namespace Qt::StringLiterals;
+
+// A file is considered completely written once its size and modification time haven't changed for
+// this long. Exporters usually write in bursts, a second is plenty to tell a pause from the end.
+static constexpr const int FILE_SETTLE_INTERVAL{ 1000 };
+
+FolderWatcher::FolderWatcher(const UserOptions& options, const BatchPipelineOptions& pipelineOptions, const QString& indexFilePath, QObject* parent)
+    : QObject{ parent }, m_options{ options }, m_pipelineOptions{ pipelineOptions }, m_indexFilePath{ indexFilePath } {
+    m_settleTimer.setSingleShot(true);
+    m_settleTimer.setInterval(FILE_SETTLE_INTERVAL);
+    connect(&m_settleTimer, &QTimer::timeout, this, &FolderWatcher::checkPendingFiles);
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, &FolderWatcher::scanDirectory);
+}
+
+FolderWatcher::~FolderWatcher() {
+    if (m_batchThread) {
+        m_batchThread->wait();
+    }
+}
+
+FolderWatcher::FileStamp FolderWatcher::stampOf(const QString& filePath) {
+    const QFileInfo fileInfo(filePath);
+    if (!fileInfo.exists()) {
+        return {};
+    }
+    return FileStamp{ fileInfo.size(), fileInfo.lastModified().toMSecsSinceEpoch() };
+}
+
+bool FolderWatcher::start(const QStringList& directoryPathList) {
+    Q_ASSERT(!directoryPathList.isEmpty());
+    if (!loadIndex()) {
+        return false;
+    }
+    for (auto&& directoryPath : std::as_const(directoryPathList)) {
+        const QString absolutePath{ QFileInfo(directoryPath).absoluteFilePath() };
+        if (!QFileInfo(absolutePath).isDir()) {
+            qCritical().noquote() << "Not a directory:" << QDir::toNativeSeparators(absolutePath);
+            return false;
+        }
+        if (!m_watcher.addPath(absolutePath)) {
+            qCritical().noquote() << "Cannot watch the directory:" << QDir::toNativeSeparators(absolutePath);
+            return false;
+        }
+        scanDirectory(absolutePath);
+    }
+    qInfo().noquote() << "Watching" << directoryPathList.size() << "directory(ies), results index:" << QDir::toNativeSeparators(m_indexFilePath);
+    return true;
+}
+
+bool FolderWatcher::loadIndex() {
+    QFile file(m_indexFilePath);
+    if (!file.exists()) {
+        return true;
+    }
+    if (!file.open(QFile::ReadOnly | QFile::Text)) {
+        qCritical().noquote() << "Cannot open the results index:" << file.errorString();
+        return false;
+    }
+    QTextStream stream(&file);
+    QString line{};
+    while (stream.readLineInto(&line)) {
+        const QStringList fieldList{ line.split(u'\t') };
+        if (fieldList.size() < 3) {
+            continue;
+        }
+        bool sizeOk{ false };
+        bool lastModifiedOk{ false };
+        const FileStamp stamp{ fieldList[1].toLongLong(&sizeOk), fieldList[2].toLongLong(&lastModifiedOk) };
+        if (!sizeOk || !lastModifiedOk) {
+            continue;
+        }
+        // Lines are only ever appended, the last one of a file is the most recent one.
+        m_indexedFileHash.insert(fieldList[0], stamp);
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Loaded" << m_indexedFileHash.size() << "file(s) from the results index.";
+    }
+    return true;
+}
+
+void FolderWatcher::appendToIndex(const BatchResult& result, const FileStamp& stamp) {
+    QFile file(m_indexFilePath);
+    if (!file.open(QFile::WriteOnly | QFile::Append | QFile::Text)) {
+        qWarning().noquote() << "Cannot write to the results index:" << file.errorString();
+        return;
+    }
+    QTextStream stream(&file);
+    stream << result.filePath << '\t' << stamp.size << '\t' << stamp.lastModified;
+    if (result.errorMessage.isEmpty()) {
+        stream << formatColorList(result.colorList);
+    } else {
+        stream << "\t!" << QString(result.errorMessage).replace(u'\t', u' ');
+    }
+    stream << '\n';
+}
+
+void FolderWatcher::scanDirectory(const QString& directoryPath) {
+    const QStringList filePathList{ collectImageFilePaths({ directoryPath }) };
+    bool hasNewFile{ false };
+    for (auto&& filePath : std::as_const(filePathList)) {
+        const FileStamp stamp{ stampOf(filePath) };
+        if (stamp.size < 0 || m_indexedFileHash.value(filePath) == stamp || m_runningFileHash.value(filePath) == stamp
+            || m_readyFileHash.value(filePath) == stamp || m_pendingFileHash.value(filePath) == stamp) {
+            continue;
+        }
+        // New or changed, (re)start waiting for it to settle.
+        m_readyFileHash.remove(filePath);
+        m_pendingFileHash.insert(filePath, stamp);
+        hasNewFile = true;
+    }
+    if (hasNewFile) {
+        // Debounced: every change pushes the check further away.
+        m_settleTimer.start();
+    }
+}
+
+void FolderWatcher::checkPendingFiles() {
+    for (auto it{ m_pendingFileHash.begin() }; it != m_pendingFileHash.end();) {
+        const FileStamp stamp{ stampOf(it.key()) };
+        if (stamp.size < 0) {
+            // Deleted (or renamed) before it settled.
+            it = m_pendingFileHash.erase(it);
+            continue;
+        }
+        if (stamp == it.value() && stamp.size > 0) {
+            m_readyFileHash.insert(it.key(), stamp);
+            it = m_pendingFileHash.erase(it);
+            continue;
+        }
+        it.value() = stamp;
+        ++it;
+    }
+    if (!m_pendingFileHash.isEmpty()) {
+        m_settleTimer.start();
+    }
+    startNextBatch();
+}
+
+void FolderWatcher::startNextBatch() {
+    if (m_batchThread || m_readyFileHash.isEmpty()) {
+        return;
+    }
+    m_runningFileHash = std::exchange(m_readyFileHash, {});
+    QStringList filePathList{ m_runningFileHash.keys() };
+    filePathList.sort();
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Analyzing" << filePathList.size() << "new or changed file(s).";
+    }
+    // The pipeline blocks until all the files are done, so it runs on its own thread and
+    // the results are sent back to ours.
+    m_batchThread.reset(QThread::create([this, filePathList](){
+        BatchPipeline pipeline(m_options, m_pipelineOptions);
+        pipeline.run(filePathList, [this](BatchResult result){
+            QMetaObject::invokeMethod(this, [this, result = std::move(result)]() mutable { handleResult(std::move(result)); }, Qt::QueuedConnection);
+        });
+        QMetaObject::invokeMethod(this, &FolderWatcher::handleBatchFinished, Qt::QueuedConnection);
+    }));
+    m_batchThread->setObjectName(u"FolderWatcherBatchThread"_s);
+    m_batchThread->start();
+}
+
+void FolderWatcher::handleResult(BatchResult result) {
+    const auto it{ m_runningFileHash.constFind(result.filePath) };
+    Q_ASSERT(it != m_runningFileHash.constEnd());
+    if (it == m_runningFileHash.constEnd()) {
+        return;
+    }
+    const FileStamp stamp{ it.value() };
+    m_runningFileHash.erase(it);
+    m_indexedFileHash.insert(result.filePath, stamp);
+    appendToIndex(result, stamp);
+    Q_EMIT resultReady(std::move(result));
+}
+
+void FolderWatcher::handleBatchFinished() {
+    Q_ASSERT(m_batchThread);
+    m_batchThread->wait();
+    m_batchThread.reset();
+    m_runningFileHash.clear();
+    // Files which changed while they were being analyzed are re-queued by the next scan.
+    const QStringList directoryPathList{ m_watcher.directories() };
+    for (auto&& directoryPath : std::as_const(directoryPathList)) {
+        scanDirectory(directoryPath);
+    }
+    startNextBatch();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "batchpipeline.h"
+#include <QObject>
+#include <QHash>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <memory>
+
+QT_BEGIN_NAMESPACE
+class QThread;
+QT_END_NAMESPACE
+
+// Watches directories (non-recursively) and analyzes every image file which lands in them, once it has
+// been completely written. Each result is appended to the results index, a tab separated text file with
+// one line per analyzed file: path, size, modification time, then either the colors (same format as the
+// batch mode output) or "!" followed by the error message. The index is read back on startup, so files
+// which haven't changed since they were analyzed are not analyzed again.
+class FolderWatcher final : public QObject {
+    Q_OBJECT
+    Q_DISABLE_COPY_MOVE(FolderWatcher)
+
+public:
+    explicit FolderWatcher(const UserOptions& options, const BatchPipelineOptions& pipelineOptions, const QString& indexFilePath, QObject* parent = nullptr);
+    ~FolderWatcher() override;
+
+    // Loads the index, starts watching and queues the new or changed files which are already there.
+    [[nodiscard]] bool start(const QStringList& directoryPathList);
+
+Q_SIGNALS:
+    void resultReady(BatchResult result);
+
+private:
+    struct FileStamp final {
+        qint64 size{ -1 };
+        qint64 lastModified{ -1 }; // Milliseconds since the epoch, UTC.
+
+        [[nodiscard]] friend bool operator==(const FileStamp& lhs, const FileStamp& rhs) {
+            return lhs.size == rhs.size && lhs.lastModified == rhs.lastModified;
+        }
+    };
+
+    [[nodiscard]] static FileStamp stampOf(const QString& filePath);
+
+    [[nodiscard]] bool loadIndex();
+    void appendToIndex(const BatchResult& result, const FileStamp& stamp);
+    void scanDirectory(const QString& directoryPath);
+    void checkPendingFiles();
+    void startNextBatch();
+    void handleResult(BatchResult result);
+    void handleBatchFinished();
+
+    UserOptions m_options{};
+    BatchPipelineOptions m_pipelineOptions{};
+    QString m_indexFilePath{};
+    QFileSystemWatcher m_watcher{};
+    QTimer m_settleTimer{};
+    QHash<QString, FileStamp> m_indexedFileHash{}; // Already analyzed, as recorded in the index.
+    QHash<QString, FileStamp> m_pendingFileHash{}; // Seen, but maybe still being written.
+    QHash<QString, FileStamp> m_readyFileHash{}; // Completely written, waiting for the pipeline.
+    QHash<QString, FileStamp> m_runningFileHash{}; // Being analyzed right now.
+    std::unique_ptr<QThread> m_batchThread{};
+};
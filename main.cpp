@@ -1,13 +1,432 @@
 #include "mainwindow.h"
+#include "batchpipeline.h"
+#include "shardedclustering.h"
+#include "folderwatcher.h"
+#include "tracing.h"
+#include "memoryprobe.h"
+#include "taskscheduler.h"
+#include "piechart.h"
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
 #include <QLocale>
 #include <QApplication>
-#include <QFontDatabase>
+#include <QCommandLineParser>
+#include <QCryptographicHash>
+#include <QFont>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QTextStream>
+#include <QScopeGuard>
+#include <QStandardPaths>
+#include <array>
+#include <atomic>
 #include <clocale>
+#include <cstdlib>
+#include <memory>
+
+#ifdef Q_OS_WINDOWS
+#  include <qt_windows.h>
+#  include <cstdio>
+#endif
 
 using namespace Qt::StringLiterals;
 
+struct CommandLineOptions final {
+    QCommandLineOption measureStartup{ u"measure-startup"_s,
+        QCoreApplication::translate("main", "Print the time-to-first-frame and exit right after the main window has been painted for the first time.") };
+    QCommandLineOption measureMemory{ u"measure-memory"_s,
+        QCoreApplication::translate("main", "Print the peak memory usage of the whole process on exit.") };
+    QCommandLineOption trace{ u"trace"_s,
+        QCoreApplication::translate("main", "Record what the analysis spends its time on and write it to this file as a Chrome trace on exit. Also enabled by the IMAGE_COLOR_ANALYZER_TRACE environment variable."), u"file"_s };
+    QCommandLineOption k{ u"k"_s, QCoreApplication::translate("main", "How many groups the colors will be divided into."), u"k"_s, u"5"_s };
+    QCommandLineOption maxIterations{ u"max-iterations"_s, QCoreApplication::translate("main", "Maximum iteration count."), u"count"_s, u"50"_s };
+    QCommandLineOption maxWidth{ u"max-width"_s, QCoreApplication::translate("main", "Maximum image width, <= 0 means no limit."), u"pixels"_s, u"100"_s };
+    QCommandLineOption maxHeight{ u"max-height"_s, QCoreApplication::translate("main", "Maximum image height, <= 0 means no limit."), u"pixels"_s, u"100"_s };
+    QCommandLineOption alphaThreshold{ u"alpha-threshold"_s, QCoreApplication::translate("main", "Only accept the pixels whose alpha is not less than this value."), u"alpha"_s, u"180"_s };
+    QCommandLineOption sampling{ u"sampling"_s, QCoreApplication::translate("main", "Sampling method: none, uniform, stratified or reservoir."), u"method"_s, u"none"_s };
+    QCommandLineOption sampleBudget{ u"sample-budget"_s, QCoreApplication::translate("main", "How many pixels to sample."), u"count"_s, u"10000"_s };
+    QCommandLineOption roi{ u"roi"_s, QCoreApplication::translate("main", "Only decode and analyze this region of the image, in pixels."), u"x,y,width,height"_s };
+    QCommandLineOption multiResolution{ u"multi-resolution"_s, QCoreApplication::translate("main", "Converge on a small copy of the image first, then refine on larger copies up to the full size.") };
+    QCommandLineOption memoryBudget{ u"memory-budget"_s, QCoreApplication::translate("main", "The memory one analysis may use, cheaper strategies are picked automatically to stay below it. 0 means no limit."), u"MiB"_s, u"0"_s };
+    QCommandLineOption readers{ u"readers"_s, QCoreApplication::translate("main", "Batch mode: file reader thread count."), u"count"_s, u"2"_s };
+    QCommandLineOption decoders{ u"decoders"_s, QCoreApplication::translate("main", "Batch mode: image decoder thread count, <= 0 means one per CPU core."), u"count"_s, u"0"_s };
+    QCommandLineOption extractors{ u"extractors"_s, QCoreApplication::translate("main", "Batch mode: pixel extractor thread count, <= 0 means one per CPU core."), u"count"_s, u"1"_s };
+    QCommandLineOption clusterers{ u"clusterers"_s, QCoreApplication::translate("main", "Batch mode: clustering thread count, <= 0 means one per CPU core."), u"count"_s, u"0"_s };
+    QCommandLineOption queueCapacity{ u"queue-capacity"_s, QCoreApplication::translate("main", "Batch mode: how many files may wait between two pipeline stages."), u"count"_s, u"4"_s };
+    QCommandLineOption shards{ u"shards"_s, QCoreApplication::translate("main", "Batch mode: split each image into this many shards, each of them clustered by its own worker process. <= 1 means no sharding."), u"count"_s, u"0"_s };
+    QCommandLineOption charts{ u"charts"_s, QCoreApplication::translate("main", "Batch mode: also render the pie chart of each file into this directory."), u"directory"_s };
+    QCommandLineOption chartFormat{ u"chart-format"_s, QCoreApplication::translate("main", "Batch mode: chart file format, png or svg."), u"format"_s, u"png"_s };
+    QCommandLineOption chartSize{ u"chart-size"_s, QCoreApplication::translate("main", "Batch mode: chart width and height."), u"pixels"_s, u"600"_s };
+    QCommandLineOption watch{ u"watch"_s, QCoreApplication::translate("main", "Batch mode: keep watching the given directories and analyze every new or changed image file.") };
+    QCommandLineOption index{ u"index"_s, QCoreApplication::translate("main", "Watch mode: the results index file, defaults to a file in the application data directory, one per set of watched directories."), u"file"_s };
+    QCommandLineOption shardWorker{ u"shard-worker"_s, QCoreApplication::translate("main", "Internal: run as the worker process of the given shard."), u"index"_s };
+
+    CommandLineOptions() {
+        shardWorker.setFlags(QCommandLineOption::HiddenFromHelp);
+    }
+
+    void addTo(QCommandLineParser& parser) const {
+        parser.addOptions({ measureStartup, measureMemory, trace, k, maxIterations, maxWidth, maxHeight, alphaThreshold, sampling, sampleBudget, roi, multiResolution, memoryBudget,
+                            readers, decoders, extractors, clusterers, queueCapacity, shards, charts, chartFormat, chartSize, watch, index, shardWorker });
+    }
+};
+
+[[nodiscard]] static inline bool parseInteger(const QCommandLineParser& parser, const QCommandLineOption& option, qsizetype& valueOut) {
+    bool ok{ false };
+    const qlonglong value{ parser.value(option).toLongLong(&ok) };
+    if (!ok) {
+        qCritical().noquote() << "Invalid value for" << option.names().constFirst() << ':' << parser.value(option);
+        return false;
+    }
+    valueOut = qsizetype(value);
+    return true;
+}
+
+[[nodiscard]] static inline bool parseUserOptions(const QCommandLineParser& parser, const CommandLineOptions& cmd, UserOptions& optionsOut) {
+    qsizetype maxWidth{ 0 };
+    qsizetype maxHeight{ 0 };
+    qsizetype alphaThreshold{ 0 };
+    qsizetype memoryBudget{ 0 };
+    if (!parseInteger(parser, cmd.k, optionsOut.k) || !parseInteger(parser, cmd.maxIterations, optionsOut.maxIterations)
+        || !parseInteger(parser, cmd.maxWidth, maxWidth) || !parseInteger(parser, cmd.maxHeight, maxHeight)
+        || !parseInteger(parser, cmd.alphaThreshold, alphaThreshold) || !parseInteger(parser, cmd.sampleBudget, optionsOut.sampleBudget)
+        || !parseInteger(parser, cmd.memoryBudget, memoryBudget)) {
+        return false;
+    }
+    optionsOut.maxWidth = int(maxWidth);
+    optionsOut.maxHeight = int(maxHeight);
+    optionsOut.alphaThreshold = int(alphaThreshold);
+    optionsOut.multiResolution = parser.isSet(cmd.multiResolution);
+    if (memoryBudget < 0) {
+        qCritical() << "The memory budget must not be negative.";
+        return false;
+    }
+    optionsOut.memoryBudget = qint64(memoryBudget) * 1048576;
+    if (parser.isSet(cmd.roi)) {
+        const QStringList partList{ parser.value(cmd.roi).split(u',') };
+        std::array<int, 4> valueArray{};
+        bool ok{ partList.size() == int(valueArray.size()) };
+        for (qsizetype index{ 0 }; ok && index < partList.size(); ++index) {
+            valueArray[index] = partList[index].trimmed().toInt(&ok);
+        }
+        if (!ok || valueArray[0] < 0 || valueArray[1] < 0 || valueArray[2] <= 0 || valueArray[3] <= 0) {
+            qCritical().noquote() << "Invalid region of interest:" << parser.value(cmd.roi) << "(expected: x,y,width,height)";
+            return false;
+        }
+        optionsOut.regionOfInterest = QRect(valueArray[0], valueArray[1], valueArray[2], valueArray[3]);
+    }
+    const QString sampling{ parser.value(cmd.sampling).toLower() };
+    if (sampling == u"none"_s) {
+        optionsOut.samplingMethod = SamplingMethod::None;
+    } else if (sampling == u"uniform"_s) {
+        optionsOut.samplingMethod = SamplingMethod::Uniform;
+    } else if (sampling == u"stratified"_s) {
+        optionsOut.samplingMethod = SamplingMethod::Stratified;
+    } else if (sampling == u"reservoir"_s) {
+        optionsOut.samplingMethod = SamplingMethod::Reservoir;
+    } else {
+        qCritical().noquote() << "Unknown sampling method:" << sampling;
+        return false;
+    }
+    if (optionsOut.k <= 1 || optionsOut.maxIterations <= 0 || (optionsOut.samplingMethod != SamplingMethod::None && optionsOut.sampleBudget <= 0)) {
+        qCritical() << "k must be greater than 1, the maximum iteration count and the sample budget must be positive.";
+        return false;
+    }
+    return true;
+}
+
+// One line per file: the path, then the colors from the most dominant one to the least dominant one.
+static inline void printResult(QTextStream& out, const QString& filePath, const ColorItemList& colorList) {
+    out << QDir::toNativeSeparators(filePath) << formatColorList(colorList) << Qt::endl;
+}
+
+struct ChartOptions final {
+    QString directoryPath{}; // Empty if no charts are wanted.
+    QString rootPath{}; // The deepest directory containing all the input files, empty if there is none (different drives).
+    bool isSvg{ false };
+    qsizetype size{ 600 };
+};
+
+// The deepest directory all the (absolute) "filePathList" are in, or an empty string if they don't have any in common.
+[[nodiscard]] static inline QString commonParentDirectory(const QStringList& filePathList) {
+    Q_ASSERT(!filePathList.isEmpty());
+    QDir rootDir(QFileInfo(filePathList.constFirst()).absolutePath());
+    for (auto&& filePath : std::as_const(filePathList)) {
+        while (true) {
+            const QString relativeFilePath{ rootDir.relativeFilePath(filePath) };
+            if (!relativeFilePath.startsWith(u"../"_s) && !QDir::isAbsolutePath(relativeFilePath)) {
+                break;
+            }
+            if (!rootDir.cdUp()) {
+                return {};
+            }
+        }
+    }
+    return rootDir.absolutePath();
+}
+
+[[nodiscard]] static inline bool parseChartOptions(const QCommandLineParser& parser, const CommandLineOptions& cmd, const QStringList& filePathList, ChartOptions& optionsOut) {
+    if (!parser.isSet(cmd.charts)) {
+        return true;
+    }
+    const QString format{ parser.value(cmd.chartFormat).toLower() };
+    if (format != u"png"_s && format != u"svg"_s) {
+        qCritical().noquote() << "Unknown chart format:" << format;
+        return false;
+    }
+    optionsOut.isSvg = format == u"svg"_s;
+    if (!parseInteger(parser, cmd.chartSize, optionsOut.size)) {
+        return false;
+    }
+    if (optionsOut.size <= 0) {
+        qCritical() << "The chart size must be positive.";
+        return false;
+    }
+    optionsOut.directoryPath = QFileInfo(parser.value(cmd.charts)).absoluteFilePath();
+    if (!QDir().mkpath(optionsOut.directoryPath)) {
+        qCritical().noquote() << "Cannot create the chart directory:" << QDir::toNativeSeparators(optionsOut.directoryPath);
+        return false;
+    }
+    optionsOut.rootPath = commonParentDirectory(filePathList);
+    return true;
+}
+
+// Thread safe. The chart of "photo.jpg" is written to "photo.jpg.png" (or ".svg"), so that "photo.jpg" and
+// "photo.png" don't overwrite each other's chart. Subdirectories of the input files are kept, so that
+// "a/photo.jpg" and "b/photo.jpg" don't either.
+[[nodiscard]] static inline bool writeChart(const ChartOptions& options, const QString& filePath, const ColorItemList& colorList) {
+    Q_ASSERT(!options.directoryPath.isEmpty());
+    // Laid out like the smallest main window, then scaled as a whole, so charts look the same at any size.
+    static constexpr const int layoutSize{ 600 };
+    PieChart chart{};
+    chart.colorList = colorList;
+    QString relativeFilePath{};
+    if (options.rootPath.isEmpty()) {
+        // No common directory at all, eg. "C:/photo.jpg" and "D:/photo.jpg": the charts go to "C/photo.jpg.png"
+        // and "D/photo.jpg.png".
+        relativeFilePath = QFileInfo(filePath).absoluteFilePath().remove(u':');
+        while (relativeFilePath.startsWith(u'/')) {
+            relativeFilePath.remove(0, 1);
+        }
+    } else {
+        relativeFilePath = QDir(options.rootPath).relativeFilePath(filePath);
+    }
+    const QString chartFilePath{ QDir(options.directoryPath).filePath(relativeFilePath + (options.isSvg ? u".svg"_s : u".png"_s)) };
+    const QString chartDirPath{ QFileInfo(chartFilePath).absolutePath() };
+    if (!QDir().mkpath(chartDirPath)) {
+        qCritical().noquote() << QDir::toNativeSeparators(filePath) << ':' << "Cannot create the chart directory:" << QDir::toNativeSeparators(chartDirPath);
+        return false;
+    }
+    const qreal scale{ qreal(options.size) / qreal(layoutSize) };
+    bool ok{ false };
+    if (options.isSvg) {
+        QFile file(chartFilePath);
+        ok = file.open(QFile::WriteOnly | QFile::Truncate) && file.write(renderPieChartSvg(chart, QSize(layoutSize, layoutSize), scale)) > 0;
+    } else {
+        ok = renderPieChartImage(chart, QSize(layoutSize, layoutSize), scale).save(chartFilePath);
+    }
+    if (!ok) {
+        qCritical().noquote() << QDir::toNativeSeparators(filePath) << ':' << "Cannot write the chart:" << QDir::toNativeSeparators(chartFilePath);
+    }
+    return ok;
+}
+
+// Each file is clustered by "shardCount" worker processes, one after another, see "ProcessShardTransport".
+// When tracing, the workers write their traces next to "traceFilePath": "trace-2-shard1.json" is the one of
+// the second worker of the third file.
+[[nodiscard]] static inline int runShardedBatch(const QStringList& filePathList, const UserOptions& options, const qsizetype shardCount, const QString& traceFilePath) {
+    QTextStream out(stdout);
+    qsizetype failureCount{ 0 };
+    for (qsizetype fileIndex{ 0 }; fileIndex < filePathList.size(); ++fileIndex) {
+        const QString& filePath{ filePathList[fileIndex] };
+        UserOptions fileOptions{ options };
+        fileOptions.filePath = filePath;
+        QList<Pixel> centroidList{};
+        ColorItemList colorList{};
+        QString traceFilePathPrefix{};
+        if (!traceFilePath.isEmpty()) {
+            const QFileInfo traceFileInfo(traceFilePath);
+            traceFilePathPrefix = traceFileInfo.dir().filePath(traceFileInfo.completeBaseName() + u'-' + QString::number(fileIndex));
+        }
+        ProcessShardTransport transport(fileOptions, shardCount, traceFilePathPrefix);
+        ShardCoordinator coordinator(transport, fileOptions);
+        if (!generateInitialCentroids(centroidList, fileOptions) || !transport.start() || !coordinator.run(colorList, centroidList)) {
+            ++failureCount;
+            qCritical().noquote() << QDir::toNativeSeparators(filePath) << ':' << "Failed to analyze the image colors.";
+            continue;
+        }
+        printResult(out, filePath, colorList);
+    }
+    return failureCount > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Runs until the process is terminated, see "FolderWatcher".
+[[nodiscard]] static inline int runWatch(const QCommandLineParser& parser, const CommandLineOptions& cmd, const UserOptions& options, const BatchPipelineOptions& pipelineOptions) {
+    const QStringList directoryPathList{ parser.positionalArguments() };
+    Q_ASSERT(!directoryPathList.isEmpty());
+    QString indexFilePath{};
+    if (parser.isSet(cmd.index)) {
+        indexFilePath = QFileInfo(parser.value(cmd.index)).absoluteFilePath();
+    } else {
+        // Outside of the watched directories, where the index would show up as a new file itself (and be mistaken for
+        // the designers' exports). Named after the directories, so that watching the same ones again finds it again.
+        const QString dataDirPath{ QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) };
+        if (dataDirPath.isEmpty() || !QDir().mkpath(dataDirPath)) {
+            qCritical() << "Cannot determine where to keep the results index, please specify it with --index.";
+            return EXIT_FAILURE;
+        }
+        QStringList canonicalPathList{};
+        for (auto&& directoryPath : std::as_const(directoryPathList)) {
+            const QFileInfo fileInfo(directoryPath);
+            canonicalPathList.push_back(fileInfo.canonicalFilePath().isEmpty() ? fileInfo.absoluteFilePath() : fileInfo.canonicalFilePath());
+        }
+        canonicalPathList.sort();
+        canonicalPathList.removeDuplicates();
+        const QByteArray hash{ QCryptographicHash::hash(canonicalPathList.join(u'\n').toUtf8(), QCryptographicHash::Sha1).toHex().left(16) };
+        indexFilePath = QDir(dataDirPath).absoluteFilePath(u"color-index-%1.tsv"_s.arg(QString::fromLatin1(hash)));
+    }
+    FolderWatcher watcher(options, pipelineOptions, indexFilePath);
+    QTextStream out(stdout);
+    QObject::connect(&watcher, &FolderWatcher::resultReady, &watcher, [&out](const BatchResult& result){
+        if (!result.errorMessage.isEmpty()) {
+            qCritical().noquote() << QDir::toNativeSeparators(result.filePath) << ':' << result.errorMessage;
+            return;
+        }
+        printResult(out, result.filePath, result.colorList);
+    });
+    if (!watcher.start(directoryPathList)) {
+        return EXIT_FAILURE;
+    }
+    return QCoreApplication::exec();
+}
+
+[[nodiscard]] static inline int runBatch(const QCommandLineParser& parser, const CommandLineOptions& cmd, const QString& traceFilePath) {
+    UserOptions options{};
+    if (!parseUserOptions(parser, cmd, options)) {
+        return EXIT_FAILURE;
+    }
+    qsizetype shardCount{ 0 };
+    if (!parseInteger(parser, cmd.shards, shardCount)) {
+        return EXIT_FAILURE;
+    }
+    if (parser.isSet(cmd.shardWorker)) {
+        qsizetype shardIndex{ 0 };
+        if (!parseInteger(parser, cmd.shardWorker, shardIndex) || parser.positionalArguments().size() != 1) {
+            return EXIT_FAILURE;
+        }
+        options.filePath = parser.positionalArguments().constFirst();
+        return runShardWorker(options, shardIndex, shardCount);
+    }
+    BatchPipelineOptions pipelineOptions{};
+    {
+        qsizetype readerCount{ 0 };
+        qsizetype decoderCount{ 0 };
+        qsizetype extractorCount{ 0 };
+        qsizetype clustererCount{ 0 };
+        if (!parseInteger(parser, cmd.readers, readerCount) || !parseInteger(parser, cmd.decoders, decoderCount)
+            || !parseInteger(parser, cmd.extractors, extractorCount) || !parseInteger(parser, cmd.clusterers, clustererCount)
+            || !parseInteger(parser, cmd.queueCapacity, pipelineOptions.queueCapacity)) {
+            return EXIT_FAILURE;
+        }
+        pipelineOptions.readerCount = int(readerCount);
+        pipelineOptions.decoderCount = int(decoderCount);
+        pipelineOptions.extractorCount = int(extractorCount);
+        pipelineOptions.clustererCount = int(clustererCount);
+    }
+    if (parser.isSet(cmd.watch)) {
+        if (parser.isSet(cmd.charts) || parser.isSet(cmd.shards)) {
+            qCritical() << "--charts and --shards are not supported together with --watch.";
+            return EXIT_FAILURE;
+        }
+        return runWatch(parser, cmd, options, pipelineOptions);
+    }
+    const QStringList filePathList{ collectImageFilePaths(parser.positionalArguments()) };
+    if (filePathList.isEmpty()) {
+        qCritical() << "No image files found.";
+        return EXIT_FAILURE;
+    }
+    if (shardCount > 1) {
+        // The shard workers count every pixel of their stripe at full resolution and only report statistics,
+        // anything else would be silently ignored. The region of interest is supported, see "runShardWorker()".
+        if (parser.isSet(cmd.charts) || options.memoryBudget > 0 || options.samplingMethod != SamplingMethod::None || options.multiResolution) {
+            qCritical() << "--charts, --memory-budget, --sampling and --multi-resolution are not supported together with --shards.";
+            return EXIT_FAILURE;
+        }
+        return runShardedBatch(filePathList, options, shardCount, traceFilePath);
+    }
+    ChartOptions chartOptions{};
+    if (!parseChartOptions(parser, cmd, filePathList, chartOptions)) {
+        return EXIT_FAILURE;
+    }
+    // Charts are rendered next to the pipeline instead of on the sink thread, which would hold up the results.
+    // When the renderers fall behind, the sink renders by itself, which also slows the pipeline down to their pace.
+    std::unique_ptr<TaskScheduler> chartScheduler{};
+    if (!chartOptions.directoryPath.isEmpty()) {
+        ensureEmbeddedFontsRegistered();
+        TaskSchedulerOptions schedulerOptions{};
+        schedulerOptions.rejectionPolicy = RejectionPolicy::RejectNew;
+        chartScheduler = std::make_unique<TaskScheduler>(schedulerOptions);
+    }
+    QTextStream out(stdout);
+    qsizetype failureCount{ 0 };
+    std::atomic<qsizetype> chartFailureCount{ 0 };
+    BatchPipeline pipeline(options, pipelineOptions);
+    pipeline.run(filePathList, [&out, &failureCount, &chartOptions, &chartScheduler, &chartFailureCount](BatchResult result){
+        if (!result.errorMessage.isEmpty()) {
+            ++failureCount;
+            qCritical().noquote() << QDir::toNativeSeparators(result.filePath) << ':' << result.errorMessage;
+            return;
+        }
+        printResult(out, result.filePath, result.colorList);
+        if (!chartScheduler) {
+            return;
+        }
+        const auto& renderChart{ [&chartOptions, &chartFailureCount, filePath = result.filePath, colorList = result.colorList](){
+            if (!writeChart(chartOptions, filePath, colorList)) {
+                ++chartFailureCount;
+            }
+        } };
+        if (!chartScheduler->submit(TaskPriority::Batch, {}, [renderChart](const CancellationToken&, AnalysisWorkspace&){ renderChart(); })) {
+            renderChart();
+        }
+    });
+    if (chartScheduler) {
+        chartScheduler->waitForDone();
+    }
+    return (failureCount > 0 || chartFailureCount > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#ifdef Q_OS_WINDOWS
+// The executable is built for the GUI subsystem, so Windows doesn't give it a console, and whatever batch mode
+// prints is lost when it's started from a command prompt. Borrow the console of the parent process instead. The
+// streams which have been redirected already (to a file, a pipe, a shard coordinator, ...) are left alone.
+static inline void attachToParentConsole() {
+    const bool hasOutput{ GetStdHandle(STD_OUTPUT_HANDLE) != nullptr };
+    const bool hasError{ GetStdHandle(STD_ERROR_HANDLE) != nullptr };
+    const bool hasInput{ GetStdHandle(STD_INPUT_HANDLE) != nullptr };
+    if ((hasOutput && hasError && hasInput) || !AttachConsole(ATTACH_PARENT_PROCESS)) {
+        return;
+    }
+    FILE* stream{ nullptr };
+    if (!hasOutput) {
+        freopen_s(&stream, "CONOUT$", "w", stdout);
+    }
+    if (!hasError) {
+        freopen_s(&stream, "CONOUT$", "w", stderr);
+    }
+    if (!hasInput) {
+        freopen_s(&stream, "CONIN$", "r", stdin);
+    }
+}
+#endif
+
 int main(int argc, char *argv[]) {
+    // Started as early as possible so that the reported time-to-first-frame covers
+    // the QApplication construction as well.
+    QElapsedTimer startupTimer{};
+    startupTimer.start();
+
     QCoreApplication::setAttribute(Qt::AA_DontCreateNativeWidgetSiblings);
 
     QCoreApplication::setApplicationName(u"Image Color Analyzer"_s);
@@ -15,42 +434,112 @@ int main(int argc, char *argv[]) {
     QCoreApplication::setOrganizationName(u"wangwenx190"_s);
     QCoreApplication::setOrganizationDomain(u"https://wangwenx190.github.io/"_s);
 
-    QApplication application(argc, argv);
+    QCommandLineParser parser{};
+    parser.setApplicationDescription(u"A small GUI tool to analyze the main colors of a given image.\n"
+                                     u"If any files or directories are given, they are analyzed in batch mode without showing any window."_s);
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument(u"paths"_s, QCoreApplication::translate("main", "Image files or directories to analyze in batch mode."), u"[paths...]"_s);
+    const CommandLineOptions cmd{};
+    cmd.addTo(parser);
+
+    // We need to know which kind of application object to create before we can create it, the batch
+    // mode must not depend on a display. Errors are ignored here, they'll be reported by "process()".
+    bool isBatchMode{ false };
+    {
+        QStringList arguments{};
+        for (int index{ 0 }; index < argc; ++index) {
+            arguments.push_back(QString::fromLocal8Bit(argv[index]));
+        }
+        isBatchMode = parser.parse(arguments) && !parser.positionalArguments().isEmpty();
+    }
+#ifdef Q_OS_WINDOWS
+    // Before anything is printed: Qt decides only once whether its messages go to the console or to the debugger.
+    if (isBatchMode) {
+        attachToParentConsole();
+    }
+#endif
+    // Rendering charts needs fonts and therefore a QGuiApplication, but still no display.
+    const bool needsGui{ !isBatchMode || parser.isSet(cmd.charts) };
+    if (isBatchMode && needsGui && !qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    std::unique_ptr<QCoreApplication> application{};
+    if (!isBatchMode) {
+        application = std::make_unique<QApplication>(argc, argv);
+    } else if (needsGui) {
+        application = std::make_unique<QGuiApplication>(argc, argv);
+    } else {
+        application = std::make_unique<QCoreApplication>(argc, argv);
+    }
 
     std::setlocale(LC_ALL, "C.UTF-8");
     QLocale::setDefault(QLocale::c());
-    QDir::setCurrent(QCoreApplication::applicationDirPath());
 
-    {
-        const QString preferredFontFamily{ std::move(u"JetBrains Mono"_s) };
-        bool hasOurRequiredFont{ false };
-        const QStringList systemFontFamilyList{ std::move(QFontDatabase::families()) };
-        for (auto&& systemFontFamily : systemFontFamilyList) {
-            if (systemFontFamily == preferredFontFamily) {
-                hasOurRequiredFont = true;
-                break;
-            }
+    parser.process(*application);
+
+    // Resolved right away, the current directory may change below. Shard workers inherit the environment
+    // of their coordinator, they must not overwrite its trace: they only trace into the file their coordinator
+    // gives them, see "ProcessShardTransport".
+    QString traceFilePath{};
+    if (parser.isSet(cmd.trace)) {
+        traceFilePath = parser.value(cmd.trace);
+    } else if (!parser.isSet(cmd.shardWorker)) {
+        traceFilePath = qEnvironmentVariable("IMAGE_COLOR_ANALYZER_TRACE");
+    }
+    if (!traceFilePath.isEmpty()) {
+        traceFilePath = QFileInfo(traceFilePath).absoluteFilePath();
+        enableTracing();
+    }
+    const auto traceWriter{ qScopeGuard([&traceFilePath](){
+        if (!traceFilePath.isEmpty()) {
+            const bool written{ writeTrace(traceFilePath) }; // Failures have been reported already.
+            Q_UNUSED(written);
         }
-        if (!hasOurRequiredFont) {
-            int result{ QFontDatabase::addApplicationFont(u":/fonts/JetBrainsMono-Regular.ttf"_s) };
-            Q_ASSERT(result >= 0);
-            result = QFontDatabase::addApplicationFont(u":/fonts/JetBrainsMono-Bold.ttf"_s);
-            Q_ASSERT(result >= 0);
-            result = QFontDatabase::addApplicationFont(u":/fonts/JetBrainsMono-Italic.ttf"_s);
-            Q_ASSERT(result >= 0);
-            result = QFontDatabase::addApplicationFont(u":/fonts/JetBrainsMono-BoldItalic.ttf"_s);
-            Q_ASSERT(result >= 0);
-            Q_UNUSED(result);
+    }) };
+
+    // A regression aid like "--measure-startup": compare the output before and after a change, eg. on large images.
+    const auto memoryReporter{ qScopeGuard([&parser, &cmd](){
+        if (!parser.isSet(cmd.measureMemory)) {
+            return;
+        }
+        const qint64 peakBytes{ peakResidentSetSize() };
+        // Critical information in this mode, always output, no matter whether this is a debug build or not.
+        if (peakBytes < 0) {
+            qInfo() << "Peak resident set size: unknown on this platform.";
+        } else {
+            qInfo().nospace() << "Peak resident set size: " << peakBytes / 1024 << " KiB.";
         }
+    }) };
+
+    if (isBatchMode) {
+        // Don't change the current directory in this mode, the user may have given us relative paths.
+        return runBatch(parser, cmd, traceFilePath);
+    }
+
+    QDir::setCurrent(QCoreApplication::applicationDirPath());
+
+    // Don't query the font database here: enumerating all the system font families is surprisingly
+    // slow on some systems (especially with network home directories). Our embedded fonts will be
+    // registered right before we paint any text for the first time, see "ensureEmbeddedFontsRegistered()".
+    {
         QFont font{ QGuiApplication::font() };
         font.setStyleStrategy(static_cast<QFont::StyleStrategy>(QFont::PreferQuality | QFont::PreferAntialias));
-        font.setFamily(preferredFontFamily);
+        font.setFamily(u"JetBrains Mono"_s);
         font.setPixelSize(14);
         QGuiApplication::setFont(font);
     }
 
     MainWindow mainWindow{};
+    if (parser.isSet(cmd.measureStartup)) {
+        QObject::connect(&mainWindow, &MainWindow::firstFramePainted, application.get(), [&startupTimer](){
+            // Critical information in this mode, always output, no matter whether this is a debug build or not.
+            qInfo().nospace() << "Time to first frame: " << startupTimer.elapsed() << " milliseconds.";
+            // Let the frame reach the screen before we exit.
+            QTimer::singleShot(0, qApp, &QCoreApplication::quit);
+        }, Qt::QueuedConnection);
+    }
     mainWindow.show();
 
-    return application.exec();
+    return application->exec();
 }
@@ -1,4 +1,8 @@
 #include "mainwindow.h"
+#include "coloranalyzer.h"
+#include "taskscheduler.h"
+#include "piechart.h"
+#include "shardedclustering.h"
 #include <QShortcut>
 #include <QPainter>
 #include <QFileDialog>
@@ -8,6 +12,7 @@
 #include <QDragEnterEvent>
 #include <QDropEvent>
 #include <QMimeData>
+#include <QFile>
 #include <QFileInfo>
 #include <QVariant>
 #include <QColor>
@@ -15,8 +20,6 @@
 #include <QUrl>
 #include <QHash>
 #include <QDir>
-#include <QElapsedTimer>
-#include <QFontMetrics>
 #include <QSettings>
 #include <QStandardPaths>
 #include <QGuiApplication>
@@ -28,315 +31,17 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QSpinBox>
+#include <QComboBox>
+#include <QCheckBox>
 #include <QClipboard>
-#include <QThread>
-#include <QMutex>
-#include <QQueue>
-#include <random>
+#include <QScopeGuard>
+#include <QtMath>
+#include <QRubberBand>
+#include <QImageReader>
+#include <QDialogButtonBox>
 
 using namespace Qt::StringLiterals;
 
-#ifdef _DEBUG
-static constexpr const bool IS_DEBUG_BUILD{ true };
-#else
-static constexpr const bool IS_DEBUG_BUILD{ false };
-#endif
-
-static constexpr const auto INVALID_COLOR_DISTANCE{ std::numeric_limits<qreal>::max() };
-
-struct Pixel final {
-    quint8 r{ 0 };
-    quint8 g{ 0 };
-    quint8 b{ 0 };
-
-    friend bool operator==(Pixel lhs, Pixel rhs);
-    friend bool operator!=(Pixel lhs, Pixel rhs);
-
-    friend std::size_t qHash(Pixel key, std::size_t seed);
-};
-
-[[nodiscard]] static inline bool operator==(Pixel lhs, Pixel rhs) {
-    return lhs.r == rhs.r && lhs.g == rhs.g && lhs.b == rhs.b;
-}
-
-[[nodiscard]] static inline bool operator!=(Pixel lhs, Pixel rhs) {
-    return !operator==(lhs, rhs);
-}
-
-[[nodiscard]] static inline std::size_t qHash(Pixel key, std::size_t seed = 0) {
-    return qHashMulti(seed, key.r, key.g, key.b);
-}
-
-[[nodiscard]] static inline qreal colorDistance(Pixel lhs, Pixel rhs) {
-    const auto dr{ lhs.r - rhs.r };
-    const auto dg{ lhs.g - rhs.g };
-    const auto db{ lhs.b - rhs.b };
-    return qSqrt(qreal(dr * dr) + qreal(dg * dg) + qreal(db * db));
-}
-
-struct ColorItem final {
-    QColor color{};
-    qreal ratio{ 0 };
-};
-using ColorItemList = QList<ColorItem>;
-
-struct UserOptions final {
-    QString filePath{}; // MUST be a local file path, not an URL.
-    qsizetype k{ 5 }; // 4~8 is best, don't be too large (eg. > 20)! We want to get the most "attractive" color, if k is too large, the result would be distracted!
-    qsizetype maxIterations{ 50 }; // Most of the time the iteration will stop at around 20 or so.
-    int maxWidth{ 100 }; // If > 0, the image size will be shrinked to not exceed this width. The image width won't be changed if this value <= 0.
-    int maxHeight{ 100 }; // Same as above, just only applied to height.
-    int alphaThreshold{ 180 }; // If > 0 and < 255, only the pixels whose alpha >= this value are accepted.
-};
-
-[[nodiscard]] static inline bool extractColorsFromImage(ColorItemList& resultOut, QImage imageIn, const UserOptions& options) {
-    QElapsedTimer timer{};
-    timer.start();
-    if constexpr (IS_DEBUG_BUILD) {
-        qInfo() << "------------------------------------------------------";
-        qDebug() << "Checking whether there are any in-appropriate function parameters ...";
-        qDebug().nospace() << "k=" << options.k << ", maxIterations=" << options.maxIterations << ", maxWidth=" << options.maxWidth << ", maxHeight=" << options.maxHeight << ", alphaThreshold=" << options.alphaThreshold;
-    }
-    Q_ASSERT(!imageIn.isNull());
-    Q_ASSERT(options.k > 1);
-    Q_ASSERT(options.maxIterations > 0);
-    if (Q_UNLIKELY(imageIn.isNull() || options.k <= 1 || options.maxIterations <= 0)) {
-        qWarning() << "Function parameter not valid, algorithm forcely exited. Please try again with appropriate ones.";
-        return false;
-    }
-    QImage image(std::move(imageIn));
-    if constexpr (IS_DEBUG_BUILD) {
-        qDebug() << "All function parameters seems to be valid.";
-        qDebug().nospace() << "Image information: size: " << image.width() << "x" << image.height();
-        qDebug() << "Checking whether we need to shrink the image size to speed up the whole process ...";
-    }
-    const qsizetype originalImageTotalPixelCount{ image.width() * image.height() };
-    if (Q_LIKELY(options.maxWidth > 0 || options.maxHeight > 0)) {
-        int targetWidth{ image.width() };
-        if (options.maxWidth > 0) {
-            targetWidth = qMin(targetWidth, options.maxWidth);
-        }
-        int targetHeight{ image.height() };
-        if (options.maxHeight > 0) {
-            targetHeight = qMin(targetHeight, options.maxHeight);
-        }
-        if (Q_LIKELY(targetWidth != image.width() || targetHeight != image.height())) {
-            image = std::move(image.scaled(targetWidth, targetHeight, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
-            Q_ASSERT(!image.isNull());
-            if constexpr (IS_DEBUG_BUILD) {
-                qDebug().nospace() << "Image size shrinked to: " << targetWidth << "x" << targetHeight;
-            }
-        }
-    }
-    const qsizetype nowImageTotalPixelCount{ image.width() * image.height() };
-    if constexpr (IS_DEBUG_BUILD) {
-        if (nowImageTotalPixelCount == originalImageTotalPixelCount) {
-            qDebug() << "The image size is not shrinked, we will process the original image as-is.";
-        }
-        qDebug() << "Preparing the pixel list ...";
-    }
-    QList<Pixel> pixelList{};
-    pixelList.reserve(nowImageTotalPixelCount);
-    for (int y{ 0 }; y < image.height(); ++y) {
-        for (int x{ 0 }; x < image.width(); ++x) {
-            const QRgb rgba{ image.pixel(x, y) };
-            const int a{ qAlpha(rgba) };
-            if (Q_LIKELY(options.alphaThreshold <= std::numeric_limits<quint8>::min() || options.alphaThreshold >= std::numeric_limits<quint8>::max() || a >= options.alphaThreshold)) {
-                const auto r{ static_cast<quint8>(qRed(rgba)) };
-                const auto g{ static_cast<quint8>(qGreen(rgba)) };
-                const auto b{ static_cast<quint8>(qBlue(rgba)) };
-                // The Pixel struct is VERY small (only 3 bytes in total), move or copy doesn't have much difference in reality.
-                pixelList.push_back(Pixel{ r, g, b });
-            }
-        }
-    }
-    Q_ASSERT(!pixelList.isEmpty());
-    if (Q_UNLIKELY(pixelList.isEmpty())) {
-        qWarning() << "No valid pixels found, please check the image file and/or the alpha threshold.";
-        return false;
-    }
-    // No longer needed from now on and it may use much memory in many cases, so release
-    // it's memory as soon as possible.
-    image = {};
-    const qsizetype totalValidPixelCount{ pixelList.size() };
-    if constexpr (IS_DEBUG_BUILD) {
-        qDebug() << "Pixel list generated.";
-        const qsizetype invalidPixelCount{ nowImageTotalPixelCount - totalValidPixelCount };
-        qDebug().nospace() << "Total pixel count: " << nowImageTotalPixelCount << ", valid pixel count: " << totalValidPixelCount << " ("
-                           << qreal(totalValidPixelCount) / qreal(nowImageTotalPixelCount) * qreal(100)
-                           << "%), invalid pixel count: " << invalidPixelCount << " ("
-                           << qreal(invalidPixelCount) / qreal(nowImageTotalPixelCount) * qreal(100) << "%)";
-    }
-    if constexpr (IS_DEBUG_BUILD) {
-        qDebug() << "Start building random centroid list ...";
-    }
-    QList<Pixel> centroidList(options.k);
-    const auto& generateRandomCentroidList{ [totalValidPixelCount, &pixelList, &centroidList, &options](){
-        QList<qsizetype> indiceList(totalValidPixelCount);
-        for (qsizetype index{ 0 }; index < indiceList.size(); ++index) {
-            indiceList[index] = index;
-        }
-        {
-            std::random_device rd{};
-            std::mt19937_64 mt64(rd());
-            std::shuffle(indiceList.begin(), indiceList.end(), mt64);
-        }
-        for (qsizetype index{ 0 }; index < options.k && index < totalValidPixelCount; ++index) {
-            const auto randomIndex{ indiceList[index] };
-            centroidList[index] = pixelList[randomIndex];
-        }
-    } };
-    generateRandomCentroidList();
-    if constexpr (IS_DEBUG_BUILD) {
-        qDebug() << "Random centroid list generated.";
-        qDebug() << "Start building cluster list ...";
-    }
-    QList<QList<Pixel>> clusterList(options.k);
-    for (auto& cluster : clusterList) {
-        cluster.reserve(totalValidPixelCount);
-    }
-    qsizetype badClusterTimes{ 0 };
-    while (true) {
-        Q_ASSERT(badClusterTimes <= 10);
-        if (badClusterTimes > 10) {
-            // Critical message, always output, no matter whether this is a debug build or not.
-            qCritical() << "Failed too many times, algorithm forcely exited. Please try again.";
-            return false;
-        }
-        if constexpr (IS_DEBUG_BUILD) {
-            qDebug() << "Start iterating.";
-        }
-        bool badClusterDetected{ false };
-        for (qsizetype iteration{ 0 }; iteration < options.maxIterations; ++iteration) {
-            if constexpr (IS_DEBUG_BUILD) {
-                qDebug() << "Current iteration:" << iteration + 1;
-            }
-            for (auto& cluster : clusterList) {
-                cluster.clear();
-            }
-            for (const Pixel pixel : std::as_const(pixelList)) {
-                auto minimumDistance{ INVALID_COLOR_DISTANCE };
-                qsizetype closestIndex{ -1 };
-                for (qsizetype index{ 0 }; index < options.k; ++index) {
-                    const auto distance{ colorDistance(pixel, centroidList[index]) };
-                    Q_ASSERT(qFuzzyIsNull(distance) || distance > qreal(0));
-                    Q_ASSERT(distance < INVALID_COLOR_DISTANCE);
-                    if (distance < minimumDistance) {
-                        minimumDistance = distance;
-                        closestIndex = index;
-                    }
-                }
-                Q_ASSERT(closestIndex >= 0);
-                Q_ASSERT(closestIndex < options.k);
-                clusterList[closestIndex].push_back(pixel);
-            }
-            bool changed{ false };
-            QList<Pixel> newCentroidList(options.k);
-            for (qsizetype index{ 0 }; index < options.k; ++index) {
-                const auto& cluster{ clusterList[index] };
-                //Q_ASSERT(!cluster.isEmpty());
-                //Q_ASSERT(cluster.size() < totalValidPixelCount);
-                if (cluster.isEmpty() || cluster.size() >= totalValidPixelCount) {
-                    badClusterDetected = true;
-                    break;
-                }
-                quint64 r{ 0 };
-                quint64 g{ 0 };
-                quint64 b{ 0 };
-                for (const Pixel pixel : std::as_const(cluster)) {
-                    r += pixel.r;
-                    g += pixel.g;
-                    b += pixel.b;
-                }
-                const auto totalPixelCount{ qreal(cluster.size()) };
-                r = qRound64(qreal(r) / totalPixelCount);
-                Q_ASSERT(r >= std::numeric_limits<quint8>::min() && r <= std::numeric_limits<quint8>::max());
-                g = qRound64(qreal(g) / totalPixelCount);
-                Q_ASSERT(g >= std::numeric_limits<quint8>::min() && g <= std::numeric_limits<quint8>::max());
-                b = qRound64(qreal(b) / totalPixelCount);
-                Q_ASSERT(b >= std::numeric_limits<quint8>::min() && b <= std::numeric_limits<quint8>::max());
-                newCentroidList[index] = Pixel{ static_cast<quint8>(r), static_cast<quint8>(g), static_cast<quint8>(b) };
-                if (colorDistance(centroidList[index], newCentroidList[index]) > qreal(1)) {
-                    changed = true;
-                }
-            }
-            if (badClusterDetected) {
-                if constexpr (IS_DEBUG_BUILD) {
-                    qWarning() << "Found bad cluster. Iteration forcely ended.";
-                }
-                break;
-            }
-            if (!changed) {
-                if constexpr (IS_DEBUG_BUILD) {
-                    qDebug() << "Result seems to be stable enough now. Iteration ended normally. Final iteration count:" << iteration + 1;
-                }
-                break;
-            }
-            centroidList = std::move(newCentroidList);
-            //qSwap(centroidList, newCentroidList);
-        }
-        if (badClusterDetected) {
-            ++badClusterTimes;
-            generateRandomCentroidList();
-            if constexpr (IS_DEBUG_BUILD) {
-                qDebug() << "Centroid list regenerated. Re-starting iteration now ...";
-            }
-            continue;
-        }
-        break;
-    }
-    if constexpr (IS_DEBUG_BUILD) {
-        qDebug() << "Cluster list stablized, start re-ordering them by their pixel count ...";
-    }
-    // No longer needed from now on and it may use much memory depending on the image and user options,
-    // so release it's memory as soon as possible.
-    pixelList = {};
-    QList<qsizetype> clusterSizeList(options.k);
-    for (qsizetype index{ 0 }; index < options.k; ++index) {
-        clusterSizeList[index] = clusterList[index].size();
-    }
-    // No longer needed from now on and it may use much memory depending on the image and user options,
-    // so release it's memory as soon as possible.
-    clusterList = {};
-    QList<qsizetype> clusterIndexList(options.k);
-    for (qsizetype index{ 0 }; index < options.k; ++index) {
-        clusterIndexList[index] = index;
-    }
-    std::sort(clusterIndexList.begin(), clusterIndexList.end(),
-              [&clusterSizeList](qsizetype indexLHS, qsizetype indexRHS){
-                  return clusterSizeList[indexLHS] < clusterSizeList[indexRHS];
-              });
-    const auto& generateResultForIndex{ [totalValidPixelCount, &centroidList, &clusterSizeList, &options](const qsizetype clusterIndex){
-        Q_ASSERT(clusterIndex >= 0);
-        Q_ASSERT(clusterIndex < options.k);
-        const Pixel pixel{ centroidList[clusterIndex] };
-        ColorItem result{};
-        result.color = std::move(QColor::fromRgb(static_cast<int>(pixel.r), static_cast<int>(pixel.g), static_cast<int>(pixel.b)));
-        const qsizetype clusterSize{ clusterSizeList[clusterIndex] };
-        Q_ASSERT(clusterSize > 0);
-        Q_ASSERT(clusterSize < totalValidPixelCount);
-        result.ratio = qreal(clusterSize) / qreal(totalValidPixelCount);
-        return std::move(result);
-    } };
-    if constexpr (IS_DEBUG_BUILD) {
-        const qsizetype clusterIndex{ clusterIndexList.constLast() };
-        const auto result{ generateResultForIndex(clusterIndex) };
-        qDebug().noquote().nospace() << "Re-ordering done. The most dominant color is: " << std::move(result.color.name().toUpper()) << ", ratio: " << result.ratio * qreal(100) << "%";
-        qDebug() << "Start generating result ...";
-    }
-    resultOut.resize(options.k);
-    for (qsizetype index{ 0 }; index < options.k; ++index) {
-        const qsizetype clusterIndex{ clusterIndexList[index] };
-        auto result{ generateResultForIndex(clusterIndex) };
-        resultOut[index] = std::move(result);
-    }
-    if constexpr (IS_DEBUG_BUILD) {
-        qDebug() << "Result ready. Everything DONE now.";
-        qDebug() << "Total elapsed time:" << timer.elapsed() << "milliseconds.";
-    }
-    return true;
-}
-
 [[nodiscard]] static inline bool extractImageDataFromMimeData(const QMimeData* md, QVariant* dataOut = nullptr) {
     Q_ASSERT(md);
     if (!md->hasImage() && !md->hasUrls() && !md->hasText()) {
@@ -374,7 +79,11 @@ struct UserOptions final {
     if (Q_LIKELY(extName.compare(u"png"_s, Qt::CaseInsensitive) == 0 ||
                  extName.compare(u"jpg"_s, Qt::CaseInsensitive) == 0 ||
                  extName.compare(u"jpeg"_s, Qt::CaseInsensitive) == 0 ||
-                 extName.compare(u"bmp"_s, Qt::CaseInsensitive) == 0)) {
+                 extName.compare(u"bmp"_s, Qt::CaseInsensitive) == 0 ||
+                 extName.compare(u"gif"_s, Qt::CaseInsensitive) == 0 ||
+                 extName.compare(u"webp"_s, Qt::CaseInsensitive) == 0 ||
+                 extName.compare(u"tif"_s, Qt::CaseInsensitive) == 0 ||
+                 extName.compare(u"tiff"_s, Qt::CaseInsensitive) == 0)) {
         if (dataOut) {
             *dataOut = std::move(fileInfo.canonicalFilePath());
         }
@@ -383,21 +92,6 @@ struct UserOptions final {
     return false;
 }
 
-[[nodiscard]] static inline bool isColorLight(const QColor& color) {
-    Q_ASSERT(color.isValid());
-    const auto& toLinear = [](const qreal value) {
-        Q_ASSERT(qFuzzyIsNull(value) || value > qreal(0));
-        Q_ASSERT(qFuzzyCompare(value, qreal(1)) || value < qreal(1));
-        static constexpr const qreal magic{ 0.03928 };
-        return (qFuzzyCompare(value, magic) || value < magic) ? (value / 12.92) : qPow((value + 0.055) / 1.055, 2.4);
-    };
-    const auto linearR{ toLinear(color.redF()) };
-    const auto linearG{ toLinear(color.greenF()) };
-    const auto linearB{ toLinear(color.blueF()) };
-    const auto luminance{ 0.2126 * linearR + 0.7152 * linearG + 0.0722 * linearB };
-    return luminance > 0.5;
-}
-
 [[nodiscard]] static inline bool isPointInPieSlice(const QPointF& point, const QPointF& center, const qreal radius, qreal startAngleDeg, qreal endAngleDeg) {
     Q_ASSERT(radius > qreal(0));
     Q_ASSERT(!qFuzzyCompare(startAngleDeg, endAngleDeg));
@@ -436,26 +130,49 @@ struct UserOptions final {
     return angleDeg > startAngleDeg && angleDeg < endAngleDeg;
 }
 
-class WorkerThread final : public QThread {
-    Q_OBJECT
-
+// Shows a preview of the image and lets the user drag a rubber band over the part to analyze.
+class RegionSelectionView final : public QWidget {
 public:
-    explicit WorkerThread(QObject* parent = nullptr);
-    ~WorkerThread() override;
+    explicit RegionSelectionView(QWidget* parent = nullptr);
+    ~RegionSelectionView() override;
 
-public Q_SLOTS:
-    void addTask(const UserOptions& options);
+    [[nodiscard]] bool loadImage(const QString& filePath);
 
-Q_SIGNALS:
-    void newResultReady(ColorItemList result);
-    void errorOccurred(QString message);
+    // In the original image's pixel coordinates, null means the whole image.
+    [[nodiscard]] QRect region() const;
+    void setRegion(const QRect& region);
+
+    [[nodiscard]] QSize sizeHint() const override;
 
 protected:
-    void run() override;
+    void paintEvent(QPaintEvent* event) override;
+    void mousePressEvent(QMouseEvent* event) override;
+    void mouseMoveEvent(QMouseEvent* event) override;
+    void mouseReleaseEvent(QMouseEvent* event) override;
 
 private:
-    QMutex m_taskMutex{};
-    QQueue<UserOptions> m_taskQueue{};
+    static inline constexpr const QSize s_maximumPreviewSize{ 800, 600 };
+
+    QImage m_preview{};
+    QSize m_imageSize{};
+    QRubberBand* m_rubberBand{ nullptr };
+    QPoint m_origin{};
+};
+
+class RegionSelectionDialog final : public QDialog {
+    Q_OBJECT
+
+public:
+    explicit RegionSelectionDialog(QWidget* parent = nullptr, Qt::WindowFlags f = {});
+    ~RegionSelectionDialog() override;
+
+    [[nodiscard]] bool loadImage(const QString& filePath);
+
+    [[nodiscard]] QRect region() const;
+    void setRegion(const QRect& region);
+
+private:
+    RegionSelectionView* m_view{ nullptr };
 };
 
 class OptionsDialog final : public QDialog {
@@ -468,9 +185,6 @@ public:
     [[nodiscard]] UserOptions& userOptions();
     [[nodiscard]] const UserOptions& userOptions() const;
 
-    [[nodiscard]] QSettings& settings();
-    [[nodiscard]] const QSettings& settings() const;
-
 protected:
     void showEvent(QShowEvent* event) override;
 
@@ -481,6 +195,14 @@ private:
     QSpinBox* m_maxWidthSpin{ nullptr };
     QSpinBox* m_maxHeightSpin{ nullptr };
     QSpinBox* m_alphaThresholdSpin{ nullptr };
+    QComboBox* m_samplingMethodCombo{ nullptr };
+    QSpinBox* m_sampleBudgetSpin{ nullptr };
+    QCheckBox* m_analyzeAllFramesCheck{ nullptr };
+    QCheckBox* m_multiResolutionCheck{ nullptr };
+    QSpinBox* m_memoryBudgetSpin{ nullptr };
+    QLabel* m_regionLabel{ nullptr };
+    QRect m_regionOfInterest{};
+    QString m_regionFilePath{}; // The (canonical) file the region of interest has been selected for.
     UserOptions m_options{};
     QSettings m_settings{};
 };
@@ -490,65 +212,162 @@ class MainWindowPrivate final {
     Q_DECLARE_PUBLIC(MainWindow)
 
 public:
-    static inline constexpr const qreal s_margin{ 50 };
-    static inline constexpr const auto s_backgroundColor{ QColorConstants::Transparent };
-
     MainWindowPrivate(MainWindow* qq);
     ~MainWindowPrivate();
 
     void parseImage();
+    void runAnalysis(const UserOptions& options, const CancellationToken& cancellationToken, AnalysisWorkspace& workspace);
+    void showResult(ColorItemList result);
+    void showTimeline(QList<ColorItemList> result);
+    void showError(const QString& message);
+    [[nodiscard]] OptionsDialog* ensureOptionsDialog();
     [[nodiscard]] QRectF pieRect() const;
-    [[nodiscard]] QPixmap grabResultImage();
+    [[nodiscard]] QRectF timelineRect() const;
+    [[nodiscard]] qsizetype frameIndexAt(const QPointF& pos) const;
+    void showFrame(const qsizetype frameIndex);
+    [[nodiscard]] PieChart pieChart(const bool interactive) const;
+    [[nodiscard]] QSize exportSize() const;
 
     MainWindow* q_ptr{ nullptr };
     qsizetype highlightedSliceIndex{ -1 };
     ColorItemList colorList{};
-    bool isGrabbing{ false };
-    OptionsDialog* optionsDialog{ nullptr };
-    WorkerThread workerThread{};
+    QList<ColorItemList> timeline{}; // One result per frame, only used when analyzing all frames.
+    qsizetype currentFrameIndex{ -1 };
+    bool hasPaintedFirstFrame{ false };
+    OptionsDialog* optionsDialog{ nullptr }; // Created on first use, see "ensureOptionsDialog()".
+    TaskScheduler taskScheduler{};
+    CancellationToken currentTaskToken{}; // Of the most recent analysis, older ones are cancelled when a new one starts.
     QString alternativeImageFilePath{};
 };
 
-WorkerThread::WorkerThread(QObject* parent) : QThread{ parent } {
-    setObjectName(u"WorkerThread"_s);
+RegionSelectionView::RegionSelectionView(QWidget* parent) : QWidget{ parent } {
+    setAttribute(Qt::WA_DontCreateNativeAncestors);
+    setCursor(Qt::CrossCursor);
+    m_rubberBand = new QRubberBand(QRubberBand::Rectangle, this);
+    m_rubberBand->hide();
 }
 
-WorkerThread::~WorkerThread() = default;
+RegionSelectionView::~RegionSelectionView() = default;
 
-void WorkerThread::addTask(const UserOptions& options) {
-    const QMutexLocker locker(&m_taskMutex);
-    m_taskQueue.enqueue(options);
+bool RegionSelectionView::loadImage(const QString& filePath) {
+    QImageReader reader(filePath);
+    m_imageSize = reader.size();
+    // Only a preview is needed, let the decoder shrink the image if it can, that's much cheaper for huge images.
+    if (m_imageSize.isValid() && (m_imageSize.width() > s_maximumPreviewSize.width() || m_imageSize.height() > s_maximumPreviewSize.height())) {
+        reader.setScaledSize(m_imageSize.scaled(s_maximumPreviewSize, Qt::KeepAspectRatio));
+    }
+    m_preview = reader.read();
+    if (m_preview.isNull()) {
+        return false;
+    }
+    if (!m_imageSize.isValid()) {
+        m_imageSize = m_preview.size();
+        m_preview = m_preview.scaled(m_imageSize.boundedTo(s_maximumPreviewSize), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    setFixedSize(m_preview.size());
+    return true;
 }
 
-void WorkerThread::run() {
-    while (true) {
-        if (isInterruptionRequested()) { // Respect Qt's own facility.
-            return;
-        }
-        UserOptions options{};
-        {
-            QMutexLocker locker(&m_taskMutex);
-            if (m_taskQueue.isEmpty()) {
-                locker.unlock();
-                msleep(10);
-                continue;
-            }
-            options = std::move(m_taskQueue.dequeue());
-        }
-        QImage image{ options.filePath };
-        if (image.isNull()) {
-            Q_EMIT errorOccurred(std::move(tr("The selected image file cannot be loaded successfully!")));
-            msleep(10);
-            continue;
-        }
-        ColorItemList result{};
-        result.reserve(options.k);
-        if (extractColorsFromImage(result, std::move(image), options)) {
-            Q_EMIT newResultReady(std::move(result));
-        } else {
-            Q_EMIT errorOccurred(std::move(tr("Failed to analyze image color!")));
-        }
+QRect RegionSelectionView::region() const {
+    if (m_rubberBand->isHidden() || m_preview.isNull()) {
+        return {};
+    }
+    const qreal xScale{ qreal(m_imageSize.width()) / qreal(m_preview.width()) };
+    const qreal yScale{ qreal(m_imageSize.height()) / qreal(m_preview.height()) };
+    const QRect selection{ m_rubberBand->geometry() };
+    const QRect region(QPoint(qFloor(selection.left() * xScale), qFloor(selection.top() * yScale)),
+                       QPoint(qCeil((selection.right() + 1) * xScale) - 1, qCeil((selection.bottom() + 1) * yScale) - 1));
+    return region & QRect(QPoint(0, 0), m_imageSize);
+}
+
+void RegionSelectionView::setRegion(const QRect& region) {
+    if (!region.isValid() || m_preview.isNull()) {
+        m_rubberBand->hide();
+        return;
+    }
+    const qreal xScale{ qreal(m_preview.width()) / qreal(m_imageSize.width()) };
+    const qreal yScale{ qreal(m_preview.height()) / qreal(m_imageSize.height()) };
+    m_rubberBand->setGeometry(QRectF(region.x() * xScale, region.y() * yScale, region.width() * xScale, region.height() * yScale).toAlignedRect() & rect());
+    m_rubberBand->show();
+}
+
+QSize RegionSelectionView::sizeHint() const {
+    return m_preview.isNull() ? QSize{ 400, 300 } : m_preview.size();
+}
+
+void RegionSelectionView::paintEvent(QPaintEvent* event) {
+    QWidget::paintEvent(event);
+    if (m_preview.isNull()) {
+        return;
     }
+    QPainter painter(this);
+    painter.drawImage(QPoint(0, 0), m_preview);
+}
+
+void RegionSelectionView::mousePressEvent(QMouseEvent* event) {
+    QWidget::mousePressEvent(event);
+    if (event->button() != Qt::LeftButton) {
+        return;
+    }
+    m_origin = event->position().toPoint();
+    m_rubberBand->setGeometry(QRect(m_origin, QSize{}));
+    m_rubberBand->show();
+}
+
+void RegionSelectionView::mouseMoveEvent(QMouseEvent* event) {
+    QWidget::mouseMoveEvent(event);
+    if (!(event->buttons() & Qt::LeftButton)) {
+        return;
+    }
+    m_rubberBand->setGeometry(QRect(m_origin, event->position().toPoint()).normalized() & rect());
+}
+
+void RegionSelectionView::mouseReleaseEvent(QMouseEvent* event) {
+    QWidget::mouseReleaseEvent(event);
+    if (event->button() != Qt::LeftButton) {
+        return;
+    }
+    // A simple click clears the selection.
+    if (m_rubberBand->geometry().width() < 2 || m_rubberBand->geometry().height() < 2) {
+        m_rubberBand->hide();
+    }
+}
+
+RegionSelectionDialog::RegionSelectionDialog(QWidget* parent, Qt::WindowFlags f) : QDialog{ parent, f } {
+    setAttribute(Qt::WA_DontCreateNativeAncestors);
+
+    setWindowTitle(tr("Select the region of interest"));
+
+    setModal(true);
+
+    m_view = new RegionSelectionView(this);
+
+    auto hintLabel{ new QLabel(this) };
+    hintLabel->setText(tr("Drag over the image to select the region to analyze, click anywhere to select the whole image."));
+
+    auto buttonBox{ new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, this) };
+    connect(buttonBox, &QDialogButtonBox::accepted, this, &RegionSelectionDialog::accept);
+    connect(buttonBox, &QDialogButtonBox::rejected, this, &RegionSelectionDialog::reject);
+
+    auto mainLayout{ new QVBoxLayout(this) };
+    mainLayout->setSizeConstraint(QVBoxLayout::SetFixedSize);
+    mainLayout->addWidget(m_view);
+    mainLayout->addWidget(hintLabel);
+    mainLayout->addWidget(buttonBox);
+}
+
+RegionSelectionDialog::~RegionSelectionDialog() = default;
+
+bool RegionSelectionDialog::loadImage(const QString& filePath) {
+    return m_view->loadImage(filePath);
+}
+
+QRect RegionSelectionDialog::region() const {
+    return m_view->region();
+}
+
+void RegionSelectionDialog::setRegion(const QRect& region) {
+    m_view->setRegion(region);
 }
 
 OptionsDialog::OptionsDialog(QWidget* parent, Qt::WindowFlags f) : QDialog{ parent, f } {
@@ -575,7 +394,7 @@ OptionsDialog::OptionsDialog(QWidget* parent, Qt::WindowFlags f) : QDialog{ pare
                 lastDirPath = std::move(u"."_s);
             }
         }
-        const QString filePath{ std::move(QFileDialog::getOpenFileName(this, MainWindow::tr("Please select an image file to analyze"), lastDirPath, MainWindow::tr("Image Files (*.png *.jpg *.jpeg *.bmp);;All Files (*)"))) };
+        const QString filePath{ std::move(QFileDialog::getOpenFileName(this, MainWindow::tr("Please select an image file to analyze"), lastDirPath, MainWindow::tr("Image Files (*.png *.jpg *.jpeg *.bmp *.gif *.webp *.tif *.tiff);;All Files (*)"))) };
         if (filePath.isEmpty()) {
             return;
         }
@@ -616,6 +435,79 @@ OptionsDialog::OptionsDialog(QWidget* parent, Qt::WindowFlags f) : QDialog{ pare
     m_alphaThresholdSpin->setValue(180);
     formLayout->addRow(tr("Maximum image height:"), m_alphaThresholdSpin);
 
+    m_samplingMethodCombo = new QComboBox(this);
+    m_samplingMethodCombo->addItem(tr("None"), QVariant::fromValue(static_cast<int>(SamplingMethod::None)));
+    m_samplingMethodCombo->addItem(tr("Uniform"), QVariant::fromValue(static_cast<int>(SamplingMethod::Uniform)));
+    m_samplingMethodCombo->addItem(tr("Stratified"), QVariant::fromValue(static_cast<int>(SamplingMethod::Stratified)));
+    m_samplingMethodCombo->addItem(tr("Reservoir"), QVariant::fromValue(static_cast<int>(SamplingMethod::Reservoir)));
+    m_samplingMethodCombo->setCurrentIndex(0);
+    formLayout->addRow(tr("Sampling method:"), m_samplingMethodCombo);
+
+    m_sampleBudgetSpin = new QSpinBox(this);
+    m_sampleBudgetSpin->setRange(100, 99999999);
+    m_sampleBudgetSpin->setValue(10000);
+    m_sampleBudgetSpin->setEnabled(false);
+    formLayout->addRow(tr("Sample budget:"), m_sampleBudgetSpin);
+
+    m_analyzeAllFramesCheck = new QCheckBox(this);
+    m_analyzeAllFramesCheck->setText(tr("Analyze all frames of animations and numbered image sequences"));
+    m_analyzeAllFramesCheck->setChecked(false);
+    formLayout->addRow(tr("Frames:"), m_analyzeAllFramesCheck);
+
+    m_multiResolutionCheck = new QCheckBox(this);
+    m_multiResolutionCheck->setText(tr("Converge on a small copy of the image first, then refine up to the full size"));
+    m_multiResolutionCheck->setChecked(false);
+    formLayout->addRow(tr("Multi-resolution:"), m_multiResolutionCheck);
+
+    m_memoryBudgetSpin = new QSpinBox(this);
+    m_memoryBudgetSpin->setRange(0, 1048576);
+    m_memoryBudgetSpin->setValue(0);
+    m_memoryBudgetSpin->setSuffix(tr(" MiB"));
+    m_memoryBudgetSpin->setSpecialValueText(tr("Unlimited"));
+    formLayout->addRow(tr("Memory budget:"), m_memoryBudgetSpin);
+
+    m_regionLabel = new QLabel(this);
+    m_regionLabel->setText(tr("Whole image"));
+    auto selectRegionButton{ new QPushButton(this) };
+    selectRegionButton->setText(tr("&Select"));
+    connect(selectRegionButton, &QPushButton::clicked, this, [this](){
+        const QString filePath{ QFileInfo(QDir::fromNativeSeparators(m_filePathEdit->text())).canonicalFilePath() };
+        if (filePath.isEmpty()) {
+            QMessageBox::warning(this, tr("ERROR"), tr("Please select an image file first."));
+            return;
+        }
+        RegionSelectionDialog dialog(this);
+        if (!dialog.loadImage(filePath)) {
+            QMessageBox::warning(this, tr("ERROR"), tr("The selected image file cannot be loaded successfully!"));
+            return;
+        }
+        dialog.setRegion(filePath == m_regionFilePath ? m_regionOfInterest : QRect{});
+        if (dialog.exec() != QDialog::Accepted) {
+            return;
+        }
+        m_regionOfInterest = dialog.region();
+        m_regionFilePath = filePath;
+        m_regionLabel->setText(m_regionOfInterest.isValid() ? tr("%1, %2, %3x%4").arg(QString::number(m_regionOfInterest.x()), QString::number(m_regionOfInterest.y()),
+                                                                                        QString::number(m_regionOfInterest.width()), QString::number(m_regionOfInterest.height()))
+                                                            : tr("Whole image"));
+    });
+    // The region belongs to the image it has been selected on.
+    connect(m_filePathEdit, &QLineEdit::textChanged, this, [this](const QString& text){
+        if (QFileInfo(QDir::fromNativeSeparators(text)).canonicalFilePath() == m_regionFilePath) {
+            return;
+        }
+        m_regionOfInterest = {};
+        m_regionFilePath.clear();
+        m_regionLabel->setText(tr("Whole image"));
+    });
+    auto regionLayout{ new QHBoxLayout() };
+    regionLayout->addWidget(m_regionLabel, 1);
+    regionLayout->addWidget(selectRegionButton);
+    formLayout->addRow(tr("Region of interest:"), regionLayout);
+    connect(m_samplingMethodCombo, &QComboBox::currentIndexChanged, this, [this](){
+        m_sampleBudgetSpin->setEnabled(static_cast<SamplingMethod>(m_samplingMethodCombo->currentData().toInt()) != SamplingMethod::None);
+    });
+
     auto okButton{ new QPushButton(this) };
     okButton->setText(tr("&OK"));
     connect(okButton, &QPushButton::clicked, this, [this](){
@@ -648,12 +540,20 @@ OptionsDialog::OptionsDialog(QWidget* parent, Qt::WindowFlags f) : QDialog{ pare
         const int maxWidth{ m_maxWidthSpin->value() };
         const int maxHeight{ m_maxHeightSpin->value() };
         const int alphaThreshold{ m_alphaThresholdSpin->value() };
+        const auto samplingMethod{ static_cast<SamplingMethod>(m_samplingMethodCombo->currentData().toInt()) };
+        const qsizetype sampleBudget{ m_sampleBudgetSpin->value() };
         m_options.filePath = std::move(fileInfo.canonicalFilePath());
         m_options.k = k;
         m_options.maxIterations = maxIterations;
         m_options.maxWidth = maxWidth;
         m_options.maxHeight = maxHeight;
         m_options.alphaThreshold = alphaThreshold;
+        m_options.samplingMethod = samplingMethod;
+        m_options.sampleBudget = sampleBudget;
+        m_options.analyzeAllFrames = m_analyzeAllFramesCheck->isChecked();
+        m_options.multiResolution = m_multiResolutionCheck->isChecked();
+        m_options.memoryBudget = qint64(m_memoryBudgetSpin->value()) * 1048576;
+        m_options.regionOfInterest = m_regionOfInterest;
         accept();
     });
 
@@ -673,14 +573,6 @@ const UserOptions& OptionsDialog::userOptions() const {
     return m_options;
 }
 
-QSettings& OptionsDialog::settings() {
-    return m_settings;
-}
-
-const QSettings& OptionsDialog::settings() const {
-    return m_settings;
-}
-
 void OptionsDialog::showEvent(QShowEvent* event) {
     QDialog::showEvent(event);
     if (!m_options.filePath.isEmpty()) {
@@ -690,56 +582,172 @@ void OptionsDialog::showEvent(QShowEvent* event) {
 
 MainWindowPrivate::MainWindowPrivate(MainWindow* qq) : q_ptr{ qq } {
     Q_ASSERT(q_ptr);
-    optionsDialog = new OptionsDialog(q_ptr);
-    MainWindow::connect(&workerThread, &WorkerThread::newResultReady, q_ptr, [this](ColorItemList result){
-        Q_ASSERT(!result.isEmpty());
-        colorList = std::move(result);
-        q_ptr->update();
-    });
-    MainWindow::connect(&workerThread, &WorkerThread::errorOccurred, q_ptr, [this](QString message){
-        Q_ASSERT(!message.isEmpty());
-        QMessageBox::critical(q_ptr, MainWindow::tr("ERROR"), message);
-    });
-    workerThread.start(WorkerThread::NormalPriority);
+    // The workers are started when the first task arrives, see "parseImage()".
 }
 
 MainWindowPrivate::~MainWindowPrivate() {
-    if (workerThread.isRunning()) {
-        workerThread.requestInterruption();
-        workerThread.quit();
-        workerThread.wait();
-    }
+    currentTaskToken.cancel();
+    // "taskScheduler" waits for its workers when it's destroyed.
 }
 
 void MainWindowPrivate::parseImage() {
     Q_Q(MainWindow);
-    UserOptions& options{ optionsDialog->userOptions() };
+    UserOptions& options{ ensureOptionsDialog()->userOptions() };
     if (!alternativeImageFilePath.isEmpty()) {
-        options.filePath = std::move(std::exchange(alternativeImageFilePath, QString{}));
+        setImageFilePath(options, std::exchange(alternativeImageFilePath, QString{}));
     }
     if (options.filePath.isEmpty()) {
         QMessageBox::critical(q, MainWindow::tr("ERROR"), MainWindow::tr("The image file path MUST not be empty!"));
         return;
     }
     qDebug() << "Trying to process:" << std::move(QDir::toNativeSeparators(options.filePath));
-    workerThread.addTask(std::move(options));
+    // Only the most recent request matters, whatever is still queued or running for an older one is wasted work.
+    currentTaskToken.cancel();
+    currentTaskToken = CancellationToken::create();
+    // A timeline may take a long time, it must not hold up the single image analyses started after it.
+    const TaskPriority priority{ options.analyzeAllFrames ? TaskPriority::Batch : TaskPriority::Interactive };
+    const bool accepted{ taskScheduler.submit(priority, currentTaskToken, [this, options](const CancellationToken& cancellationToken, AnalysisWorkspace& workspace){
+        runAnalysis(options, cancellationToken, workspace);
+    }) };
+    if (!accepted) {
+        QMessageBox::critical(q, MainWindow::tr("ERROR"), MainWindow::tr("Too many analyses are pending, please try again later."));
+    }
+}
+
+// Runs on a worker thread, the results are sent back to the GUI thread and dropped there if they are stale by then.
+void MainWindowPrivate::runAnalysis(const UserOptions& options, const CancellationToken& cancellationToken, AnalysisWorkspace& workspace) {
+    const auto& deliver{ [this, cancellationToken](auto function){
+        QMetaObject::invokeMethod(q_ptr, [cancellationToken, function = std::move(function)]() mutable {
+            if (!cancellationToken.isCancelled()) {
+                function();
+            }
+        }, Qt::QueuedConnection);
+    } };
+    if (options.analyzeAllFrames) {
+        QList<ColorItemList> timeline{};
+        if (analyzeImageSequence(timeline, options, &workspace, cancellationToken)) {
+            deliver([this, timeline = std::move(timeline)]() mutable { showTimeline(std::move(timeline)); });
+        } else {
+            deliver([this](){ showError(MainWindow::tr("Failed to analyze any frame of the selected image!")); });
+        }
+        return;
+    }
+    UserOptions analysisOptions{ options };
+    MemoryPlan memoryPlan{};
+    QString errorMessage{};
+    QImage image{ readImage(analysisOptions, memoryPlan, true, &errorMessage) };
+    if (image.isNull()) {
+        deliver([this, errorMessage](){ showError(MainWindow::tr("The selected image file cannot be loaded successfully!") + u'\n' + errorMessage); });
+        return;
+    }
+    if (cancellationToken.isCancelled()) {
+        return;
+    }
+    ColorItemList result{};
+    result.reserve(analysisOptions.k);
+    const bool ok{ memoryPlan.strategy == MemoryStrategy::Tiling
+                       ? clusterImageInTiles(result, prepareImage(std::move(image), analysisOptions), analysisOptions, memoryPlan.tileHeight, &workspace)
+                       : extractColorsFromImage(result, std::move(image), analysisOptions, &workspace) };
+    if (ok) {
+        deliver([this, result = std::move(result)]() mutable { showResult(std::move(result)); });
+    } else {
+        deliver([this](){ showError(MainWindow::tr("Failed to analyze image color!")); });
+    }
+}
+
+void MainWindowPrivate::showResult(ColorItemList result) {
+    Q_ASSERT(!result.isEmpty());
+    timeline.clear();
+    currentFrameIndex = -1;
+    colorList = std::move(result);
+    q_ptr->update();
+}
+
+void MainWindowPrivate::showTimeline(QList<ColorItemList> result) {
+    Q_ASSERT(!result.isEmpty());
+    timeline = std::move(result);
+    currentFrameIndex = -1;
+    // Start with the first frame that has been analyzed successfully.
+    for (qsizetype index{ 0 }; index < timeline.size(); ++index) {
+        if (!timeline[index].isEmpty()) {
+            showFrame(index);
+            break;
+        }
+    }
+    q_ptr->update();
+}
+
+void MainWindowPrivate::showError(const QString& message) {
+    Q_ASSERT(!message.isEmpty());
+    QMessageBox::critical(q_ptr, MainWindow::tr("ERROR"), message);
+}
+
+OptionsDialog* MainWindowPrivate::ensureOptionsDialog() {
+    if (optionsDialog) {
+        return optionsDialog;
+    }
+    Q_Q(MainWindow);
+    // The dialog will paint text as soon as it's shown.
+    ensureEmbeddedFontsRegistered();
+    optionsDialog = new OptionsDialog(q);
+    MainWindow::connect(optionsDialog, &OptionsDialog::finished, q, [this](const int result){
+        if (result == OptionsDialog::Rejected) {
+            return;
+        }
+        parseImage();
+    });
+    return optionsDialog;
 }
 
 QRectF MainWindowPrivate::pieRect() const {
     Q_Q(const MainWindow);
-    const auto width{ qreal(q->width()) };
-    const auto height{ qreal(q->height()) };
-    const qreal diameter{ qMin(width, height) - s_margin * qreal(2) };
-    return QRectF{ (width - diameter) / qreal(2), (height - diameter) / qreal(2), diameter, diameter };
+    return pieChartPieRect(QRectF{ q->rect() });
 }
 
-QPixmap MainWindowPrivate::grabResultImage() {
-    Q_Q(MainWindow);
-    isGrabbing = true;
-    q->update();
-    QPixmap pixmap{ q->grab(pieRect().toRect().marginsAdded(QMarginsF(s_margin, s_margin, s_margin, s_margin).toMargins())) };
-    isGrabbing = false;
-    return std::move(pixmap);
+QRectF MainWindowPrivate::timelineRect() const {
+    Q_Q(const MainWindow);
+    return pieChartTimelineRect(QRectF{ q->rect() });
+}
+
+qsizetype MainWindowPrivate::frameIndexAt(const QPointF& pos) const {
+    if (timeline.isEmpty()) {
+        return -1;
+    }
+    const QRectF rect{ timelineRect() };
+    if (!rect.contains(pos)) {
+        return -1;
+    }
+    const auto index{ qsizetype((pos.x() - rect.left()) / rect.width() * qreal(timeline.size())) };
+    return qBound(qsizetype(0), index, timeline.size() - 1);
+}
+
+void MainWindowPrivate::showFrame(const qsizetype frameIndex) {
+    Q_ASSERT(frameIndex >= 0 && frameIndex < timeline.size());
+    if (frameIndex == currentFrameIndex || timeline[frameIndex].isEmpty()) {
+        return;
+    }
+    currentFrameIndex = frameIndex;
+    colorList = timeline[frameIndex];
+    highlightedSliceIndex = -1;
+}
+
+PieChart MainWindowPrivate::pieChart(const bool interactive) const {
+    Q_Q(const MainWindow);
+    PieChart chart{};
+    chart.colorList = colorList;
+    chart.timeline = timeline;
+    chart.currentFrameIndex = currentFrameIndex;
+    // The mouse hover feedback doesn't belong to an exported chart.
+    chart.highlightedSliceIndex = interactive ? highlightedSliceIndex : -1;
+    chart.font = q->font();
+    return chart;
+}
+
+QSize MainWindowPrivate::exportSize() const {
+    Q_Q(const MainWindow);
+    // The pie with its margins, as large as it is on screen.
+    const int side{ qMin(q->width(), q->height()) };
+    return QSize{ side, side };
 }
 
 MainWindow::MainWindow(QWidget* parent) : QWidget{ parent }, d_ptr{ std::make_unique<MainWindowPrivate>(this) } {
@@ -762,19 +770,9 @@ MainWindow::MainWindow(QWidget* parent) : QWidget{ parent }, d_ptr{ std::make_un
         setFont(f);
     }
 
-    {
-        Q_D(MainWindow);
-        connect(d->optionsDialog, &OptionsDialog::finished, this, [this, d](const int result){
-            if (result == OptionsDialog::Rejected) {
-                return;
-            }
-            d->parseImage();
-        });
-    }
-
     new QShortcut(QKeySequence::Open, this, this, [this](){
         Q_D(MainWindow);
-        d->optionsDialog->open();
+        d->ensureOptionsDialog()->open();
     });
     new QShortcut(QKeySequence::Refresh, this, this, [this](){
         Q_D(MainWindow);
@@ -782,7 +780,9 @@ MainWindow::MainWindow(QWidget* parent) : QWidget{ parent }, d_ptr{ std::make_un
     });
     new QShortcut(QKeySequence::Save, this, this, [this](){
         Q_D(MainWindow);
-        QSettings& settings{ d->optionsDialog->settings() };
+        // Only now, like the rest of what's only needed to save: it must not slow the start-up down, nor construct
+        // the (lazily created) options dialog, which has settings of its own.
+        QSettings settings{};
         static const QString saveDirKey{ std::move(u"save_dir"_s) };
         QString lastDirPath{ std::move(settings.value(saveDirKey, u"."_s).toString()) };
         {
@@ -799,7 +799,7 @@ MainWindow::MainWindow(QWidget* parent) : QWidget{ parent }, d_ptr{ std::make_un
                 }
             }
         }
-        const QString filePath{ std::move(QFileDialog::getSaveFileName(this, tr("Please select a save location"), lastDirPath, tr("PNG Files (*.png);;JPEG Files (*.jpg);;All Files (*)"))) };
+        const QString filePath{ std::move(QFileDialog::getSaveFileName(this, tr("Please select a save location"), lastDirPath, tr("PNG Files (*.png);;JPEG Files (*.jpg);;SVG Files (*.svg);;All Files (*)"))) };
         if (filePath.isEmpty()) {
             return;
         }
@@ -808,27 +808,48 @@ MainWindow::MainWindow(QWidget* parent) : QWidget{ parent }, d_ptr{ std::make_un
         // an empty string if the file doesn't exist, so we can't use it here apparently.
         lastDirPath = std::move(QDir::cleanPath(QFileInfo(filePath).absolutePath()));
         settings.setValue(saveDirKey, std::move(lastDirPath));
-        const QPixmap pixmap{ std::move(d->grabResultImage()) };
-        Q_ASSERT(!pixmap.isNull());
-        if (Q_UNLIKELY(pixmap.isNull())) {
-            QMessageBox::warning(this, tr("ERROR"), tr("Failed to grab the image of current result."));
+        if (d->colorList.isEmpty()) {
+            QMessageBox::warning(this, tr("ERROR"), tr("There is no result to save yet."));
             return;
         }
-        if (pixmap.save(filePath)) {
-            QMessageBox::information(this, tr("INFORMATION"), tr("Result saved to: %1").arg(QDir::toNativeSeparators(filePath)));
-        } else {
-            QMessageBox::warning(this, tr("ERROR"), tr("Failed to write the grabbed image to disk."));
+        ensureEmbeddedFontsRegistered();
+        // Rendering (especially at high DPI) and encoding don't need the window, keep them off the GUI thread.
+        const bool isSvg{ QFileInfo(filePath).suffix().compare(u"svg"_s, Qt::CaseInsensitive) == 0 };
+        const bool accepted{ d->taskScheduler.submit(TaskPriority::Interactive, {}, [this, filePath, isSvg, chart = d->pieChart(false), size = d->exportSize(), scale = devicePixelRatioF()](const CancellationToken&, AnalysisWorkspace&){
+            bool saved{ false };
+            if (isSvg) {
+                QFile file(filePath);
+                saved = file.open(QFile::WriteOnly | QFile::Truncate) && file.write(renderPieChartSvg(chart, size)) > 0;
+            } else {
+                saved = renderPieChartImage(chart, size, scale).save(filePath);
+            }
+            QMetaObject::invokeMethod(this, [this, filePath, saved](){
+                if (saved) {
+                    QMessageBox::information(this, tr("INFORMATION"), tr("Result saved to: %1").arg(QDir::toNativeSeparators(filePath)));
+                } else {
+                    QMessageBox::warning(this, tr("ERROR"), tr("Failed to write the result image to disk."));
+                }
+            }, Qt::QueuedConnection);
+        }) };
+        if (!accepted) {
+            QMessageBox::warning(this, tr("ERROR"), tr("Too many analyses are pending, please try again later."));
         }
     });
     new QShortcut(QKeySequence::Copy, this, this, [this](){
         Q_D(MainWindow);
-        const QPixmap pixmap{ std::move(d->grabResultImage()) };
-        Q_ASSERT(!pixmap.isNull());
-        if (Q_UNLIKELY(pixmap.isNull())) {
-            QMessageBox::warning(this, tr("ERROR"), tr("Failed to grab the image of current result."));
+        if (d->colorList.isEmpty()) {
+            QMessageBox::warning(this, tr("ERROR"), tr("There is no result to copy yet."));
+            return;
+        }
+        ensureEmbeddedFontsRegistered();
+        // The clipboard lives on the GUI thread, but rendering the chart alone is cheap, there is no repaint of the window involved.
+        const QImage image{ renderPieChartImage(d->pieChart(false), d->exportSize(), devicePixelRatioF()) };
+        Q_ASSERT(!image.isNull());
+        if (Q_UNLIKELY(image.isNull())) {
+            QMessageBox::warning(this, tr("ERROR"), tr("Failed to render the image of current result."));
             return;
         }
-        QGuiApplication::clipboard()->setPixmap(pixmap);
+        QGuiApplication::clipboard()->setImage(image);
         QMessageBox::information(this, tr("INFORMATION"), tr("The current result image has been copied to the clipboard."));
     });
     new QShortcut(QKeySequence::Cancel, this, this, [](){ QCoreApplication::quit(); });
@@ -855,6 +876,11 @@ void MainWindow::leaveEvent(QEvent *event) {
 void MainWindow::mouseMoveEvent(QMouseEvent *event) {
     QWidget::mouseMoveEvent(event);
     Q_D(MainWindow);
+    if (const qsizetype frameIndex{ d->frameIndexAt(event->position()) }; frameIndex >= 0 && frameIndex != d->currentFrameIndex) {
+        d->showFrame(frameIndex);
+        update();
+        return;
+    }
     qsizetype nowHighlightedSliceIndex{ -1 };
     do {
         if (d->colorList.isEmpty()) {
@@ -900,83 +926,24 @@ void MainWindow::mouseReleaseEvent(QMouseEvent *event) {
     QWidget::mouseReleaseEvent(event);
     if (event->button() == Qt::LeftButton) {
         Q_D(MainWindow);
-        d->optionsDialog->open();
+        d->ensureOptionsDialog()->open();
     }
 }
 
 void MainWindow::paintEvent(QPaintEvent*) {
     Q_D(MainWindow);
-    QPainter painter(this);
-    painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing | QPainter::SmoothPixmapTransform);
-    painter.fillRect(rect(), MainWindowPrivate::s_backgroundColor);
-    if (d->colorList.isEmpty()) {
-        return;
-    }
-    const bool hasHighlightedSlice{ !d->isGrabbing && d->highlightedSliceIndex >= 0 };
-    const QRectF pieRect{ d->pieRect() };
-    const QPointF pieCenter{ pieRect.center() };
-    const qreal textRadius{ pieRect.width() / qreal(2) * 0.7 };
-    qreal currentAngle{ 90 }; // 0 degree is +x direction, positive degree is counter-wise.
-    for (qsizetype index{ 0 }; index < d->colorList.size(); ++index) {
-        const auto& slice{ d->colorList[index] };
-        Q_ASSERT(slice.ratio > qreal(0));
-        Q_ASSERT(slice.ratio < qreal(1));
-        Q_ASSERT(slice.color.isValid());
-        Q_ASSERT(slice.color.alpha() == 255);
-        const bool lightColor{ isColorLight(slice.color) };
-        const bool highlightCurrentSlice{ hasHighlightedSlice && d->highlightedSliceIndex == index };
-        QPen pen{};
-        if (index == d->colorList.size() - 1) {
-            const QColor reversedColor{ std::move(QColor::fromRgb(255 - slice.color.red(), 255 - slice.color.green(), 255 - slice.color.blue())) };
-            pen.setColor(highlightCurrentSlice ? (isColorLight(reversedColor) ? reversedColor.darker(130) : reversedColor.lighter(130)) : reversedColor);
-            pen.setWidthF(qreal(10));
-        } else {
-            pen.setColor(MainWindowPrivate::s_backgroundColor);
-            pen.setWidthF(qreal(1));
+    // Only notify the outside world after the whole frame has been painted.
+    const auto firstFrameGuard{ qScopeGuard([this, firstFrame = !std::exchange(d->hasPaintedFirstFrame, true)](){
+        if (firstFrame) {
+            Q_EMIT firstFramePainted();
         }
-        painter.setPen(pen);
-        painter.setBrush(highlightCurrentSlice ? (lightColor ? slice.color.darker(130) : slice.color.lighter(130)) : slice.color);
-        const qreal spanAngle{ slice.ratio * qreal(360) };
-        painter.drawPie(pieRect, currentAngle * qreal(16), spanAngle * qreal(16));
-        const qreal middleAngleDeg{ currentAngle + spanAngle / qreal(2) };
-        const qreal middleAngleRad{ qDegreesToRadians(middleAngleDeg) };
-        const QPointF textCenterPos{ pieCenter.x() + textRadius * qCos(middleAngleRad), pieCenter.y() - textRadius * qSin(middleAngleRad) };
-        const QFontMetricsF fm(painter.fontMetrics());
-        QRectF textRect{};
-        textRect.setWidth(fm.horizontalAdvance(u"#RRGGBB"_s));
-        textRect.setHeight(fm.height() * qreal(2)); // 2 lines: 1 line for the color hex text and another line for the ratio text.
-        textRect.moveCenter(textCenterPos);
-        painter.setPen(lightColor ? QColorConstants::Black : QColorConstants::White);
-        const QString sliceText{ u"%1\n%2%"_s.arg(slice.color.name().toUpper(), QString::number(slice.ratio * qreal(100))) };
-        painter.drawText(textRect, Qt::AlignCenter | Qt::TextDontClip, sliceText);
-        currentAngle += spanAngle;
-    }
-}
-
-void MainWindow::dragEnterEvent(QDragEnterEvent *event) {
-    QWidget::dragEnterEvent(event);
-    if (extractImageDataFromMimeData(event->mimeData())) {
-        event->acceptProposedAction();
-    } else {
-        event->ignore();
-    }
-}
-
-void MainWindow::dropEvent(QDropEvent *event) {
-    QWidget::dropEvent(event);
-    Q_D(MainWindow);
-    QVariant data{};
-    const bool hasData{ extractImageDataFromMimeData(event->mimeData(), &data) };
-    Q_ASSERT(hasData);
-    Q_ASSERT(data.isValid());
-    if (data.typeId() == QMetaType::QImage) {
-        const QImage image{ std::move(qvariant_cast<QImage>(data)) };
-        Q_UNUSED(image);
-    } else {
-        Q_ASSERT(data.typeId() == QMetaType::QString);
-        d->alternativeImageFilePath = std::move(data.toString());
-        d->parseImage();
+    }) };
+    if (!d->colorList.isEmpty()) {
+        // Must be done before the painter picks up the widget font.
+        ensureEmbeddedFontsRegistered();
     }
+    QPainter painter(this);
+    paintPieChart(painter, QRectF{ rect() }, d->pieChart(true));
 }
 
 #include "mainwindow.moc"
@@ -0,0 +1,30 @@
+#include "memoryprobe.h"
+
+#ifdef Q_OS_WINDOWS
+#  include <qt_windows.h>
+#  include <psapi.h>
+#elif defined(Q_OS_UNIX)
+#  include <sys/resource.h>
+#endif
+
+qint64 peakResidentSetSize() {
+#ifdef Q_OS_WINDOWS
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return -1;
+    }
+    return qint64(counters.PeakWorkingSetSize);
+#elif defined(Q_OS_UNIX)
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+#  ifdef Q_OS_DARWIN
+    return qint64(usage.ru_maxrss); // Already in bytes.
+#  else
+    return qint64(usage.ru_maxrss) * 1024; // In kilobytes.
+#  endif
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <QtGlobal>
+
+// The highest amount of physical memory the whole process has used so far, in bytes, or -1 if the
+// platform can't tell. Unlike "AnalysisWorkspace::memoryUsage()", this includes everything: the
+// decoded images, the Qt libraries, the other threads and so on.
+[[nodiscard]] extern qint64 peakResidentSetSize();
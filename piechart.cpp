@@ -0,0 +1,190 @@
+#include "piechart.h"
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QFontDatabase>
+#include <QFontMetricsF>
+#include <QPainter>
+#include <QScopeGuard>
+#include <QSvgGenerator>
+#include <QtMath>
+#include <QDebug>
+
+using namespace Qt::StringLiterals;
+
+[[nodiscard]] static inline bool isColorLight(const QColor& color) {
+    Q_ASSERT(color.isValid());
+    const auto& toLinear = [](const qreal value) {
+        Q_ASSERT(qFuzzyIsNull(value) || value > qreal(0));
+        Q_ASSERT(qFuzzyCompare(value, qreal(1)) || value < qreal(1));
+        static constexpr const qreal magic{ 0.03928 };
+        return (qFuzzyCompare(value, magic) || value < magic) ? (value / 12.92) : qPow((value + 0.055) / 1.055, 2.4);
+    };
+    const auto linearR{ toLinear(color.redF()) };
+    const auto linearG{ toLinear(color.greenF()) };
+    const auto linearB{ toLinear(color.blueF()) };
+    const auto luminance{ 0.2126 * linearR + 0.7152 * linearG + 0.0722 * linearB };
+    return luminance > 0.5;
+}
+
+QFont defaultPieChartFont() {
+    QFont font{ u"JetBrains Mono"_s };
+    font.setStyleStrategy(static_cast<QFont::StyleStrategy>(QFont::PreferQuality | QFont::PreferAntialias));
+    font.setBold(true);
+    font.setPixelSize(25);
+    return font;
+}
+
+void ensureEmbeddedFontsRegistered() {
+    // Registering the fonts is not free (and the font database needs to be populated first),
+    // so we delay it until we really need to paint some text, which is usually long after the
+    // main window has been shown.
+    static bool registered{ false };
+    if (registered) {
+        return;
+    }
+    registered = true;
+    QElapsedTimer timer{};
+    timer.start();
+    int result{ QFontDatabase::addApplicationFont(u":/fonts/JetBrainsMono-Regular.ttf"_s) };
+    Q_ASSERT(result >= 0);
+    result = QFontDatabase::addApplicationFont(u":/fonts/JetBrainsMono-Bold.ttf"_s);
+    Q_ASSERT(result >= 0);
+    result = QFontDatabase::addApplicationFont(u":/fonts/JetBrainsMono-Italic.ttf"_s);
+    Q_ASSERT(result >= 0);
+    result = QFontDatabase::addApplicationFont(u":/fonts/JetBrainsMono-BoldItalic.ttf"_s);
+    Q_ASSERT(result >= 0);
+    Q_UNUSED(result);
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Embedded fonts registered in" << timer.elapsed() << "milliseconds.";
+    }
+}
+
+QRectF pieChartPieRect(const QRectF& canvas) {
+    const qreal diameter{ qMin(canvas.width(), canvas.height()) - PIE_CHART_MARGIN * qreal(2) };
+    QRectF rect{ 0, 0, diameter, diameter };
+    rect.moveCenter(canvas.center());
+    return rect;
+}
+
+QRectF pieChartTimelineRect(const QRectF& canvas) {
+    // Lives in the bottom margin, right below the pie.
+    static constexpr const qreal height{ 16 };
+    const QRectF rect{ pieChartPieRect(canvas) };
+    return QRectF{ rect.left(), canvas.bottom() - (PIE_CHART_MARGIN + height) / qreal(2), rect.width(), height };
+}
+
+void paintPieChart(QPainter& painter, const QRectF& canvas, const PieChart& chart) {
+    painter.save();
+    const auto restorePainter{ qScopeGuard([&painter](){ painter.restore(); }) };
+    painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing | QPainter::SmoothPixmapTransform);
+    painter.setFont(chart.font);
+    painter.fillRect(canvas, PIE_CHART_BACKGROUND_COLOR);
+    if (chart.colorList.isEmpty()) {
+        return;
+    }
+    const bool hasHighlightedSlice{ chart.highlightedSliceIndex >= 0 };
+    const QRectF pieRect{ pieChartPieRect(canvas) };
+    const QPointF pieCenter{ pieRect.center() };
+    const qreal textRadius{ pieRect.width() / qreal(2) * 0.7 };
+    qreal currentAngle{ 90 }; // 0 degree is +x direction, positive degree is counter-wise.
+    for (qsizetype index{ 0 }; index < chart.colorList.size(); ++index) {
+        const auto& slice{ chart.colorList[index] };
+        Q_ASSERT(slice.ratio > qreal(0));
+        Q_ASSERT(slice.ratio < qreal(1));
+        Q_ASSERT(slice.color.isValid());
+        Q_ASSERT(slice.color.alpha() == 255);
+        const bool lightColor{ isColorLight(slice.color) };
+        const bool highlightCurrentSlice{ hasHighlightedSlice && chart.highlightedSliceIndex == index };
+        QPen pen{};
+        if (index == chart.colorList.size() - 1) {
+            const QColor reversedColor{ std::move(QColor::fromRgb(255 - slice.color.red(), 255 - slice.color.green(), 255 - slice.color.blue())) };
+            pen.setColor(highlightCurrentSlice ? (isColorLight(reversedColor) ? reversedColor.darker(130) : reversedColor.lighter(130)) : reversedColor);
+            pen.setWidthF(qreal(10));
+        } else {
+            pen.setColor(PIE_CHART_BACKGROUND_COLOR);
+            pen.setWidthF(qreal(1));
+        }
+        painter.setPen(pen);
+        painter.setBrush(highlightCurrentSlice ? (lightColor ? slice.color.darker(130) : slice.color.lighter(130)) : slice.color);
+        const qreal spanAngle{ slice.ratio * qreal(360) };
+        painter.drawPie(pieRect, currentAngle * qreal(16), spanAngle * qreal(16));
+        const qreal middleAngleDeg{ currentAngle + spanAngle / qreal(2) };
+        const qreal middleAngleRad{ qDegreesToRadians(middleAngleDeg) };
+        const QPointF textCenterPos{ pieCenter.x() + textRadius * qCos(middleAngleRad), pieCenter.y() - textRadius * qSin(middleAngleRad) };
+        const QFontMetricsF fm(painter.font(), painter.device());
+        QRectF textRect{};
+        textRect.setWidth(fm.horizontalAdvance(u"#RRGGBB"_s));
+        textRect.setHeight(fm.height() * qreal(2)); // 2 lines: 1 line for the color hex text and another line for the ratio text.
+        textRect.moveCenter(textCenterPos);
+        painter.setPen(lightColor ? QColorConstants::Black : QColorConstants::White);
+        QString sliceText{ u"%1\n%2%"_s.arg(slice.color.name().toUpper(), QString::number(slice.ratio * qreal(100))) };
+        // The interval is not symmetric, we show the larger side to be conservative.
+        const qreal ratioError{ qMax(slice.ratio - slice.ratioLowerBound, slice.ratioUpperBound - slice.ratio) };
+        if (!qFuzzyIsNull(ratioError)) {
+            sliceText += u" \u00B1%1%"_s.arg(QString::number(ratioError * qreal(100), 'f', 2));
+        }
+        painter.drawText(textRect, Qt::AlignCenter | Qt::TextDontClip, sliceText);
+        currentAngle += spanAngle;
+    }
+    if (chart.timeline.isEmpty()) {
+        return;
+    }
+    // The timeline: the most dominant color of each frame, the current frame is outlined.
+    const QRectF timelineRect{ pieChartTimelineRect(canvas) };
+    const qreal frameWidth{ timelineRect.width() / qreal(chart.timeline.size()) };
+    painter.setPen(Qt::NoPen);
+    for (qsizetype index{ 0 }; index < chart.timeline.size(); ++index) {
+        const auto& frameColorList{ chart.timeline[index] };
+        if (frameColorList.isEmpty()) {
+            continue;
+        }
+        // The result list is sorted in ascending order, the last one is the most dominant color.
+        painter.setBrush(frameColorList.constLast().color);
+        painter.drawRect(QRectF{ timelineRect.left() + frameWidth * qreal(index), timelineRect.top(), frameWidth, timelineRect.height() });
+    }
+    if (chart.currentFrameIndex >= 0) {
+        QPen pen{ QColorConstants::Gray };
+        pen.setWidthF(qreal(2));
+        painter.setPen(pen);
+        painter.setBrush(Qt::NoBrush);
+        painter.drawRect(QRectF{ timelineRect.left() + frameWidth * qreal(chart.currentFrameIndex), timelineRect.top(), frameWidth, timelineRect.height() });
+    }
+}
+
+QImage renderPieChartImage(const PieChart& chart, const QSize& size, const qreal scale) {
+    Q_ASSERT(!size.isEmpty());
+    Q_ASSERT(scale > qreal(0));
+    if (Q_UNLIKELY(size.isEmpty() || scale <= qreal(0))) {
+        return {};
+    }
+    QImage image{ (QSizeF(size) * scale).toSize(), QImage::Format_ARGB32_Premultiplied };
+    // The painter works in logical coordinates, the text is still rasterized at the full resolution.
+    image.setDevicePixelRatio(scale);
+    image.fill(PIE_CHART_BACKGROUND_COLOR);
+    QPainter painter(&image);
+    paintPieChart(painter, QRectF{ QPointF{ 0, 0 }, QSizeF(size) }, chart);
+    painter.end();
+    return image;
+}
+
+QByteArray renderPieChartSvg(const PieChart& chart, const QSize& size, const qreal scale) {
+    Q_ASSERT(!size.isEmpty());
+    Q_ASSERT(scale > qreal(0));
+    if (Q_UNLIKELY(size.isEmpty() || scale <= qreal(0))) {
+        return {};
+    }
+    QByteArray data{};
+    QBuffer buffer(&data);
+    buffer.open(QBuffer::WriteOnly);
+    QSvgGenerator generator{};
+    generator.setOutputDevice(&buffer);
+    generator.setSize((QSizeF(size) * scale).toSize());
+    generator.setViewBox(QRect{ QPoint{ 0, 0 }, size });
+    generator.setTitle(u"Image Color Analyzer"_s);
+    {
+        QPainter painter(&generator);
+        paintPieChart(painter, QRectF{ QPointF{ 0, 0 }, QSizeF(size) }, chart);
+    }
+    buffer.close();
+    return data;
+}
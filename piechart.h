@@ -0,0 +1,46 @@
+#pragma once
+
+#include "coloranalyzer.h"
+#include <QByteArray>
+#include <QFont>
+#include <QRectF>
+
+QT_BEGIN_NAMESPACE
+class QPainter;
+QT_END_NAMESPACE
+
+// The font of the main window: the embedded "JetBrains Mono", bold, 25 pixels.
+[[nodiscard]] extern QFont defaultPieChartFont();
+
+// Everything needed to draw an analysis result. Drawing only depends on this and the canvas, not on any
+// widget, so a chart can be rendered on any thread and without a display (QGuiApplication is still needed
+// for the fonts, the "offscreen" platform is enough).
+struct PieChart final {
+    ColorItemList colorList{};
+    QList<ColorItemList> timeline{}; // Drawn below the pie if not empty.
+    qsizetype currentFrameIndex{ -1 }; // Outlined in the timeline.
+    qsizetype highlightedSliceIndex{ -1 };
+    QFont font{ defaultPieChartFont() };
+};
+
+inline constexpr const qreal PIE_CHART_MARGIN{ 50 };
+inline constexpr const auto PIE_CHART_BACKGROUND_COLOR{ QColorConstants::Transparent };
+
+// Registers the fonts shipped with the application, the default chart font is one of them. Only does
+// something on the first call, and MUST be called on the GUI thread before any chart text is painted.
+extern void ensureEmbeddedFontsRegistered();
+
+// The layout of a chart inside "canvas": the pie is as large as possible while keeping a margin around
+// it, and the timeline lives in the bottom margin.
+[[nodiscard]] extern QRectF pieChartPieRect(const QRectF& canvas);
+[[nodiscard]] extern QRectF pieChartTimelineRect(const QRectF& canvas);
+
+// Paints the whole chart (including the background) into "canvas", in the painter's logical coordinates.
+extern void paintPieChart(QPainter& painter, const QRectF& canvas, const PieChart& chart);
+
+// Renders the chart into an image of "size * scale" pixels. The layout is computed for "size", so a
+// larger scale gives a sharper image with exactly the same proportions.
+[[nodiscard]] extern QImage renderPieChartImage(const PieChart& chart, const QSize& size, const qreal scale = 1);
+
+// Same as above, as an SVG document. "scale" only changes its nominal size.
+[[nodiscard]] extern QByteArray renderPieChartSvg(const PieChart& chart, const QSize& size, const qreal scale = 1);
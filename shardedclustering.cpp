@@ -0,0 +1,574 @@
+#include "shardedclustering.h"
+#include "tracing.h"
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImageReader>
+#include <QProcess>
+#include <QDebug>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+
+using namespace Qt::StringLiterals;
+
+static constexpr const quint32 SHARD_STATISTICS_MAGIC{ 0x49434153 }; // "ICAS"
+static constexpr const quint32 CENTROID_LIST_MAGIC{ 0x49434143 }; // "ICAC"
+static constexpr const quint16 SHARD_FORMAT_VERSION{ 1 };
+static constexpr const auto SHARD_DATA_STREAM_VERSION{ QDataStream::Qt_6_0 };
+
+// The longer side of the preview used to pick the initial centroids, see "generateInitialCentroids()".
+static constexpr const int SHARD_PREVIEW_SIZE{ 256 };
+
+// Whether "extractPixels()" would find anything in "image", so that fully transparent bands can be skipped.
+[[nodiscard]] static inline bool hasAcceptedPixel(const QImage& image, const int alphaThreshold) {
+    if (!image.hasAlphaChannel() || alphaThreshold <= 0 || alphaThreshold >= 255) {
+        return true;
+    }
+    for (int y{ 0 }; y < image.height(); ++y) {
+        for (int x{ 0 }; x < image.width(); ++x) {
+            if (qAlpha(image.pixel(x, y)) >= alphaThreshold) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Clusters a (small) preview image and turns the result into centroids, see "generateInitialCentroids()".
+[[nodiscard]] static inline bool clusterPreview(QList<Pixel>& centroidListOut, QImage preview, const UserOptions& options, AnalysisWorkspace* workspace = nullptr) {
+    UserOptions previewOptions{ options };
+    previewOptions.maxWidth = 0;
+    previewOptions.maxHeight = 0;
+    previewOptions.samplingMethod = SamplingMethod::None;
+    previewOptions.multiResolution = false;
+    ColorItemList result{};
+    if (!extractColorsFromImage(result, std::move(preview), previewOptions, workspace)) {
+        return false;
+    }
+    centroidListOut.resize(result.size());
+    for (qsizetype index{ 0 }; index < result.size(); ++index) {
+        const QColor& color{ result[index].color };
+        centroidListOut[index] = Pixel{ static_cast<quint8>(color.red()), static_cast<quint8>(color.green()), static_cast<quint8>(color.blue()) };
+    }
+    return true;
+}
+
+[[nodiscard]] static inline bool isCentroidMoved(const Pixel lhs, const Pixel rhs) {
+    // Same criterion as "clusterPixels()": the centroid moved by more than 1 in RGB space.
+    const int dr{ lhs.r - rhs.r };
+    const int dg{ lhs.g - rhs.g };
+    const int db{ lhs.b - rhs.b };
+    return dr * dr + dg * dg + db * db > 1;
+}
+
+// Messages are framed by their size, so that the receiver knows how much to wait for on a stream.
+[[nodiscard]] static inline bool writeMessage(QIODevice& device, const QByteArray& message) {
+    QByteArray frame{};
+    {
+        QDataStream stream(&frame, QIODevice::WriteOnly);
+        stream.setVersion(SHARD_DATA_STREAM_VERSION);
+        stream << quint32(message.size());
+    }
+    frame.append(message);
+    return device.write(frame) == frame.size();
+}
+
+[[nodiscard]] static inline bool readExactly(QIODevice& device, char* data, qint64 size) {
+    while (size > 0) {
+        const qint64 readSize{ device.read(data, size) };
+        if (readSize < 0) {
+            return false;
+        }
+        if (readSize == 0) {
+            // Nothing buffered yet (a process), or the end of the stream (a plain file).
+            if (!device.waitForReadyRead(-1)) {
+                return false;
+            }
+            continue;
+        }
+        data += readSize;
+        size -= readSize;
+    }
+    return true;
+}
+
+[[nodiscard]] static inline bool readMessage(QIODevice& device, QByteArray& messageOut) {
+    QByteArray header(sizeof(quint32), Qt::Uninitialized);
+    if (!readExactly(device, header.data(), header.size())) {
+        return false;
+    }
+    quint32 size{ 0 };
+    {
+        QDataStream stream(header);
+        stream.setVersion(SHARD_DATA_STREAM_VERSION);
+        stream >> size;
+    }
+    messageOut.resize(size);
+    return readExactly(device, messageOut.data(), messageOut.size());
+}
+
+void ShardStatistics::merge(const ShardStatistics& other) {
+    if (clusterList.isEmpty()) {
+        clusterList.resize(other.clusterList.size());
+    }
+    Q_ASSERT(clusterList.size() == other.clusterList.size());
+    for (qsizetype index{ 0 }; index < clusterList.size(); ++index) {
+        clusterList[index].merge(other.clusterList[index]);
+    }
+    pixelCount += other.pixelCount;
+}
+
+QByteArray ShardStatistics::serialize() const {
+    QByteArray data{};
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(SHARD_DATA_STREAM_VERSION);
+    stream << SHARD_STATISTICS_MAGIC << SHARD_FORMAT_VERSION << qint64(pixelCount) << qint64(clusterList.size());
+    for (auto&& cluster : std::as_const(clusterList)) {
+        stream << cluster.r << cluster.g << cluster.b << qint64(cluster.count) << cluster.inertia
+               << cluster.farthestPixel.r << cluster.farthestPixel.g << cluster.farthestPixel.b << qint32(cluster.farthestDistance);
+    }
+    return data;
+}
+
+bool ShardStatistics::deserialize(const QByteArray& data, ShardStatistics& statisticsOut) {
+    QDataStream stream(data);
+    stream.setVersion(SHARD_DATA_STREAM_VERSION);
+    quint32 magic{ 0 };
+    quint16 version{ 0 };
+    qint64 pixelCount{ 0 };
+    qint64 clusterCount{ 0 };
+    stream >> magic >> version >> pixelCount >> clusterCount;
+    if (stream.status() != QDataStream::Ok || magic != SHARD_STATISTICS_MAGIC || version != SHARD_FORMAT_VERSION || clusterCount < 0) {
+        qWarning() << "Invalid shard statistics.";
+        return false;
+    }
+    ShardStatistics statistics{};
+    statistics.pixelCount = qsizetype(pixelCount);
+    statistics.clusterList.resize(qsizetype(clusterCount));
+    for (auto&& cluster : statistics.clusterList) {
+        qint64 count{ 0 };
+        qint32 farthestDistance{ 0 };
+        stream >> cluster.r >> cluster.g >> cluster.b >> count >> cluster.inertia
+               >> cluster.farthestPixel.r >> cluster.farthestPixel.g >> cluster.farthestPixel.b >> farthestDistance;
+        cluster.count = qsizetype(count);
+        cluster.farthestDistance = int(farthestDistance);
+    }
+    if (stream.status() != QDataStream::Ok) {
+        qWarning() << "Truncated shard statistics.";
+        return false;
+    }
+    statisticsOut = std::move(statistics);
+    return true;
+}
+
+QByteArray serializeCentroids(const QList<Pixel>& centroidList) {
+    QByteArray data{};
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(SHARD_DATA_STREAM_VERSION);
+    stream << CENTROID_LIST_MAGIC << SHARD_FORMAT_VERSION << qint64(centroidList.size());
+    for (auto&& centroid : std::as_const(centroidList)) {
+        stream << centroid.r << centroid.g << centroid.b;
+    }
+    return data;
+}
+
+bool deserializeCentroids(const QByteArray& data, QList<Pixel>& centroidListOut) {
+    QDataStream stream(data);
+    stream.setVersion(SHARD_DATA_STREAM_VERSION);
+    quint32 magic{ 0 };
+    quint16 version{ 0 };
+    qint64 centroidCount{ 0 };
+    stream >> magic >> version >> centroidCount;
+    if (stream.status() != QDataStream::Ok || magic != CENTROID_LIST_MAGIC || version != SHARD_FORMAT_VERSION || centroidCount < 0) {
+        qWarning() << "Invalid centroid list.";
+        return false;
+    }
+    centroidListOut.resize(qsizetype(centroidCount));
+    for (auto&& centroid : centroidListOut) {
+        stream >> centroid.r >> centroid.g >> centroid.b;
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+ShardCoordinator::ShardCoordinator(ShardTransport& transport, const UserOptions& options) : m_transport{ transport }, m_options{ options } {}
+
+ShardCoordinator::~ShardCoordinator() = default;
+
+bool ShardCoordinator::runIteration(const QList<Pixel>& centroidList, ShardStatistics& statisticsOut) {
+    if (!m_transport.broadcast(centroidList)) {
+        qWarning() << "Failed to send the centroids to the shards.";
+        return false;
+    }
+    statisticsOut = {};
+    statisticsOut.clusterList.resize(centroidList.size());
+    for (qsizetype shardIndex{ 0 }; shardIndex < m_transport.shardCount(); ++shardIndex) {
+        ShardStatistics shardStatistics{};
+        if (!m_transport.collect(shardIndex, shardStatistics)) {
+            qWarning() << "Failed to collect the statistics of shard" << shardIndex;
+            return false;
+        }
+        if (Q_UNLIKELY(shardStatistics.clusterList.size() != centroidList.size())) {
+            qWarning() << "Shard" << shardIndex << "reported" << shardStatistics.clusterList.size() << "clusters, expected" << centroidList.size();
+            return false;
+        }
+        statisticsOut.merge(shardStatistics);
+    }
+    return true;
+}
+
+bool ShardCoordinator::run(ColorItemList& resultOut, const QList<Pixel>& initialCentroidList, AnalysisStatistics* statisticsOut) {
+    QElapsedTimer timer{};
+    timer.start();
+    const qsizetype k{ m_options.k };
+    Q_ASSERT(initialCentroidList.size() == k);
+    if (Q_UNLIKELY(initialCentroidList.size() != k || m_transport.shardCount() <= 0 || m_options.maxIterations <= 0)) {
+        qWarning() << "Function parameter not valid, algorithm forcely exited. Please try again with appropriate ones.";
+        return false;
+    }
+    QList<Pixel> centroidList{ initialCentroidList };
+    QList<Pixel> newCentroidList(k);
+    ShardStatistics totalStatistics{};
+    AnalysisStatistics statistics{};
+    const auto& hasEmptyCluster{ [&totalStatistics](){
+        return std::any_of(totalStatistics.clusterList.cbegin(), totalStatistics.clusterList.cend(), [](const ClusterAccumulator& cluster){ return cluster.count <= 0; });
+    } };
+    bool converged{ false };
+    for (qsizetype iteration{ 0 }; iteration < m_options.maxIterations; ++iteration) {
+        ++statistics.iterationCount;
+        if (!runIteration(centroidList, totalStatistics)) {
+            return false;
+        }
+        if constexpr (IS_DEBUG_BUILD) {
+            const quint64 inertia{ std::accumulate(totalStatistics.clusterList.cbegin(), totalStatistics.clusterList.cend(), quint64(0),
+                                                   [](const quint64 sum, const ClusterAccumulator& cluster){ return sum + cluster.inertia; }) };
+            qDebug() << "Sharded iteration" << iteration + 1 << "total inertia:" << inertia;
+        }
+        if (hasEmptyCluster()) {
+            // Same repair as "clusterPixels()", the farthest members are mergeable as well.
+            qsizetype repairedCount{ 0 };
+            for (qsizetype index{ 0 }; index < k; ++index) {
+                if (totalStatistics.clusterList[index].count > 0) {
+                    continue;
+                }
+                const auto donor{ std::max_element(totalStatistics.clusterList.begin(), totalStatistics.clusterList.end(), [](const ClusterAccumulator& lhs, const ClusterAccumulator& rhs){
+                    return lhs.farthestDistance < rhs.farthestDistance;
+                }) };
+                if (donor->farthestDistance <= 0) {
+                    break;
+                }
+                centroidList[index] = donor->farthestPixel;
+                donor->farthestDistance = 0;
+                ++repairedCount;
+            }
+            if (repairedCount <= 0) {
+                qWarning() << "The image contains less than" << k << "distinct colors, please try again with a smaller k.";
+                return false;
+            }
+            statistics.clusterRepairCount += repairedCount;
+            continue;
+        }
+        bool changed{ false };
+        for (qsizetype index{ 0 }; index < k; ++index) {
+            const auto& cluster{ totalStatistics.clusterList[index] };
+            const auto count{ qreal(cluster.count) };
+            newCentroidList[index] = Pixel{ static_cast<quint8>(qRound64(qreal(cluster.r) / count)), static_cast<quint8>(qRound64(qreal(cluster.g) / count)),
+                                            static_cast<quint8>(qRound64(qreal(cluster.b) / count)) };
+            if (isCentroidMoved(centroidList[index], newCentroidList[index])) {
+                changed = true;
+            }
+        }
+        if (!changed) {
+            converged = true;
+            break;
+        }
+        centroidList.swap(newCentroidList);
+    }
+    if (!converged) {
+        // The statistics we have belong to the previous centroids, collect them once more for the final ones.
+        if (!runIteration(centroidList, totalStatistics)) {
+            return false;
+        }
+        if (hasEmptyCluster()) {
+            qWarning() << "Found empty cluster(s) after the last iteration, please try again with a smaller k or more iterations.";
+            return false;
+        }
+    }
+    const qsizetype totalPixelCount{ totalStatistics.pixelCount };
+    QList<qsizetype> clusterIndexList(k);
+    std::iota(clusterIndexList.begin(), clusterIndexList.end(), qsizetype(0));
+    std::sort(clusterIndexList.begin(), clusterIndexList.end(), [&totalStatistics](const qsizetype indexLHS, const qsizetype indexRHS){
+        return totalStatistics.clusterList[indexLHS].count < totalStatistics.clusterList[indexRHS].count;
+    });
+    resultOut.resize(k);
+    for (qsizetype index{ 0 }; index < k; ++index) {
+        const qsizetype clusterIndex{ clusterIndexList[index] };
+        const Pixel pixel{ centroidList[clusterIndex] };
+        ColorItem& result{ resultOut[index] };
+        result.color = QColor::fromRgb(static_cast<int>(pixel.r), static_cast<int>(pixel.g), static_cast<int>(pixel.b));
+        // Every shard counts all of its pixels, the ratios are exact.
+        result.ratio = qreal(totalStatistics.clusterList[clusterIndex].count) / qreal(totalPixelCount);
+        result.ratioLowerBound = result.ratio;
+        result.ratioUpperBound = result.ratio;
+    }
+    if (statisticsOut) {
+        *statisticsOut = statistics;
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Sharded clustering over" << m_transport.shardCount() << "shard(s) done in" << statistics.iterationCount
+                 << "iteration(s)," << timer.elapsed() << "milliseconds.";
+    }
+    return true;
+}
+
+ProcessShardTransport::ProcessShardTransport(const UserOptions& options, const qsizetype shardCount, const QString& traceFilePathPrefix)
+    : m_options{ options }, m_shardCount{ shardCount }, m_traceFilePathPrefix{ traceFilePathPrefix } {}
+
+ProcessShardTransport::~ProcessShardTransport() {
+    for (auto&& process : m_processList) {
+        // Closing the standard input is the signal for the workers to exit.
+        process->closeWriteChannel();
+    }
+    for (auto&& process : m_processList) {
+        if (!process->waitForFinished(5000)) {
+            process->kill();
+            process->waitForFinished();
+        }
+    }
+}
+
+bool ProcessShardTransport::start() {
+    Q_ASSERT(m_processList.empty());
+    for (qsizetype shardIndex{ 0 }; shardIndex < m_shardCount; ++shardIndex) {
+        auto process{ std::make_unique<QProcess>() };
+        // The workers' diagnostics go straight to our own standard error.
+        process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        process->setProgram(QCoreApplication::applicationFilePath());
+        process->setArguments({ u"--shard-worker"_s, QString::number(shardIndex), u"--shards"_s, QString::number(m_shardCount),
+                                u"--max-width"_s, QString::number(m_options.maxWidth), u"--max-height"_s, QString::number(m_options.maxHeight),
+                                u"--alpha-threshold"_s, QString::number(m_options.alphaThreshold) });
+        if (m_options.regionOfInterest.isValid()) {
+            const QRect& roi{ m_options.regionOfInterest };
+            process->setArguments(process->arguments() << u"--roi"_s << u"%1,%2,%3,%4"_s.arg(QString::number(roi.x()), QString::number(roi.y()), QString::number(roi.width()), QString::number(roi.height())));
+        }
+        if (!m_traceFilePathPrefix.isEmpty()) {
+            process->setArguments(process->arguments() << u"--trace"_s << u"%1-shard%2.json"_s.arg(m_traceFilePathPrefix, QString::number(shardIndex)));
+        }
+        process->setArguments(process->arguments() << m_options.filePath);
+        process->start();
+        if (!process->waitForStarted()) {
+            qWarning() << "Failed to start shard worker" << shardIndex << ':' << process->errorString();
+            return false;
+        }
+        m_processList.push_back(std::move(process));
+    }
+    return true;
+}
+
+qsizetype ProcessShardTransport::shardCount() const {
+    return m_shardCount;
+}
+
+bool ProcessShardTransport::broadcast(const QList<Pixel>& centroidList) {
+    Q_ASSERT(qsizetype(m_processList.size()) == m_shardCount);
+    const QByteArray message{ serializeCentroids(centroidList) };
+    for (auto&& process : m_processList) {
+        if (!writeMessage(*process, message)) {
+            return false;
+        }
+    }
+    // Without an event loop, QProcess only hands the data over to the pipe when we wait for it. Do it for all
+    // the workers before collecting anything, otherwise each of them only gets its centroids once the previous
+    // one has answered, and the shards run one after the other.
+    for (auto&& process : m_processList) {
+        while (process->bytesToWrite() > 0) {
+            if (!process->waitForBytesWritten(-1)) {
+                qWarning() << "Cannot send the centroids to a shard worker:" << process->errorString();
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool ProcessShardTransport::collect(const qsizetype shardIndex, ShardStatistics& statisticsOut) {
+    Q_ASSERT(shardIndex >= 0 && shardIndex < qsizetype(m_processList.size()));
+    QProcess& process{ *m_processList[shardIndex] };
+    QByteArray message{};
+    if (!readMessage(process, message)) {
+        qWarning() << "Shard worker" << shardIndex << "stopped responding:" << process.errorString();
+        return false;
+    }
+    return ShardStatistics::deserialize(message, statisticsOut);
+}
+
+int runShardWorker(const UserOptions& options, const qsizetype shardIndex, const qsizetype shardCount) {
+    Q_ASSERT(shardIndex >= 0 && shardIndex < shardCount);
+    if (Q_UNLIKELY(shardIndex < 0 || shardIndex >= shardCount)) {
+        qCritical() << "Invalid shard index" << shardIndex << "of" << shardCount;
+        return EXIT_FAILURE;
+    }
+    QImageReader reader(options.filePath);
+    const QSize imageSize{ reader.size() };
+    if (!imageSize.isValid()) {
+        qCritical().noquote() << "Cannot read the image size:" << reader.errorString();
+        return EXIT_FAILURE;
+    }
+    // Shrink the whole image (or its region of interest) exactly like "prepareImage()" does, then keep our
+    // own stripe of it. The decoder only needs to produce the rows we asked for if it supports clipping natively.
+    QRect sourceRect(QPoint(0, 0), imageSize);
+    if (options.regionOfInterest.isValid() && sourceRect.intersects(options.regionOfInterest)) {
+        sourceRect &= options.regionOfInterest;
+    }
+    const bool isPalettized{ reader.imageFormat() == QImage::Format_Indexed8 || reader.imageFormat() == QImage::Format_Grayscale8 };
+    QSize targetSize{ sourceRect.size() };
+    if (!isPalettized) {
+        if (options.maxWidth > 0) {
+            targetSize.setWidth(qMin(targetSize.width(), options.maxWidth));
+        }
+        if (options.maxHeight > 0) {
+            targetSize.setHeight(qMin(targetSize.height(), options.maxHeight));
+        }
+    }
+    const int top{ int(qint64(shardIndex) * targetSize.height() / shardCount) };
+    const int bottom{ int(qint64(shardIndex + 1) * targetSize.height() / shardCount) };
+    const QRect stripeRect(0, top, targetSize.width(), bottom - top);
+    if (targetSize == sourceRect.size()) {
+        reader.setClipRect(stripeRect.translated(sourceRect.topLeft()));
+    } else {
+        if (sourceRect.size() != imageSize) {
+            reader.setClipRect(sourceRect);
+        }
+        reader.setScaledSize(targetSize);
+        reader.setScaledClipRect(stripeRect);
+    }
+    PixelData pixelData{};
+    if (!stripeRect.isEmpty()) {
+        const QImage image{ reader.read() };
+        if (image.isNull()) {
+            qCritical().noquote() << "Cannot decode the image:" << reader.errorString();
+            return EXIT_FAILURE;
+        }
+        // Every shard must count all of its pixels, sampling is not supported here.
+        UserOptions shardOptions{ options };
+        shardOptions.samplingMethod = SamplingMethod::None;
+        // A fully transparent stripe is fine, it simply reports empty statistics.
+        if (hasAcceptedPixel(image, shardOptions.alphaThreshold) && !extractPixels(pixelData, image, shardOptions)) {
+            qCritical() << "Cannot extract the pixels of the stripe.";
+            return EXIT_FAILURE;
+        }
+    }
+    const qsizetype pixelCount{ pixelData.totalWeight() };
+    QFile input{};
+    QFile output{};
+    if (!input.open(stdin, QFile::ReadOnly, QFile::DontCloseHandle) || !output.open(stdout, QFile::WriteOnly, QFile::DontCloseHandle)) {
+        qCritical() << "Cannot open the standard input/output.";
+        return EXIT_FAILURE;
+    }
+    AnalysisWorkspace workspace{};
+    QByteArray message{};
+    QList<Pixel> centroidList{};
+    ShardStatistics statistics{};
+    // Runs until the coordinator closes our standard input.
+    for (qint64 iterationIndex{ 0 }; readMessage(input, message); ++iterationIndex) {
+        const TraceSpan span{ "Shard iteration", iterationIndex };
+        if (!deserializeCentroids(message, centroidList) || centroidList.isEmpty()) {
+            return EXIT_FAILURE;
+        }
+        statistics.pixelCount = pixelCount;
+        if (pixelData.pixelList.isEmpty()) {
+            statistics.clusterList.fill(ClusterAccumulator{}, centroidList.size());
+        } else if (!accumulateClusters(statistics.clusterList, pixelData, centroidList, &workspace)) {
+            return EXIT_FAILURE;
+        }
+        if (!writeMessage(output, statistics.serialize()) || !output.flush()) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+bool generateInitialCentroids(QList<Pixel>& centroidListOut, const UserOptions& options) {
+    QImageReader reader(options.filePath);
+    applyRegionOfInterest(reader, options);
+    const QSize imageSize{ reader.clipRect().isValid() ? reader.clipRect().size() : reader.size() };
+    if (imageSize.isValid() && qMax(imageSize.width(), imageSize.height()) > SHARD_PREVIEW_SIZE) {
+        reader.setScaledSize(imageSize.scaled(SHARD_PREVIEW_SIZE, SHARD_PREVIEW_SIZE, Qt::KeepAspectRatio));
+    }
+    QImage preview{ reader.read() };
+    if (preview.isNull()) {
+        qWarning().noquote() << "Cannot decode the image preview:" << reader.errorString();
+        return false;
+    }
+    return clusterPreview(centroidListOut, std::move(preview), options);
+}
+
+TileShardTransport::TileShardTransport(const QImage& image, const UserOptions& options, const int tileHeight, AnalysisWorkspace* workspace)
+    : m_image{ image }, m_options{ options }, m_tileHeight{ qMax(tileHeight, 1) }, m_workspace{ workspace } {
+    Q_ASSERT(!m_image.isNull());
+    Q_ASSERT(m_image.format() != QImage::Format_Indexed8);
+    Q_ASSERT(m_options.samplingMethod == SamplingMethod::None);
+    m_options.samplingMethod = SamplingMethod::None;
+    m_hasPixelsList.resize(shardCount());
+    for (qsizetype shardIndex{ 0 }; shardIndex < m_hasPixelsList.size(); ++shardIndex) {
+        m_hasPixelsList[shardIndex] = hasAcceptedPixel(band(shardIndex), m_options.alphaThreshold);
+    }
+}
+
+TileShardTransport::~TileShardTransport() = default;
+
+QImage TileShardTransport::band(const qsizetype shardIndex) const {
+    Q_ASSERT(shardIndex >= 0 && shardIndex < shardCount());
+    const int top{ int(shardIndex) * m_tileHeight };
+    const int height{ qMin(m_tileHeight, m_image.height() - top) };
+    return QImage{ m_image.constScanLine(top), m_image.width(), height, m_image.bytesPerLine(), m_image.format() };
+}
+
+qsizetype TileShardTransport::shardCount() const {
+    return (qsizetype(m_image.height()) + m_tileHeight - 1) / m_tileHeight;
+}
+
+bool TileShardTransport::broadcast(const QList<Pixel>& centroidList) {
+    m_centroidList = centroidList;
+    return !m_centroidList.isEmpty();
+}
+
+bool TileShardTransport::collect(const qsizetype shardIndex, ShardStatistics& statisticsOut) {
+    Q_ASSERT(shardIndex >= 0 && shardIndex < shardCount());
+    if (!m_hasPixelsList[shardIndex]) {
+        statisticsOut.pixelCount = 0;
+        statisticsOut.clusterList.fill(ClusterAccumulator{}, m_centroidList.size());
+        return true;
+    }
+    if (!extractPixels(m_pixelData, band(shardIndex), m_options, m_workspace) || !accumulateClusters(statisticsOut.clusterList, m_pixelData, m_centroidList, m_workspace)) {
+        return false;
+    }
+    statisticsOut.pixelCount = m_pixelData.totalWeight();
+    return true;
+}
+
+bool clusterImageInTiles(ColorItemList& resultOut, const QImage& image, const UserOptions& options, const int tileHeight, AnalysisWorkspace* workspace) {
+    const TraceSpan span{ "Cluster image in tiles", tileHeight };
+    Q_ASSERT(!image.isNull());
+    Q_ASSERT(tileHeight > 0);
+    if (Q_UNLIKELY(image.isNull() || tileHeight <= 0 || image.format() == QImage::Format_Indexed8 || options.samplingMethod != SamplingMethod::None)) {
+        qWarning() << "Function parameter not valid, algorithm forcely exited. Please try again with appropriate ones.";
+        return false;
+    }
+    QImage preview{ image };
+    if (qMax(image.width(), image.height()) > SHARD_PREVIEW_SIZE) {
+        preview = image.scaled(SHARD_PREVIEW_SIZE, SHARD_PREVIEW_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    QList<Pixel> initialCentroidList{};
+    if (!clusterPreview(initialCentroidList, std::move(preview), options, workspace)) {
+        return false;
+    }
+    TileShardTransport transport{ image, options, tileHeight, workspace };
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Clustering the image in" << transport.shardCount() << "band(s) of" << tileHeight << "rows.";
+    }
+    ShardCoordinator coordinator{ transport, options };
+    return coordinator.run(resultOut, initialCentroidList);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "coloranalyzer.h"
+#include <QByteArray>
+#include <memory>
+#include <vector>
+
+QT_BEGIN_NAMESPACE
+class QProcess;
+QT_END_NAMESPACE
+
+// The partial state of one k-means iteration over a part ("shard") of an image: the sufficient statistics
+// of every cluster for a given centroid list. The statistics of different shards can be merged in any order,
+// so one image can be clustered by several processes or machines, each of them only holding its own pixels.
+struct ShardStatistics final {
+    QList<ClusterAccumulator> clusterList{}; // One item per centroid, in the same order.
+    qsizetype pixelCount{ 0 }; // The total weight of all the pixels of the shard.
+
+    void merge(const ShardStatistics& other);
+
+    [[nodiscard]] QByteArray serialize() const;
+    [[nodiscard]] static bool deserialize(const QByteArray& data, ShardStatistics& statisticsOut);
+};
+
+[[nodiscard]] extern QByteArray serializeCentroids(const QList<Pixel>& centroidList);
+[[nodiscard]] extern bool deserializeCentroids(const QByteArray& data, QList<Pixel>& centroidListOut);
+
+// How the coordinator reaches its shards. A shard may live in another thread, process or machine,
+// the coordinator only ever sends centroid lists and receives statistics.
+class ShardTransport {
+    Q_DISABLE_COPY_MOVE(ShardTransport)
+
+public:
+    explicit ShardTransport() = default;
+    virtual ~ShardTransport() = default;
+
+    [[nodiscard]] virtual qsizetype shardCount() const = 0;
+
+    // Sends the centroids to all the shards, which may start accumulating right away.
+    [[nodiscard]] virtual bool broadcast(const QList<Pixel>& centroidList) = 0;
+
+    // Blocks until the given shard has reported its statistics for the centroids broadcast last.
+    [[nodiscard]] virtual bool collect(const qsizetype shardIndex, ShardStatistics& statisticsOut) = 0;
+};
+
+// Runs k-means over all the shards of a transport: broadcast the centroids, merge the statistics of all
+// the shards, move the centroids, and repeat until they are stable. Gives exactly the same result as
+// "clusterPixels()" would give for the same initial centroids over all the pixels at once.
+class ShardCoordinator final {
+    Q_DISABLE_COPY_MOVE(ShardCoordinator)
+
+public:
+    explicit ShardCoordinator(ShardTransport& transport, const UserOptions& options);
+    ~ShardCoordinator();
+
+    // "initialCentroidList" MUST contain exactly k items. Unlike "clusterPixels()", there is no restart
+    // with random centroids if a cluster ends up empty, the shards have no common source of randomness.
+    [[nodiscard]] bool run(ColorItemList& resultOut, const QList<Pixel>& initialCentroidList, AnalysisStatistics* statisticsOut = nullptr);
+
+private:
+    [[nodiscard]] bool runIteration(const QList<Pixel>& centroidList, ShardStatistics& statisticsOut);
+
+    ShardTransport& m_transport;
+    UserOptions m_options{};
+};
+
+// A local stand-in for a cluster of nodes: each shard is a child process of this very executable, running
+// in shard worker mode (see "runShardWorker()") and talking through its standard input and output.
+// If "traceFilePathPrefix" is not empty, worker N records a trace into "<traceFilePathPrefix>-shardN.json".
+class ProcessShardTransport final : public ShardTransport {
+public:
+    explicit ProcessShardTransport(const UserOptions& options, const qsizetype shardCount, const QString& traceFilePathPrefix = {});
+    ~ProcessShardTransport() override;
+
+    // Starts all the worker processes, each of them decodes its own part of "options.filePath".
+    [[nodiscard]] bool start();
+
+    [[nodiscard]] qsizetype shardCount() const override;
+    [[nodiscard]] bool broadcast(const QList<Pixel>& centroidList) override;
+    [[nodiscard]] bool collect(const qsizetype shardIndex, ShardStatistics& statisticsOut) override;
+
+private:
+    UserOptions m_options{};
+    qsizetype m_shardCount{ 0 };
+    QString m_traceFilePathPrefix{};
+    std::vector<std::unique_ptr<QProcess>> m_processList{};
+};
+
+// An in-process transport over horizontal bands of one image: the pixels of only one band exist at a time,
+// so the memory usage doesn't grow with the image size. Used to stay within a memory budget, see "MemoryStrategy::Tiling".
+// The bands are collected one after another on the calling thread.
+class TileShardTransport final : public ShardTransport {
+public:
+    // "image" MUST NOT be palettized, and "options" MUST NOT ask for sampling: every pixel is counted.
+    explicit TileShardTransport(const QImage& image, const UserOptions& options, const int tileHeight, AnalysisWorkspace* workspace = nullptr);
+    ~TileShardTransport() override;
+
+    [[nodiscard]] qsizetype shardCount() const override;
+    [[nodiscard]] bool broadcast(const QList<Pixel>& centroidList) override;
+    [[nodiscard]] bool collect(const qsizetype shardIndex, ShardStatistics& statisticsOut) override;
+
+private:
+    // A view into the rows of "m_image", nothing is copied.
+    [[nodiscard]] QImage band(const qsizetype shardIndex) const;
+
+    QImage m_image{};
+    UserOptions m_options{};
+    int m_tileHeight{ 0 };
+    AnalysisWorkspace* m_workspace{ nullptr };
+    QList<bool> m_hasPixelsList{}; // Fully transparent bands are skipped, "extractPixels()" would fail for them.
+    QList<Pixel> m_centroidList{};
+    PixelData m_pixelData{}; // Reused by all the bands.
+};
+
+// Clusters the (already prepared) image band by band through "TileShardTransport", starting from the
+// centroids of a small preview. Needs far less memory than "clusterImage()" for large images, at the
+// cost of extracting the pixels again in every iteration.
+[[nodiscard]] extern bool clusterImageInTiles(ColorItemList& resultOut, const QImage& image, const UserOptions& options, const int tileHeight, AnalysisWorkspace* workspace = nullptr);
+
+// The worker side of "ProcessShardTransport": decodes the horizontal stripe "shardIndex" of the (possibly
+// shrinked) image, then reads centroid lists from the standard input and answers each of them with the
+// statistics of its pixels on the standard output, until the standard input is closed. Returns the exit code.
+[[nodiscard]] extern int runShardWorker(const UserOptions& options, const qsizetype shardIndex, const qsizetype shardCount);
+
+// Clusters a small preview of the image to get the initial centroids, so that the shards don't have
+// to agree on a random seed. Also a good warm start: the centroids are already close to the final ones.
+[[nodiscard]] extern bool generateInitialCentroids(QList<Pixel>& centroidListOut, const UserOptions& options);
@@ -0,0 +1,171 @@
+#include "taskscheduler.h"
+#include "tracing.h"
+#include <QThread>
+#include <QDebug>
+
+using namespace Qt::StringLiterals;
+
+TaskScheduler::TaskScheduler(const TaskSchedulerOptions& options) : m_options{ options } {
+    m_workerCount = m_options.workerCount > 0 ? m_options.workerCount : qMax(QThread::idealThreadCount(), 1);
+    m_options.queueCapacity = qMax(m_options.queueCapacity, qsizetype(1));
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        const QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        for (auto&& queue : m_queueList) {
+            for (auto&& queuedTask : std::as_const(queue)) {
+                queuedTask.cancellationToken.cancel();
+            }
+            queue.clear();
+        }
+        for (auto&& token : std::as_const(m_runningTokenList)) {
+            token.cancel();
+        }
+        m_taskAvailable.wakeAll();
+    }
+    for (auto&& thread : m_threadList) {
+        thread->wait();
+    }
+}
+
+bool TaskScheduler::submit(const TaskPriority priority, const CancellationToken& cancellationToken, Task task) {
+    Q_ASSERT(task);
+    if (Q_UNLIKELY(!task)) {
+        return false;
+    }
+    const QMutexLocker locker(&m_mutex);
+    if (Q_UNLIKELY(m_stopping)) {
+        return false;
+    }
+    dropCancelledTasks();
+    if (queuedTaskCount() >= m_options.queueCapacity) {
+        if (m_options.rejectionPolicy == RejectionPolicy::RejectNew) {
+            if constexpr (IS_DEBUG_BUILD) {
+                qDebug() << "Task rejected, the queue is full.";
+            }
+            return false;
+        }
+        Q_ASSERT(m_options.rejectionPolicy == RejectionPolicy::CancelLowest);
+        qsizetype victimPriority{ s_priorityCount - 1 };
+        while (m_queueList[victimPriority].isEmpty()) {
+            --victimPriority;
+        }
+        if (victimPriority < qsizetype(priority)) {
+            if constexpr (IS_DEBUG_BUILD) {
+                qDebug() << "Task rejected, the queue is full of more urgent tasks.";
+            }
+            return false;
+        }
+        m_queueList[victimPriority].dequeue().cancellationToken.cancel();
+        if constexpr (IS_DEBUG_BUILD) {
+            qDebug() << "The queue is full, cancelled a queued task of priority" << victimPriority << "to make room.";
+        }
+    }
+    m_queueList[qsizetype(priority)].enqueue(QueuedTask{ cancellationToken, std::move(task) });
+    if (m_threadList.empty()) {
+        startWorkers();
+    }
+    m_taskAvailable.wakeOne();
+    return true;
+}
+
+void TaskScheduler::waitForDone() {
+    QMutexLocker locker(&m_mutex);
+    while (true) {
+        dropCancelledTasks();
+        if (m_runningCount <= 0 && queuedTaskCount() <= 0) {
+            return;
+        }
+        m_idle.wait(&m_mutex);
+    }
+}
+
+int TaskScheduler::workerCount() const {
+    return m_workerCount;
+}
+
+void TaskScheduler::startWorkers() {
+    Q_ASSERT(m_threadList.empty());
+    m_runningTokenList.resize(m_workerCount);
+    m_threadList.reserve(m_workerCount);
+    for (int index{ 0 }; index < m_workerCount; ++index) {
+        std::unique_ptr<QThread> thread{ QThread::create([this, index](){ runWorker(index); }) };
+        thread->setObjectName(u"TaskWorkerThread%1"_s.arg(index));
+        thread->start();
+        m_threadList.push_back(std::move(thread));
+    }
+    if constexpr (IS_DEBUG_BUILD) {
+        qDebug() << "Started" << m_workerCount << "task worker(s).";
+    }
+}
+
+void TaskScheduler::runWorker(const int workerIndex) {
+    // Lives as long as the worker, so its buffers are reused by all the tasks it runs.
+    AnalysisWorkspace workspace{};
+    QueuedTask queuedTask{};
+    TaskPriority priority{ TaskPriority::Interactive };
+    QMutexLocker locker(&m_mutex);
+    while (takeTask(workerIndex, queuedTask, priority)) {
+        locker.unlock();
+        {
+            const TraceSpan span{ "Task", qint64(priority) };
+            queuedTask.task(queuedTask.cancellationToken, workspace);
+        }
+        queuedTask = {};
+        locker.relock();
+        m_runningTokenList[workerIndex] = {};
+        --m_runningCount;
+        if (priority != TaskPriority::Interactive) {
+            --m_runningNonInteractiveCount;
+        }
+        if (m_runningCount <= 0) {
+            m_idle.wakeAll();
+        }
+    }
+}
+
+bool TaskScheduler::takeTask(const int workerIndex, QueuedTask& taskOut, TaskPriority& priorityOut) {
+    while (!m_stopping) {
+        dropCancelledTasks();
+        for (qsizetype index{ 0 }; index < s_priorityCount; ++index) {
+            const auto priority{ TaskPriority(index) };
+            // Keep one worker free for interactive tasks, see the class description.
+            if (priority != TaskPriority::Interactive && m_workerCount > 1 && m_runningNonInteractiveCount >= m_workerCount - 1) {
+                break;
+            }
+            if (m_queueList[index].isEmpty()) {
+                continue;
+            }
+            taskOut = m_queueList[index].dequeue();
+            priorityOut = priority;
+            m_runningTokenList[workerIndex] = taskOut.cancellationToken;
+            ++m_runningCount;
+            if (priority != TaskPriority::Interactive) {
+                ++m_runningNonInteractiveCount;
+            }
+            return true;
+        }
+        if (m_runningCount <= 0 && queuedTaskCount() <= 0) {
+            // The last queued tasks may have been cancelled instead of having run.
+            m_idle.wakeAll();
+        }
+        m_taskAvailable.wait(&m_mutex);
+    }
+    return false;
+}
+
+void TaskScheduler::dropCancelledTasks() {
+    for (auto&& queue : m_queueList) {
+        queue.removeIf([](const QueuedTask& queuedTask){ return queuedTask.cancellationToken.isCancelled(); });
+    }
+}
+
+qsizetype TaskScheduler::queuedTaskCount() const {
+    qsizetype count{ 0 };
+    for (auto&& queue : m_queueList) {
+        count += queue.size();
+    }
+    return count;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "coloranalyzer.h"
+#include <QMutex>
+#include <QQueue>
+#include <QWaitCondition>
+#include <array>
+#include <functional>
+#include <memory>
+#include <vector>
+
+QT_BEGIN_NAMESPACE
+class QThread;
+QT_END_NAMESPACE
+
+// From the most urgent to the least urgent one. A worker always takes the most urgent task available.
+enum class TaskPriority : quint8 {
+    Interactive, // The user is waiting for it, eg. a (re-)analysis started from the main window.
+    Batch, // Long running work the user has asked for, but isn't staring at, eg. all the frames of an animation.
+    Background // Speculative work, eg. prefetching, which may as well never run.
+};
+
+// What "TaskScheduler::submit()" does when the queue is full.
+enum class RejectionPolicy : quint8 {
+    RejectNew, // The new task is refused.
+    CancelLowest // The oldest queued task of the least urgent class is cancelled to make room, unless
+                 // it's more urgent than the new task, in which case the new task is refused.
+};
+
+struct TaskSchedulerOptions final {
+    int workerCount{ 0 }; // Any value <= 0 means one worker per logical CPU core.
+    qsizetype queueCapacity{ 16 }; // How many tasks (of all classes together) may wait for a worker.
+    RejectionPolicy rejectionPolicy{ RejectionPolicy::CancelLowest };
+};
+
+// A pool of worker threads running prioritized tasks. Each worker owns an analysis workspace which is passed
+// to every task it runs, so tasks don't need to allocate their own buffers.
+//
+// Tasks are never preempted, the unit of scheduling ("quantum") is one task. To still keep the application
+// responsive while long tasks are running, one worker is kept for interactive tasks only (as long as there is
+// more than one worker): a new interactive task therefore starts right away, or at most after the interactive
+// task currently running, even when the whole pool is busy with batch work.
+class TaskScheduler final {
+    Q_DISABLE_COPY_MOVE(TaskScheduler)
+
+public:
+    using Task = std::function<void(const CancellationToken& cancellationToken, AnalysisWorkspace& workspace)>;
+
+    explicit TaskScheduler(const TaskSchedulerOptions& options = {});
+    // Cancels all the queued and running tasks and waits for the workers to finish.
+    ~TaskScheduler();
+
+    // Queues "task", the workers are started on first use. "cancellationToken" is handed over to the task, a
+    // task that has been cancelled before a worker got to it is dropped without running. Returns false (and
+    // drops the task) if it has been rejected because the queue is full.
+    [[nodiscard]] bool submit(const TaskPriority priority, const CancellationToken& cancellationToken, Task task);
+
+    // Blocks until all the queued tasks have run (or have been cancelled) and no task is running anymore.
+    void waitForDone();
+
+    [[nodiscard]] int workerCount() const;
+
+private:
+    struct QueuedTask final {
+        CancellationToken cancellationToken{};
+        Task task{};
+    };
+
+    static inline constexpr const qsizetype s_priorityCount{ 3 };
+
+    // All the functions below MUST be called with "m_mutex" locked (apart from "runWorker()", which locks it itself).
+    void startWorkers();
+    void runWorker(const int workerIndex);
+    [[nodiscard]] bool takeTask(const int workerIndex, QueuedTask& taskOut, TaskPriority& priorityOut);
+    void dropCancelledTasks();
+    [[nodiscard]] qsizetype queuedTaskCount() const;
+
+    TaskSchedulerOptions m_options{};
+    int m_workerCount{ 1 };
+    mutable QMutex m_mutex{};
+    QWaitCondition m_taskAvailable{};
+    QWaitCondition m_idle{};
+    std::array<QQueue<QueuedTask>, s_priorityCount> m_queueList{}; // Indexed by "TaskPriority".
+    std::vector<CancellationToken> m_runningTokenList{}; // Indexed by the worker index.
+    int m_runningCount{ 0 };
+    int m_runningNonInteractiveCount{ 0 };
+    bool m_stopping{ false };
+    std::vector<std::unique_ptr<QThread>> m_threadList{};
+};
@@ -0,0 +1,494 @@
+#include "coloranalyzer.h"
+#include <QDir>
+#include <QTemporaryDir>
+#include <QTest>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <numeric>
+#include <random>
+
+using namespace Qt::StringLiterals;
+
+Q_DECLARE_METATYPE(UserOptions)
+
+// Counts the heap allocations of the current thread, however they're made: the global allocation functions of this
+// test binary are replaced, and so is "malloc()" with glibc, which Qt's containers call directly. Other threads (eg.
+// the watchdog of the test library) don't count.
+thread_local bool t_isCountingHeapAllocations{ false };
+thread_local qsizetype t_heapAllocationCount{ 0 };
+
+static inline void countHeapAllocation() {
+    if (t_isCountingHeapAllocations) {
+        ++t_heapAllocationCount;
+    }
+}
+
+#ifdef __GLIBC__
+static constexpr const bool s_canCountMalloc{ true };
+
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* pointer, std::size_t size);
+void __libc_free(void* pointer);
+
+void* malloc(std::size_t size) noexcept {
+    countHeapAllocation();
+    return __libc_malloc(size);
+}
+
+void* calloc(std::size_t count, std::size_t size) noexcept {
+    countHeapAllocation();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, std::size_t size) noexcept {
+    countHeapAllocation();
+    return __libc_realloc(pointer, size);
+}
+}
+
+[[nodiscard]] static inline void* allocateUncounted(const std::size_t size) {
+    return __libc_malloc(size == 0 ? 1 : size);
+}
+
+static inline void deallocate(void* pointer) {
+    __libc_free(pointer);
+}
+#else
+static constexpr const bool s_canCountMalloc{ false };
+
+[[nodiscard]] static inline void* allocateUncounted(const std::size_t size) {
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+static inline void deallocate(void* pointer) {
+    std::free(pointer);
+}
+#endif
+
+void* operator new(const std::size_t size) {
+    countHeapAllocation();
+    if (void* const pointer{ allocateUncounted(size) }) {
+        return pointer;
+    }
+    throw std::bad_alloc{};
+}
+
+void* operator new[](const std::size_t size) {
+    return ::operator new(size);
+}
+
+void* operator new(const std::size_t size, const std::nothrow_t&) noexcept {
+    countHeapAllocation();
+    return allocateUncounted(size);
+}
+
+void* operator new[](const std::size_t size, const std::nothrow_t&) noexcept {
+    countHeapAllocation();
+    return allocateUncounted(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    deallocate(pointer);
+}
+
+template <typename Function>
+[[nodiscard]] static inline qsizetype countHeapAllocations(Function&& function) {
+    t_heapAllocationCount = 0;
+    t_isCountingHeapAllocations = true;
+    function();
+    t_isCountingHeapAllocations = false;
+    return t_heapAllocationCount;
+}
+
+// Far away from each other, so that k-means can't possibly merge any two of them.
+static const QList<QRgb> DISTINCT_COLOR_LIST{ 0xFFFF0000, 0xFF00FF00, 0xFF0000FF, 0xFFFFFF00, 0xFFFF00FF, 0xFF00FFFF, 0xFFFFFFFF, 0xFF000000 };
+
+// Horizontal stripes of the first "colorCount" distinct colors, color i being 2 * (i + 1) rows high, so that
+// no two colors have the same pixel count. Small enough to never be shrinked with the default options.
+[[nodiscard]] static inline QImage stripedImage(const qsizetype colorCount) {
+    Q_ASSERT(colorCount > 0 && colorCount <= DISTINCT_COLOR_LIST.size());
+    const int width{ 64 };
+    QImage image(width, int(colorCount * (colorCount + 1)), QImage::Format_ARGB32);
+    int y{ 0 };
+    for (qsizetype colorIndex{ 0 }; colorIndex < colorCount; ++colorIndex) {
+        for (int row{ 0 }; row < 2 * (colorIndex + 1); ++row, ++y) {
+            for (int x{ 0 }; x < width; ++x) {
+                image.setPixel(x, y, DISTINCT_COLOR_LIST[colorIndex]);
+            }
+        }
+    }
+    return image;
+}
+
+// Every centroid starts on the same color: all the clusters but the first one are empty.
+[[nodiscard]] static inline ColorItemList collapsedWarmStart(const qsizetype k) {
+    return ColorItemList(k, ColorItem{ QColor::fromRgb(DISTINCT_COLOR_LIST.constFirst()) });
+}
+
+// Random colors from a fixed seed. Palettized formats get a random 256 color palette.
+[[nodiscard]] static inline QImage noiseImage(const int width, const int height, const QImage::Format format) {
+    std::mt19937 engine(20240601);
+    std::uniform_int_distribution<int> channelDist(0, 255);
+    const auto& randomColor{ [&engine, &channelDist](){
+        const int r{ channelDist(engine) };
+        const int g{ channelDist(engine) };
+        const int b{ channelDist(engine) };
+        return qRgb(r, g, b);
+    } };
+    QImage image(width, height, format);
+    const bool isIndexed{ format == QImage::Format_Indexed8 };
+    if (isIndexed) {
+        image.setColorCount(256);
+        for (int index{ 0 }; index < 256; ++index) {
+            image.setColor(index, randomColor());
+        }
+    }
+    for (int y{ 0 }; y < height; ++y) {
+        for (int x{ 0 }; x < width; ++x) {
+            if (isIndexed) {
+                image.setPixel(x, y, uint(channelDist(engine)));
+            } else {
+                image.setPixel(x, y, randomColor());
+            }
+        }
+    }
+    return image;
+}
+
+class ColorAnalyzerTest final : public QObject {
+    Q_OBJECT
+
+private Q_SLOTS:
+    void fewerColorsThanK_data();
+    void fewerColorsThanK();
+    void exactlyKColors_data();
+    void exactlyKColors();
+    void fullyTransparentImage();
+    void steadyStateDoesNotAllocate_data();
+    void steadyStateDoesNotAllocate();
+    void emptyPyramidLevel();
+    void pyramidOfOpaqueFormat();
+    void regionOfInterestFollowsTheFile();
+    void paletteHistogram_data();
+    void paletteHistogram();
+};
+
+void ColorAnalyzerTest::fewerColorsThanK_data() {
+    QTest::addColumn<int>("k");
+    QTest::addColumn<int>("colorCount");
+    QTest::addColumn<bool>("warmStart");
+    for (const bool warmStart : { false, true }) {
+        for (const int k : { 5, 8 }) {
+            for (const int colorCount : { 1, 2, k - 1 }) {
+                QTest::addRow("k=%d colors=%d%s", k, colorCount, warmStart ? " collapsed" : "") << k << colorCount << warmStart;
+            }
+        }
+    }
+}
+
+// Not enough distinct colors is a hard failure: no amount of repairing or restarting can fill k clusters.
+void ColorAnalyzerTest::fewerColorsThanK() {
+    QFETCH(int, k);
+    QFETCH(int, colorCount);
+    QFETCH(bool, warmStart);
+    UserOptions options{};
+    options.k = k;
+    // The restart path would log "Failed too many times" instead, after up to ten restarts.
+    QTest::ignoreMessage(QtWarningMsg, qPrintable(u"The image contains less than %1 distinct colors, please try again with a smaller k."_s.arg(k)));
+    ColorItemList result{};
+    AnalysisStatistics statistics{};
+    QVERIFY(!extractColorsFromImage(result, stripedImage(colorCount), options, nullptr, warmStart ? collapsedWarmStart(k) : ColorItemList{}, &statistics));
+    QVERIFY(result.isEmpty());
+}
+
+void ColorAnalyzerTest::exactlyKColors_data() {
+    QTest::addColumn<int>("k");
+    QTest::addColumn<bool>("warmStart");
+    for (const int k : { 2, 5, 8 }) {
+        QTest::addRow("k=%d random", k) << k << false;
+        QTest::addRow("k=%d collapsed", k) << k << true;
+    }
+}
+
+// Every empty cluster is repaired in place, one per iteration since there is only one cluster to split at
+// first, and no restart is ever needed. The result is exact: one cluster per color.
+void ColorAnalyzerTest::exactlyKColors() {
+    QFETCH(int, k);
+    QFETCH(bool, warmStart);
+    UserOptions options{};
+    options.k = k;
+    const QImage image{ stripedImage(k) };
+    ColorItemList result{};
+    AnalysisStatistics statistics{};
+    QVERIFY(extractColorsFromImage(result, image, options, nullptr, warmStart ? collapsedWarmStart(k) : ColorItemList{}, &statistics));
+    QCOMPARE(statistics.restartCount, qsizetype(0));
+    if (warmStart) {
+        QCOMPARE(statistics.clusterRepairCount, qsizetype(k - 1));
+    } else {
+        // Only the duplicated initial centroids need a repair.
+        QVERIFY(statistics.clusterRepairCount >= 0);
+        QVERIFY(statistics.clusterRepairCount <= k - 1);
+    }
+    QCOMPARE(result.size(), qsizetype(k));
+    const qreal totalPixelCount{ qreal(image.width()) * qreal(image.height()) };
+    // Sorted from the smallest cluster to the largest one, which is the stripe order.
+    for (int index{ 0 }; index < k; ++index) {
+        QCOMPARE(result[index].color.rgba(), DISTINCT_COLOR_LIST[index]);
+        QCOMPARE(result[index].ratio, qreal(image.width()) * qreal(2 * (index + 1)) / totalPixelCount);
+    }
+}
+
+// Fails at runtime (even in debug builds, where it used to hit an assertion).
+void ColorAnalyzerTest::fullyTransparentImage() {
+    QImage image(64, 64, QImage::Format_ARGB32);
+    image.fill(Qt::transparent);
+    const UserOptions options{};
+    PixelData pixelData{};
+    QTest::ignoreMessage(QtWarningMsg, "No valid pixels found, please check the image file and/or the alpha threshold.");
+    QVERIFY(!extractPixels(pixelData, image, options));
+    QVERIFY(pixelData.pixelList.isEmpty());
+    ColorItemList result{};
+    QTest::ignoreMessage(QtWarningMsg, "Function parameter not valid, algorithm forcely exited. Please try again with appropriate ones.");
+    QVERIFY(!clusterPixels(result, pixelData, options));
+}
+
+void ColorAnalyzerTest::steadyStateDoesNotAllocate_data() {
+    QTest::addColumn<QImage>("image");
+    QTest::addColumn<UserOptions>("options");
+    const QImage image{ noiseImage(300, 200, QImage::Format_ARGB32) };
+    QTest::newRow("shrinked") << image << UserOptions{};
+    UserOptions fullSizeOptions{};
+    fullSizeOptions.maxWidth = 0;
+    fullSizeOptions.maxHeight = 0;
+    QTest::newRow("full size") << image << fullSizeOptions;
+    UserOptions multiResolutionOptions{ fullSizeOptions };
+    multiResolutionOptions.multiResolution = true;
+    QTest::newRow("multi-resolution") << image << multiResolutionOptions;
+    UserOptions largeKOptions{};
+    largeKOptions.k = 100; // Through the k-d tree.
+    QTest::newRow("large k") << image << largeKOptions;
+    for (const SamplingMethod samplingMethod : { SamplingMethod::Uniform, SamplingMethod::Stratified, SamplingMethod::Reservoir }) {
+        UserOptions samplingOptions{};
+        samplingOptions.samplingMethod = samplingMethod;
+        samplingOptions.sampleBudget = 5000;
+        QTest::addRow("sampling %d", int(samplingMethod)) << image << samplingOptions;
+    }
+    QTest::newRow("palette") << noiseImage(300, 200, QImage::Format_Indexed8) << UserOptions{};
+}
+
+// Once a workspace has seen an image, analyzing the same kind of image again must not grow any buffer,
+// including the pixel buffers "extractPixels()" fills.
+void ColorAnalyzerTest::steadyStateDoesNotAllocate() {
+    QFETCH(QImage, image);
+    QFETCH(UserOptions, options);
+    AnalysisWorkspace workspace{};
+    ColorItemList result{};
+    QVERIFY(extractColorsFromImage(result, image, options, &workspace));
+    const qsizetype warmAllocationCount{ workspace.allocationCount() };
+    QVERIFY(warmAllocationCount > 0);
+    for (int run{ 0 }; run < 3; ++run) {
+        QVERIFY(extractColorsFromImage(result, image, options, &workspace));
+        QCOMPARE(workspace.allocationCount(), warmAllocationCount);
+    }
+    // The pixel buffers are counted even when they don't belong to the workspace.
+    PixelData pixelData{};
+    QVERIFY(extractPixels(pixelData, image, options, &workspace));
+    QVERIFY(workspace.allocationCount() > warmAllocationCount);
+    const qsizetype extractedAllocationCount{ workspace.allocationCount() };
+    QVERIFY(extractPixels(pixelData, image, options, &workspace));
+    QCOMPARE(workspace.allocationCount(), extractedAllocationCount);
+    // The workspace only knows about its own buffers, the heap sees everything else too: once warm, extracting
+    // the pixels again and clustering them must not allocate anything at all.
+    if constexpr (IS_DEBUG_BUILD) {
+        QSKIP("The debug output allocates.");
+    }
+    if (!s_canCountMalloc) {
+        QSKIP("Qt's containers call malloc() directly, it can only be counted with glibc.");
+    }
+    QVERIFY(clusterPixels(result, pixelData, options, &workspace));
+    bool ok{ false };
+    const qsizetype heapAllocationCount{ countHeapAllocations([&ok, &pixelData, &image, &options, &workspace, &result](){
+        ok = extractPixels(pixelData, image, options, &workspace) && clusterPixels(result, pixelData, options, &workspace);
+    }) };
+    QVERIFY(ok);
+    QCOMPARE(heapAllocationCount, qsizetype(0));
+}
+
+// Only one pixel of every 2x2 block is opaque, so the alpha of every smaller level averages to 64, below the
+// default threshold of 180: all the levels but level 0 are empty, and must simply be skipped.
+void ColorAnalyzerTest::emptyPyramidLevel() {
+    QImage image(256, 256, QImage::Format_ARGB32);
+    image.fill(Qt::transparent);
+    for (int y{ 0 }; y < image.height(); y += 2) {
+        for (int x{ 0 }; x < image.width(); x += 2) {
+            image.setPixel(x, y, x < 64 ? DISTINCT_COLOR_LIST[0] : DISTINCT_COLOR_LIST[1]);
+        }
+    }
+    UserOptions options{};
+    options.k = 2;
+    options.maxWidth = 0;
+    options.maxHeight = 0;
+    options.multiResolution = true;
+    // 256 -> 128 -> 64: two empty levels.
+    for (int level{ 1 }; level <= 2; ++level) {
+        QTest::ignoreMessage(QtWarningMsg, "No valid pixels found, please check the image file and/or the alpha threshold.");
+    }
+    ColorItemList result{};
+    QVERIFY(clusterImage(result, image, options));
+    QCOMPARE(result.size(), qsizetype(2));
+    QCOMPARE(result[0].color.rgba(), DISTINCT_COLOR_LIST[0]);
+    QCOMPARE(result[0].ratio, qreal(0.25));
+    QCOMPARE(result[1].color.rgba(), DISTINCT_COLOR_LIST[1]);
+    QCOMPARE(result[1].ratio, qreal(0.75));
+}
+
+// Level 0 is used in its own format, only the smaller levels are built from an ARGB32 copy. Starts from the
+// stripe colors themselves, so that no random initialization is involved: whatever the format, the result must be
+// exactly the stripes, each color i covering 2 * (i + 1) of the 30 rows (the smallest first).
+void ColorAnalyzerTest::pyramidOfOpaqueFormat() {
+    const int k{ 5 };
+    const QImage stripes{ stripedImage(k).scaled(300, 300) }; // Nearest neighbour, exactly 10 times, no new colors.
+    UserOptions options{};
+    options.k = k;
+    options.maxWidth = 0;
+    options.maxHeight = 0;
+    options.multiResolution = true;
+    ColorItemList warmStartList{};
+    for (qsizetype index{ 0 }; index < k; ++index) {
+        warmStartList.append(ColorItem{ QColor::fromRgb(DISTINCT_COLOR_LIST[index]) });
+    }
+    for (const QImage::Format format : { QImage::Format_ARGB32, QImage::Format_RGB32, QImage::Format_RGB888, QImage::Format_ARGB32_Premultiplied }) {
+        ColorItemList result{};
+        QVERIFY(clusterImage(result, stripes.convertToFormat(format), options, nullptr, warmStartList));
+        QCOMPARE(result.size(), qsizetype(k));
+        for (qsizetype index{ 0 }; index < k; ++index) {
+            QCOMPARE(result[index].color.rgba(), DISTINCT_COLOR_LIST[index]);
+            QCOMPARE(result[index].ratio, qreal(2 * (index + 1)) / qreal(30));
+        }
+    }
+}
+
+// The GUI keeps its options around, a region selected on one image must not be applied to the next one.
+void ColorAnalyzerTest::regionOfInterestFollowsTheFile() {
+    QTemporaryDir directory{};
+    QVERIFY(directory.isValid());
+    const QString firstFilePath{ directory.filePath(u"first.png"_s) };
+    const QString secondFilePath{ directory.filePath(u"second.png"_s) };
+    QVERIFY(stripedImage(2).save(firstFilePath));
+    QVERIFY(stripedImage(3).save(secondFilePath));
+    const QRect region{ 4, 2, 16, 3 };
+    UserOptions options{};
+    setImageFilePath(options, firstFilePath);
+    options.regionOfInterest = region;
+    // The same file, even through another path.
+    setImageFilePath(options, firstFilePath);
+    QCOMPARE(options.regionOfInterest, region);
+    const QString otherSpelling{ QDir(directory.filePath(u"."_s)).filePath(u"../%1/first.png"_s.arg(QDir(directory.path()).dirName())) };
+    setImageFilePath(options, otherSpelling);
+    QCOMPARE(options.filePath, otherSpelling);
+    QCOMPARE(options.regionOfInterest, region);
+    // Another file: the whole image is analyzed, not the old region.
+    setImageFilePath(options, secondFilePath);
+    QCOMPARE(options.filePath, secondFilePath);
+    QVERIFY(!options.regionOfInterest.isValid());
+    // The old region would only cover one of the three colors, which isn't enough for k=3.
+    options.k = 3;
+    ColorItemList result{};
+    QVERIFY(extractColorsFromImage(result, readImage(options), options));
+    QCOMPARE(result.size(), qsizetype(3));
+    // Also when the file doesn't exist (any more).
+    options.regionOfInterest = region;
+    setImageFilePath(options, directory.filePath(u"missing.png"_s));
+    QVERIFY(!options.regionOfInterest.isValid());
+}
+
+void ColorAnalyzerTest::paletteHistogram_data() {
+    QTest::addColumn<QImage>("image");
+    QTest::addColumn<QList<QRgb>>("expectedColorList"); // In palette order.
+    QTest::addColumn<QList<qsizetype>>("expectedWeightList");
+    // Index:  0: red, 1: green, 2: red again, 3: blue below the alpha threshold, 4: yellow above it, 5: unused.
+    // Pixels: 5,      20,       25,           10,                                40,                  0.
+    {
+        QImage image(10, 10, QImage::Format_Indexed8);
+        image.setColorTable({ qRgb(255, 0, 0), qRgb(0, 255, 0), qRgb(255, 0, 0), qRgba(0, 0, 255, 100), qRgba(255, 255, 0, 200), qRgb(0, 0, 0) });
+        static constexpr const std::array<int, 5> pixelCountArray{ 5, 20, 25, 10, 40 };
+        int pixelIndex{ 0 };
+        for (std::size_t colorIndex{ 0 }; colorIndex < pixelCountArray.size(); ++colorIndex) {
+            for (int count{ 0 }; count < pixelCountArray[colorIndex]; ++count, ++pixelIndex) {
+                image.setPixel(pixelIndex % image.width(), pixelIndex / image.width(), uint(colorIndex));
+            }
+        }
+        // The duplicate entries are merged into the first one, the transparent one is rejected as a whole.
+        QTest::newRow("indexed") << image << QList<QRgb>{ qRgb(255, 0, 0), qRgb(0, 255, 0), qRgb(255, 255, 0) } << QList<qsizetype>{ 30, 20, 40 };
+    }
+    {
+        QImage image(10, 10, QImage::Format_Grayscale8);
+        for (int y{ 0 }; y < image.height(); ++y) {
+            uchar* const line{ image.scanLine(y) };
+            for (int x{ 0 }; x < image.width(); ++x) {
+                line[x] = y < 1 ? 0 : (y < 4 ? 128 : 255);
+            }
+        }
+        QTest::newRow("grayscale") << image << QList<QRgb>{ qRgb(0, 0, 0), qRgb(128, 128, 128), qRgb(255, 255, 255) } << QList<qsizetype>{ 10, 30, 60 };
+    }
+}
+
+// Every pixel is counted through the histogram, so the result is exact, even when sampling has been asked for.
+void ColorAnalyzerTest::paletteHistogram() {
+    QFETCH(QImage, image);
+    QFETCH(QList<QRgb>, expectedColorList);
+    QFETCH(QList<qsizetype>, expectedWeightList);
+    const qsizetype totalWeight{ std::accumulate(expectedWeightList.cbegin(), expectedWeightList.cend(), qsizetype(0)) };
+    for (const SamplingMethod samplingMethod : { SamplingMethod::None, SamplingMethod::Uniform, SamplingMethod::Stratified, SamplingMethod::Reservoir }) {
+        UserOptions options{};
+        options.k = expectedColorList.size();
+        options.samplingMethod = samplingMethod;
+        options.sampleBudget = 10;
+        PixelData pixelData{};
+        QVERIFY(extractPixels(pixelData, image, options));
+        QCOMPARE(pixelData.imagePixelCount, qsizetype(100));
+        QVERIFY(!pixelData.isSampled);
+        QCOMPARE(pixelData.weightList, expectedWeightList);
+        QCOMPARE(pixelData.pixelList.size(), expectedColorList.size());
+        for (qsizetype index{ 0 }; index < expectedColorList.size(); ++index) {
+            const Pixel& pixel{ pixelData.pixelList[index] };
+            QCOMPARE(qRgb(pixel.r, pixel.g, pixel.b), expectedColorList[index]);
+        }
+        // The smallest cluster first, none of the weights are the same.
+        ColorItemList result{};
+        QVERIFY(extractColorsFromImage(result, image, options));
+        QCOMPARE(result.size(), expectedColorList.size());
+        QList<qsizetype> orderList(expectedColorList.size());
+        std::iota(orderList.begin(), orderList.end(), qsizetype(0));
+        std::sort(orderList.begin(), orderList.end(), [&expectedWeightList](const qsizetype lhs, const qsizetype rhs){ return expectedWeightList[lhs] < expectedWeightList[rhs]; });
+        for (qsizetype index{ 0 }; index < result.size(); ++index) {
+            const qsizetype expectedIndex{ orderList[index] };
+            const qreal expectedRatio{ qreal(expectedWeightList[expectedIndex]) / qreal(totalWeight) };
+            QCOMPARE(result[index].color.rgba(), expectedColorList[expectedIndex]);
+            QCOMPARE(result[index].ratio, expectedRatio);
+            QCOMPARE(result[index].ratioLowerBound, expectedRatio);
+            QCOMPARE(result[index].ratioUpperBound, expectedRatio);
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(ColorAnalyzerTest)
+
+#include "tst_coloranalyzer.moc"
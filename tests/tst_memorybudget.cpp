@@ -0,0 +1,233 @@
+#include "coloranalyzer.h"
+#include "shardedclustering.h"
+#include <QBuffer>
+#include <QDebug>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QProcess>
+#include <QRegularExpression>
+#include <QTemporaryDir>
+#include <QTest>
+#include <array>
+
+using namespace Qt::StringLiterals;
+
+Q_DECLARE_METATYPE(MemoryStrategy)
+
+static constexpr const qint64 s_mebibyte{ 1048576 };
+
+// What the process may use on top of the budget: the compressed file contents, the decoder's own buffers,
+// the allocator's bookkeeping and the pages it doesn't give back right away. None of this is part of the
+// estimate, which only covers the analysis itself.
+static constexpr const qint64 s_peakMemorySlack{ 16 * s_mebibyte };
+
+// Large blocks of a few colors: nothing to see for k-means, but the files stay small, so that reading them
+// hardly counts towards the peak memory usage.
+[[nodiscard]] static inline QImage blockImage(const int width, const int height) {
+    static constexpr const std::array<QRgb, 5> colorArray{ 0xFFC0392B, 0xFF27AE60, 0xFF2980B9, 0xFFF1C40F, 0xFF8E44AD };
+    QImage image(width, height, QImage::Format_RGB32);
+    for (int y{ 0 }; y < height; ++y) {
+        const auto line{ reinterpret_cast<QRgb*>(image.scanLine(y)) };
+        for (int x{ 0 }; x < width; ++x) {
+            line[x] = colorArray[std::size_t((x * 8 / width + y * 8 / height) % int(colorArray.size()))];
+        }
+    }
+    return image;
+}
+
+[[nodiscard]] static inline QByteArray encodeImage(const QImage& image, const QByteArray& format) {
+    QByteArray data{};
+    QBuffer buffer(&data);
+    buffer.open(QBuffer::WriteOnly);
+    QImageWriter writer(&buffer, format);
+    if (!writer.write(image)) {
+        qWarning().noquote() << "Cannot encode the test image:" << writer.errorString();
+        return {};
+    }
+    return data;
+}
+
+[[nodiscard]] static inline bool canEncode(const QByteArray& format) {
+    return QImageReader::supportedImageFormats().contains(format) && QImageWriter::supportedImageFormats().contains(format);
+}
+
+class MemoryBudgetTest final : public QObject {
+    Q_OBJECT
+
+private Q_SLOTS:
+    void strategySelection_data();
+    void strategySelection();
+    void refusal_data();
+    void refusal();
+    void peakMemoryUsage_data();
+    void peakMemoryUsage();
+};
+
+void MemoryBudgetTest::strategySelection_data() {
+    QTest::addColumn<QByteArray>("format");
+    QTest::addColumn<QSize>("imageSize");
+    QTest::addColumn<int>("maxSize");
+    QTest::addColumn<qint64>("budget");
+    QTest::addColumn<bool>("allowTiling");
+    QTest::addColumn<MemoryStrategy>("expectedStrategy");
+    // The JPEG decoder scales natively, 12 MiB of pixels never exist.
+    QTest::newRow("decoder downscale") << QByteArray("jpeg") << QSize(2048, 1536) << 100 << s_mebibyte << true << MemoryStrategy::DecoderDownscale;
+    // Analyzed at full size: the decoded image (4 MiB) fits, all its pixels at once (another 11 MiB) don't.
+    QTest::newRow("tiling") << QByteArray("png") << QSize(1024, 1024) << 0 << 6 * s_mebibyte << true << MemoryStrategy::Tiling;
+    QTest::newRow("sampling") << QByteArray("png") << QSize(1024, 1024) << 0 << 6 * s_mebibyte << false << MemoryStrategy::Sampling;
+    // Fits as it is.
+    QTest::newRow("full") << QByteArray("png") << QSize(1024, 1024) << 100 << 6 * s_mebibyte << true << MemoryStrategy::Full;
+}
+
+void MemoryBudgetTest::strategySelection() {
+    QFETCH(QByteArray, format);
+    QFETCH(QSize, imageSize);
+    QFETCH(int, maxSize);
+    QFETCH(qint64, budget);
+    QFETCH(bool, allowTiling);
+    QFETCH(MemoryStrategy, expectedStrategy);
+    if (!canEncode(format)) {
+        QSKIP("The image format plugin is not available.");
+    }
+    QByteArray data{ encodeImage(blockImage(imageSize.width(), imageSize.height()), format) };
+    QVERIFY(!data.isEmpty());
+    QBuffer buffer(&data);
+    QVERIFY(buffer.open(QBuffer::ReadOnly));
+    QImageReader reader(&buffer, format);
+    UserOptions options{};
+    options.maxWidth = maxSize;
+    options.maxHeight = maxSize;
+    options.memoryBudget = budget;
+    MemoryPlan plan{};
+    QString errorMessage{};
+    QVERIFY2(applyMemoryBudget(reader, options, plan, allowTiling, &errorMessage), qPrintable(errorMessage));
+    QCOMPARE(plan.strategy, expectedStrategy);
+    QVERIFY2(plan.estimatedBytes > 0 && plan.estimatedBytes <= budget, qPrintable(QString::number(plan.estimatedBytes)));
+    switch (expectedStrategy) {
+    case MemoryStrategy::Full:
+        QCOMPARE(options.samplingMethod, SamplingMethod::None);
+        break;
+    case MemoryStrategy::DecoderDownscale:
+        QCOMPARE(plan.decodeSize, QSize(100, 100)); // Exactly what "prepareImage()" would have shrinked to.
+        break;
+    case MemoryStrategy::Tiling:
+        QVERIFY(plan.tileHeight > 0 && plan.tileHeight < imageSize.height());
+        break;
+    case MemoryStrategy::Sampling:
+        QVERIFY(options.samplingMethod != SamplingMethod::None);
+        QVERIFY(options.sampleBudget > 0 && options.sampleBudget < qsizetype(imageSize.width()) * qsizetype(imageSize.height()));
+        break;
+    }
+    // Carry the plan out: the decoder honours it, and the buffers of the analysis stay within the budget.
+    const QImage image{ reader.read() };
+    QVERIFY2(!image.isNull(), qPrintable(reader.errorString()));
+    QCOMPARE(image.size(), plan.decodeSize);
+    AnalysisWorkspace workspace{};
+    ColorItemList colorList{};
+    if (plan.strategy == MemoryStrategy::Tiling) {
+        QVERIFY(clusterImageInTiles(colorList, prepareImage(image, options), options, plan.tileHeight, &workspace));
+    } else {
+        QVERIFY(clusterImage(colorList, prepareImage(image, options), options, &workspace));
+    }
+    QVERIFY(!colorList.isEmpty());
+    QVERIFY2(workspace.memoryUsage() <= budget, qPrintable(QString::number(workspace.memoryUsage())));
+}
+
+void MemoryBudgetTest::refusal_data() {
+    QTest::addColumn<QByteArray>("format");
+    QTest::addColumn<int>("maxSize");
+    // Not even the smallest image the budget would allow to decode is large enough to be worth analyzing.
+    QTest::newRow("jpeg") << QByteArray("jpeg") << 100;
+    QTest::newRow("png") << QByteArray("png") << 0;
+}
+
+void MemoryBudgetTest::refusal() {
+    QFETCH(QByteArray, format);
+    QFETCH(int, maxSize);
+    if (!canEncode(format)) {
+        QSKIP("The image format plugin is not available.");
+    }
+    QByteArray data{ encodeImage(blockImage(1024, 768), format) };
+    QVERIFY(!data.isEmpty());
+    QBuffer buffer(&data);
+    QVERIFY(buffer.open(QBuffer::ReadOnly));
+    QImageReader reader(&buffer, format);
+    UserOptions options{};
+    options.maxWidth = maxSize;
+    options.maxHeight = maxSize;
+    options.memoryBudget = 8192; // Far below the decoded size, whatever strategy.
+    MemoryPlan plan{};
+    QString errorMessage{};
+    QVERIFY(!applyMemoryBudget(reader, options, plan, true, &errorMessage));
+    QVERIFY(errorMessage.contains(u"exceeds the memory budget"_s));
+}
+
+void MemoryBudgetTest::peakMemoryUsage_data() {
+    QTest::addColumn<QByteArray>("format");
+    QTest::addColumn<QStringList>("argumentList");
+    QTest::addColumn<int>("budget"); // MiB
+    // 3072x3072 pixels are 36 MiB decoded, and about 100 MiB more when all of them are clustered at once.
+    QTest::newRow("decoder downscale") << QByteArray("jpeg") << QStringList{} << 8;
+    QTest::newRow("tiling") << QByteArray("png") << QStringList{ u"--max-width"_s, u"0"_s, u"--max-height"_s, u"0"_s } << 48;
+    QTest::newRow("sampling") << QByteArray("png")
+                              << QStringList{ u"--max-width"_s, u"0"_s, u"--max-height"_s, u"0"_s, u"--sampling"_s, u"stratified"_s, u"--sample-budget"_s, u"100000000"_s }
+                              << 48;
+}
+
+// The whole process, measured by the operating system: compared to analyzing a tiny image with the same
+// options, analyzing a large one may only cost the budget (and some slack) more.
+void MemoryBudgetTest::peakMemoryUsage() {
+    QFETCH(QByteArray, format);
+    QFETCH(QStringList, argumentList);
+    QFETCH(int, budget);
+    if (!canEncode(format)) {
+        QSKIP("The image format plugin is not available.");
+    }
+    QTemporaryDir directory{};
+    QVERIFY(directory.isValid());
+    const auto& writeImage{ [&directory, &format](const QString& fileName, const int size){
+        const QString filePath{ directory.filePath(fileName + u'.' + QString::fromLatin1(format)) };
+        QImageWriter writer(filePath, format);
+        return writer.write(blockImage(size, size)) ? filePath : QString{};
+    } };
+    const QString smallFilePath{ writeImage(u"small"_s, 16) };
+    const QString largeFilePath{ writeImage(u"large"_s, 3072) };
+    QVERIFY(!smallFilePath.isEmpty());
+    QVERIFY(!largeFilePath.isEmpty());
+    const auto& measure{ [&argumentList, budget](const QString& filePath, qint64& peakBytesOut){
+        peakBytesOut = -1;
+        QProcess process{};
+        process.start(QString::fromUtf8(IMAGE_COLOR_ANALYZER_EXECUTABLE), QStringList{ u"--measure-memory"_s, u"--memory-budget"_s, QString::number(budget), u"--max-iterations"_s, u"5"_s }
+                                                                              + argumentList + QStringList{ filePath });
+        QVERIFY2(process.waitForFinished(120000), qPrintable(process.errorString()));
+        const QString errorOutput{ QString::fromLocal8Bit(process.readAllStandardError()) };
+        QVERIFY2(process.exitStatus() == QProcess::NormalExit && process.exitCode() == 0, qPrintable(errorOutput));
+        if (errorOutput.contains(u"unknown on this platform"_s)) {
+            return;
+        }
+        static const QRegularExpression pattern{ u"Peak resident set size: (\\d+) KiB"_s };
+        const QRegularExpressionMatch match{ pattern.match(errorOutput) };
+        QVERIFY2(match.hasMatch(), qPrintable(errorOutput));
+        peakBytesOut = match.captured(1).toLongLong() * 1024;
+    } };
+    qint64 baselineBytes{ -1 };
+    measure(smallFilePath, baselineBytes);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    if (baselineBytes < 0) {
+        QSKIP("The peak memory usage can't be measured on this platform.");
+    }
+    qint64 peakBytes{ -1 };
+    measure(largeFilePath, peakBytes);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    const qint64 growthBytes{ peakBytes - baselineBytes };
+    QVERIFY2(growthBytes <= qint64(budget) * s_mebibyte + s_peakMemorySlack,
+             qPrintable(u"%1 MiB more than the baseline, the budget is %2 MiB."_s.arg(QString::number(growthBytes / s_mebibyte), QString::number(budget))));
+}
+
+QTEST_GUILESS_MAIN(MemoryBudgetTest)
+
+#include "tst_memorybudget.moc"
@@ -0,0 +1,131 @@
+#include "piechart.h"
+#include <QImage>
+#include <QPainter>
+#include <QSvgRenderer>
+#include <QTest>
+#include <QXmlStreamReader>
+#include <QtMath>
+#include <array>
+
+using namespace Qt::StringLiterals;
+
+// The logical width and height of the charts below.
+static constexpr const int s_canvasSize{ 300 };
+
+struct Slice final {
+    QColor color{};
+    qreal ratio{ 0 };
+    qreal middleAngle{ 0 }; // Degrees, counter-clockwise from +x, the first slice starts at 90.
+};
+
+// The last slice is the most dominant one, the only one with a (thick) outline.
+static const std::array<Slice, 3> s_sliceArray{ {
+    { QColorConstants::Blue, 0.2, 90 + 36 },
+    { QColorConstants::Green, 0.3, 162 + 54 },
+    { QColorConstants::Red, 0.5, 270 + 90 }
+} };
+
+[[nodiscard]] static inline PieChart makeChart() {
+    PieChart chart{};
+    for (auto&& slice : s_sliceArray) {
+        chart.colorList.append(ColorItem{ slice.color, slice.ratio, slice.ratio, slice.ratio });
+    }
+    // Keeps the labels (drawn at 70% of the radius) tiny, so that they can't cover the points checked below.
+    chart.font.setPixelSize(4);
+    return chart;
+}
+
+// The physical pixel at "radius" from the pie center, in the direction of "angle" (degrees).
+[[nodiscard]] static inline QPoint piePoint(const qreal angle, const qreal radius, const qreal scale) {
+    const QPointF center{ pieChartPieRect(QRectF{ 0, 0, s_canvasSize, s_canvasSize }).center() };
+    const QPointF point{ center.x() + radius * qCos(qDegreesToRadians(angle)), center.y() - radius * qSin(qDegreesToRadians(angle)) };
+    return (point * scale).toPoint();
+}
+
+[[nodiscard]] static inline qsizetype opaquePixelCount(const QImage& image) {
+    qsizetype count{ 0 };
+    for (int y{ 0 }; y < image.height(); ++y) {
+        for (int x{ 0 }; x < image.width(); ++x) {
+            if (qAlpha(image.pixel(x, y)) > 0) {
+                ++count;
+            }
+        }
+    }
+    return count;
+}
+
+// Every slice is found in its place, and there is nothing around the pie.
+static inline void checkLayout(const QImage& image, const qreal scale) {
+    const qreal radius{ pieChartPieRect(QRectF{ 0, 0, s_canvasSize, s_canvasSize }).width() / qreal(2) };
+    for (auto&& slice : s_sliceArray) {
+        const QPoint point{ piePoint(slice.middleAngle, radius * qreal(0.35), scale) };
+        QCOMPARE(QColor::fromRgba(image.pixel(point)), slice.color);
+    }
+    QCOMPARE(qAlpha(image.pixel(piePoint(45, radius * qreal(1.2), scale))), 0);
+    QCOMPARE(qAlpha(image.pixel(0, 0)), 0);
+    QCOMPARE(qAlpha(image.pixel(image.width() - 1, image.height() - 1)), 0);
+}
+
+class PieChartTest final : public QObject {
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void sameLayoutAtAnyScale();
+    void svgIsValid();
+};
+
+void PieChartTest::initTestCase() {
+    ensureEmbeddedFontsRegistered();
+}
+
+void PieChartTest::sameLayoutAtAnyScale() {
+    const PieChart chart{ makeChart() };
+    const QSize size{ s_canvasSize, s_canvasSize };
+    const QImage image1x{ renderPieChartImage(chart, size, 1) };
+    const QImage image2x{ renderPieChartImage(chart, size, 2) };
+    QCOMPARE(image1x.size(), size);
+    QCOMPARE(image2x.size(), size * 2);
+    QCOMPARE(image2x.devicePixelRatio(), qreal(2));
+    checkLayout(image1x, 1);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    checkLayout(image2x, 2);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    // The pie covers the same share of the canvas, only the anti-aliased edges may differ a little.
+    const qreal coverage1x{ qreal(opaquePixelCount(image1x)) / qreal(image1x.width() * image1x.height()) };
+    const qreal coverage2x{ qreal(opaquePixelCount(image2x)) / qreal(image2x.width() * image2x.height()) };
+    QVERIFY2(qAbs(coverage1x - coverage2x) < 0.01, qPrintable(QString::number(coverage1x) + u" vs "_s + QString::number(coverage2x)));
+}
+
+void PieChartTest::svgIsValid() {
+    const PieChart chart{ makeChart() };
+    const QSize size{ s_canvasSize, s_canvasSize };
+    const QByteArray data{ renderPieChartSvg(chart, size, 2) };
+    QVERIFY(!data.isEmpty());
+    // Well formed XML...
+    QXmlStreamReader reader(data);
+    while (!reader.atEnd()) {
+        reader.readNext();
+    }
+    QVERIFY2(!reader.hasError(), qPrintable(reader.errorString()));
+    // ... and a valid SVG document, of the nominal size, with the same picture as the raster chart.
+    QSvgRenderer renderer(data);
+    QVERIFY(renderer.isValid());
+    QCOMPARE(renderer.defaultSize(), size * 2);
+    QCOMPARE(renderer.viewBox(), QRect(QPoint{ 0, 0 }, size));
+    QImage image{ size, QImage::Format_ARGB32_Premultiplied };
+    image.fill(Qt::transparent);
+    {
+        QPainter painter(&image);
+        renderer.render(&painter);
+    }
+    checkLayout(image, 1);
+}
+
+QTEST_MAIN(PieChartTest)
+
+#include "tst_piechart.moc"
@@ -0,0 +1,376 @@
+#include "shardedclustering.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QTest>
+#include <QThread>
+#include <algorithm>
+#include <array>
+#include <random>
+#include <utility>
+
+using namespace Qt::StringLiterals;
+
+// Random pixels from a fixed seed, around a few colors so that k-means has something to find.
+[[nodiscard]] static inline PixelData randomPixelData(const qsizetype pixelCount) {
+    std::mt19937 engine(20240601);
+    std::uniform_int_distribution<int> channelDist(0, 255);
+    std::normal_distribution<qreal> noiseDist(0, 20);
+    std::array<Pixel, 6> centerArray{};
+    for (auto&& center : centerArray) {
+        const int r{ channelDist(engine) };
+        const int g{ channelDist(engine) };
+        const int b{ channelDist(engine) };
+        center = Pixel{ static_cast<quint8>(r), static_cast<quint8>(g), static_cast<quint8>(b) };
+    }
+    const auto& jitter{ [&engine, &noiseDist](const quint8 channel){
+        return static_cast<quint8>(std::clamp(qRound(qreal(channel) + noiseDist(engine)), 0, 255));
+    } };
+    PixelData pixelData{};
+    for (qsizetype index{ 0 }; index < pixelCount; ++index) {
+        const Pixel center{ centerArray[std::size_t(index) % centerArray.size()] };
+        const quint8 r{ jitter(center.r) };
+        const quint8 g{ jitter(center.g) };
+        const quint8 b{ jitter(center.b) };
+        pixelData.pixelList.push_back(Pixel{ r, g, b });
+    }
+    pixelData.imagePixelCount = pixelCount;
+    return pixelData;
+}
+
+// Pixels [begin, end) of "pixelData".
+[[nodiscard]] static inline PixelData slicePixelData(const PixelData& pixelData, const qsizetype begin, const qsizetype end) {
+    PixelData slice{};
+    slice.pixelList = pixelData.pixelList.mid(begin, end - begin);
+    slice.imagePixelCount = slice.pixelList.size();
+    return slice;
+}
+
+[[nodiscard]] static inline ShardStatistics accumulateShard(const PixelData& pixelData, const QList<Pixel>& centroidList) {
+    ShardStatistics statistics{};
+    statistics.pixelCount = pixelData.totalWeight();
+    if (pixelData.pixelList.isEmpty()) {
+        statistics.clusterList.fill(ClusterAccumulator{}, centroidList.size());
+    } else {
+        const bool ok{ accumulateClusters(statistics.clusterList, pixelData, centroidList) };
+        Q_ASSERT(ok);
+        Q_UNUSED(ok);
+    }
+    return statistics;
+}
+
+static inline void compareStatistics(const ShardStatistics& actual, const ShardStatistics& expected) {
+    QCOMPARE(actual.pixelCount, expected.pixelCount);
+    QCOMPARE(actual.clusterList.size(), expected.clusterList.size());
+    for (qsizetype index{ 0 }; index < actual.clusterList.size(); ++index) {
+        const ClusterAccumulator& lhs{ actual.clusterList[index] };
+        const ClusterAccumulator& rhs{ expected.clusterList[index] };
+        QCOMPARE(lhs.r, rhs.r);
+        QCOMPARE(lhs.g, rhs.g);
+        QCOMPARE(lhs.b, rhs.b);
+        QCOMPARE(lhs.count, rhs.count);
+        QCOMPARE(lhs.inertia, rhs.inertia);
+        QCOMPARE(lhs.farthestDistance, rhs.farthestDistance);
+        QVERIFY(lhs.farthestPixel == rhs.farthestPixel);
+    }
+}
+
+// The shards of a pixel list, all in memory, collected on the calling thread.
+class MemoryShardTransport final : public ShardTransport {
+public:
+    explicit MemoryShardTransport(const PixelData& pixelData, const qsizetype shardCount) {
+        for (qsizetype shardIndex{ 0 }; shardIndex < shardCount; ++shardIndex) {
+            const qsizetype begin{ shardIndex * pixelData.pixelList.size() / shardCount };
+            const qsizetype end{ (shardIndex + 1) * pixelData.pixelList.size() / shardCount };
+            m_shardList.push_back(slicePixelData(pixelData, begin, end));
+        }
+    }
+
+    ~MemoryShardTransport() override = default;
+
+    [[nodiscard]] qsizetype shardCount() const override {
+        return m_shardList.size();
+    }
+
+    [[nodiscard]] bool broadcast(const QList<Pixel>& centroidList) override {
+        m_centroidList = centroidList;
+        return true;
+    }
+
+    [[nodiscard]] bool collect(const qsizetype shardIndex, ShardStatistics& statisticsOut) override {
+        // Through the wire format, like a real shard.
+        return ShardStatistics::deserialize(accumulateShard(m_shardList[shardIndex], m_centroidList).serialize(), statisticsOut);
+    }
+
+private:
+    QList<PixelData> m_shardList{};
+    QList<Pixel> m_centroidList{};
+};
+
+// The "Shard iteration" spans of a shard worker's trace, by iteration, in microseconds on the machine's monotonic clock.
+static inline void readShardIterations(const QString& filePath, QMap<qint64, std::pair<qreal, qreal>>& iterationMapOut) {
+    QFile file(filePath);
+    QVERIFY2(file.open(QFile::ReadOnly), qPrintable(filePath));
+    QJsonParseError error{};
+    const QJsonDocument document{ QJsonDocument::fromJson(file.readAll(), &error) };
+    QVERIFY2(error.error == QJsonParseError::NoError, qPrintable(error.errorString()));
+    const QJsonObject rootObject{ document.object() };
+    QVERIFY(rootObject.value(u"otherData"_s).toObject().value(u"startTime"_s).isDouble());
+    const qreal startTime{ rootObject.value(u"otherData"_s).toObject().value(u"startTime"_s).toDouble() };
+    for (auto&& value : rootObject.value(u"traceEvents"_s).toArray()) {
+        const QJsonObject object{ value.toObject() };
+        if (object.value(u"name"_s).toString() != u"Shard iteration"_s) {
+            continue;
+        }
+        const qreal start{ startTime + object.value(u"ts"_s).toDouble() };
+        const qreal end{ start + object.value(u"dur"_s).toDouble() };
+        iterationMapOut.insert(object.value(u"args"_s).toObject().value(u"value"_s).toInteger(), std::make_pair(start, end));
+    }
+}
+
+class ShardedClusteringTest final : public QObject {
+    Q_OBJECT
+
+private Q_SLOTS:
+    void statisticsRoundTrip();
+    void invalidStatistics();
+    void centroidsRoundTrip();
+    void mergeIsOrderIndependent();
+    void coordinatorMatchesClusterPixels_data();
+    void coordinatorMatchesClusterPixels();
+    void processShards_data();
+    void processShards();
+    void unsupportedOptions_data();
+    void unsupportedOptions();
+    void workersRunConcurrently();
+};
+
+void ShardedClusteringTest::statisticsRoundTrip() {
+    const PixelData pixelData{ randomPixelData(10000) };
+    const QList<Pixel> centroidList{ pixelData.pixelList.mid(0, 5) };
+    const ShardStatistics statistics{ accumulateShard(pixelData, centroidList) };
+    ShardStatistics roundTripped{};
+    QVERIFY(ShardStatistics::deserialize(statistics.serialize(), roundTripped));
+    compareStatistics(roundTripped, statistics);
+    // Including the statistics of an empty shard.
+    const ShardStatistics emptyStatistics{ accumulateShard(PixelData{}, centroidList) };
+    QVERIFY(ShardStatistics::deserialize(emptyStatistics.serialize(), roundTripped));
+    compareStatistics(roundTripped, emptyStatistics);
+}
+
+void ShardedClusteringTest::invalidStatistics() {
+    const PixelData pixelData{ randomPixelData(1000) };
+    const QByteArray data{ accumulateShard(pixelData, pixelData.pixelList.mid(0, 5)).serialize() };
+    ShardStatistics statistics{};
+    QTest::ignoreMessage(QtWarningMsg, "Truncated shard statistics.");
+    QVERIFY(!ShardStatistics::deserialize(data.left(data.size() - 1), statistics));
+    QTest::ignoreMessage(QtWarningMsg, "Invalid shard statistics.");
+    QVERIFY(!ShardStatistics::deserialize(serializeCentroids(pixelData.pixelList.mid(0, 5)), statistics));
+}
+
+void ShardedClusteringTest::centroidsRoundTrip() {
+    const QList<Pixel> centroidList{ randomPixelData(16).pixelList };
+    QList<Pixel> roundTripped{};
+    QVERIFY(deserializeCentroids(serializeCentroids(centroidList), roundTripped));
+    QVERIFY(roundTripped == centroidList);
+}
+
+// The statistics of the parts, merged in every possible order, are those of all the pixels at once.
+void ShardedClusteringTest::mergeIsOrderIndependent() {
+    const PixelData pixelData{ randomPixelData(20000) };
+    const QList<Pixel> centroidList{ pixelData.pixelList.mid(0, 6) };
+    const ShardStatistics expected{ accumulateShard(pixelData, centroidList) };
+    // Uneven parts, one of them empty.
+    const std::array<qsizetype, 5> boundaryArray{ 0, 1234, 1234, 15000, pixelData.pixelList.size() };
+    QList<ShardStatistics> partList{};
+    for (std::size_t index{ 0 }; index + 1 < boundaryArray.size(); ++index) {
+        partList.push_back(accumulateShard(slicePixelData(pixelData, boundaryArray[index], boundaryArray[index + 1]), centroidList));
+    }
+    std::array<qsizetype, 4> orderArray{ 0, 1, 2, 3 };
+    do {
+        ShardStatistics merged{};
+        for (const qsizetype partIndex : orderArray) {
+            merged.merge(partList[partIndex]);
+        }
+        compareStatistics(merged, expected);
+    } while (std::next_permutation(orderArray.begin(), orderArray.end()));
+}
+
+void ShardedClusteringTest::coordinatorMatchesClusterPixels_data() {
+    QTest::addColumn<qsizetype>("shardCount");
+    for (const qsizetype shardCount : { 1, 2, 3, 4, 7 }) {
+        QTest::addRow("%d shards", int(shardCount)) << shardCount;
+    }
+}
+
+// "ShardCoordinator" gives exactly the same result as "clusterPixels()" from the same initial centroids.
+void ShardedClusteringTest::coordinatorMatchesClusterPixels() {
+    QFETCH(qsizetype, shardCount);
+    const PixelData pixelData{ randomPixelData(30000) };
+    UserOptions options{};
+    options.k = 6;
+    options.maxIterations = 100;
+    const QList<Pixel> initialCentroidList{ pixelData.pixelList.mid(0, options.k) };
+    ColorItemList warmStartList{};
+    for (const Pixel centroid : initialCentroidList) {
+        warmStartList.push_back(ColorItem{ QColor::fromRgb(centroid.r, centroid.g, centroid.b) });
+    }
+    ColorItemList expectedResult{};
+    QVERIFY(clusterPixels(expectedResult, pixelData, options, nullptr, warmStartList));
+    MemoryShardTransport transport(pixelData, shardCount);
+    ShardCoordinator coordinator(transport, options);
+    ColorItemList result{};
+    QVERIFY(coordinator.run(result, initialCentroidList));
+    QCOMPARE(result.size(), expectedResult.size());
+    for (qsizetype index{ 0 }; index < result.size(); ++index) {
+        QCOMPARE(result[index].color, expectedResult[index].color);
+        QCOMPARE(result[index].ratio, expectedResult[index].ratio);
+    }
+}
+
+void ShardedClusteringTest::processShards_data() {
+    QTest::addColumn<int>("shardCount");
+    QTest::addColumn<QStringList>("extraArgumentList");
+    for (const int shardCount : { 1, 2, 4 }) {
+        QTest::addRow("%d shards", shardCount) << shardCount << QStringList{};
+    }
+    // Part of the opaque half only, the columns and so the ratios are the same.
+    QTest::newRow("3 shards, region of interest") << 3 << QStringList{ u"--roi"_s, u"0,40,64,17"_s };
+}
+
+// The application itself, unsharded and with worker processes. The top half of the image is fully transparent,
+// so one (two) of the stripes of 2 (4) shards don't have any pixel at all. The bottom half has four colors of
+// different widths, with exact ratios of 12.5%, 18.75%, 31.25% and 37.5%.
+void ShardedClusteringTest::processShards() {
+    QFETCH(int, shardCount);
+    QFETCH(QStringList, extraArgumentList);
+    QTemporaryDir directory{};
+    QVERIFY(directory.isValid());
+    const QString filePath{ directory.filePath(u"stripes.png"_s) };
+    {
+        QImage image(64, 64, QImage::Format_ARGB32);
+        image.fill(Qt::transparent);
+        static constexpr const std::array<int, 4> columnEndArray{ 8, 20, 40, 64 };
+        static constexpr const std::array<QRgb, 4> colorArray{ 0xFFFF0000, 0xFF00FF00, 0xFF0000FF, 0xFFFFFF00 };
+        for (int y{ 32 }; y < image.height(); ++y) {
+            for (int x{ 0 }; x < image.width(); ++x) {
+                const auto columnIndex{ std::upper_bound(columnEndArray.cbegin(), columnEndArray.cend(), x) - columnEndArray.cbegin() };
+                image.setPixel(x, y, colorArray[std::size_t(columnIndex)]);
+            }
+        }
+        QVERIFY(image.save(filePath));
+    }
+    const auto& analyze{ [&filePath, &extraArgumentList](const QStringList& shardArgumentList, QByteArray& outputOut){
+        QProcess process{};
+        process.start(QString::fromUtf8(IMAGE_COLOR_ANALYZER_EXECUTABLE), QStringList{ u"-k"_s, u"4"_s, u"--max-width"_s, u"0"_s, u"--max-height"_s, u"0"_s }
+                                                                              + extraArgumentList + shardArgumentList + QStringList{ filePath });
+        QVERIFY2(process.waitForFinished(60000), qPrintable(process.errorString()));
+        QVERIFY2(process.exitStatus() == QProcess::NormalExit && process.exitCode() == 0, process.readAllStandardError().constData());
+        outputOut = process.readAllStandardOutput();
+    } };
+    QByteArray expectedOutput{};
+    analyze({}, expectedOutput);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    QVERIFY2(expectedOutput.contains("#FFFF00 37.50%\t#0000FF 31.25%\t#00FF00 18.75%\t#FF0000 12.50%"), expectedOutput.constData());
+    QByteArray output{};
+    analyze({ u"--shards"_s, QString::number(shardCount) }, output);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    QCOMPARE(output, expectedOutput);
+}
+
+void ShardedClusteringTest::unsupportedOptions_data() {
+    QTest::addColumn<QStringList>("argumentList");
+    QTest::newRow("charts") << QStringList{ u"--charts"_s, u"charts"_s };
+    QTest::newRow("memory budget") << QStringList{ u"--memory-budget"_s, u"64"_s };
+    QTest::newRow("sampling") << QStringList{ u"--sampling"_s, u"uniform"_s };
+    QTest::newRow("multi-resolution") << QStringList{ u"--multi-resolution"_s };
+}
+
+// Refused up front, instead of being silently ignored by the workers.
+void ShardedClusteringTest::unsupportedOptions() {
+    QFETCH(QStringList, argumentList);
+    QTemporaryDir directory{};
+    QVERIFY(directory.isValid());
+    const QString filePath{ directory.filePath(u"image.png"_s) };
+    {
+        QImage image(16, 16, QImage::Format_RGB32);
+        image.fill(Qt::red);
+        QVERIFY(image.save(filePath));
+    }
+    QProcess process{};
+    process.setWorkingDirectory(directory.path());
+    process.start(QString::fromUtf8(IMAGE_COLOR_ANALYZER_EXECUTABLE), QStringList{ u"--shards"_s, u"2"_s } + argumentList + QStringList{ filePath });
+    QVERIFY2(process.waitForFinished(60000), qPrintable(process.errorString()));
+    const QByteArray errorOutput{ process.readAllStandardError() };
+    QCOMPARE(process.exitStatus(), QProcess::NormalExit);
+    QVERIFY(process.exitCode() != 0);
+    QVERIFY2(errorOutput.contains("not supported together with --shards"), errorOutput.constData());
+    QVERIFY(process.readAllStandardOutput().isEmpty());
+    QVERIFY(!QFileInfo::exists(directory.filePath(u"charts"_s)));
+}
+
+// The workers get the centroids of each iteration at the same time, instead of each of them only once the previous
+// one has answered. Their traces are on the same clock, so the spans of the same iteration must overlap (almost)
+// entirely. Without an event loop, this breaks as soon as the coordinator stops flushing its writes itself.
+void ShardedClusteringTest::workersRunConcurrently() {
+    if (QThread::idealThreadCount() < 2) {
+        QSKIP("The workers can't run at the same time on a single CPU.");
+    }
+    QTemporaryDir directory{};
+    QVERIFY(directory.isValid());
+    const QString filePath{ directory.filePath(u"noise.png"_s) };
+    {
+        // Plenty of distinct colors, so that every iteration keeps each worker busy for several milliseconds.
+        QImage image(1024, 1024, QImage::Format_RGB32);
+        std::mt19937 engine(20240601);
+        std::uniform_int_distribution<quint32> colorDist(0, 0xFFFFFF);
+        for (int y{ 0 }; y < image.height(); ++y) {
+            const auto line{ reinterpret_cast<QRgb*>(image.scanLine(y)) };
+            for (int x{ 0 }; x < image.width(); ++x) {
+                line[x] = 0xFF000000 | colorDist(engine);
+            }
+        }
+        QVERIFY(image.save(filePath));
+    }
+    QProcess process{};
+    process.start(QString::fromUtf8(IMAGE_COLOR_ANALYZER_EXECUTABLE), QStringList{ u"-k"_s, u"8"_s, u"--max-width"_s, u"0"_s, u"--max-height"_s, u"0"_s, u"--max-iterations"_s, u"4"_s,
+                                                                                   u"--shards"_s, u"2"_s, u"--trace"_s, directory.filePath(u"trace.json"_s), filePath });
+    QVERIFY2(process.waitForFinished(120000), qPrintable(process.errorString()));
+    QVERIFY2(process.exitStatus() == QProcess::NormalExit && process.exitCode() == 0, process.readAllStandardError().constData());
+    QMap<qint64, std::pair<qreal, qreal>> iterationMap0{};
+    QMap<qint64, std::pair<qreal, qreal>> iterationMap1{};
+    readShardIterations(directory.filePath(u"trace-0-shard0.json"_s), iterationMap0);
+    readShardIterations(directory.filePath(u"trace-0-shard1.json"_s), iterationMap1);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    QVERIFY(!iterationMap0.isEmpty());
+    QCOMPARE(iterationMap1.keys(), iterationMap0.keys());
+    // One iteration is enough, a busy machine may well delay either worker now and then. One after the other,
+    // the spans could only overlap by the few microseconds it takes to hand the answer over.
+    QString spanText{};
+    for (auto it{ iterationMap0.cbegin() }; it != iterationMap0.cend(); ++it) {
+        const auto [start0, end0]{ it.value() };
+        const auto [start1, end1]{ iterationMap1.value(it.key()) };
+        const qreal overlap{ qMin(end0, end1) - qMax(start0, start1) };
+        if (overlap > qMin(end0 - start0, end1 - start1) / 2) {
+            return;
+        }
+        spanText += u"\n%1: [%2, %3] [%4, %5]"_s.arg(QString::number(it.key()), QString::number(start0, 'f', 0), QString::number(end0, 'f', 0),
+                                                       QString::number(start1, 'f', 0), QString::number(end1, 'f', 0));
+    }
+    QFAIL(qPrintable(u"The workers never ran at the same time:"_s + spanText));
+}
+
+QTEST_GUILESS_MAIN(ShardedClusteringTest)
+
+#include "tst_shardedclustering.moc"
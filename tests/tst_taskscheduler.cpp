@@ -0,0 +1,170 @@
+#include "taskscheduler.h"
+#include <QMutex>
+#include <QSemaphore>
+#include <QTest>
+
+using namespace Qt::StringLiterals;
+
+// Generous, the tasks below are trivial, but the machine running the tests may be very busy.
+static constexpr const int s_timeout{ 10000 };
+
+// Both helpers below are referenced by the queued tasks, so the tests declare them before the scheduler.
+
+// Keeps a worker busy until it's opened. Also gives up when the task is cancelled, so a failed test can't leave
+// the scheduler's destructor waiting forever.
+struct Gate final {
+    QSemaphore started{};
+    QSemaphore opened{};
+
+    [[nodiscard]] TaskScheduler::Task task() {
+        return [this](const CancellationToken& cancellationToken, AnalysisWorkspace&){
+            started.release();
+            while (!opened.tryAcquire(1, 10)) {
+                if (cancellationToken.isCancelled()) {
+                    return;
+                }
+            }
+        };
+    }
+};
+
+// The names of the tasks, in the order they've run.
+struct RunLog final {
+    QMutex mutex{};
+    QStringList nameList{};
+
+    [[nodiscard]] TaskScheduler::Task task(const QString& name) {
+        return [this, name](const CancellationToken&, AnalysisWorkspace&){
+            const QMutexLocker locker(&mutex);
+            nameList.append(name);
+        };
+    }
+
+    [[nodiscard]] QStringList names() {
+        const QMutexLocker locker(&mutex);
+        return nameList;
+    }
+};
+
+class TaskSchedulerTest final : public QObject {
+    Q_OBJECT
+
+private Q_SLOTS:
+    void priorityOrder();
+    void reservedInteractiveWorker();
+    void rejectNew();
+    void cancelLowest();
+    void cancelledTaskIsDropped();
+};
+
+void TaskSchedulerTest::priorityOrder() {
+    // A single worker, so nothing is reserved and the order is all down to the priorities.
+    Gate gate{};
+    RunLog log{};
+    TaskScheduler scheduler{ TaskSchedulerOptions{ 1, 16, RejectionPolicy::RejectNew } };
+    QVERIFY(scheduler.submit(TaskPriority::Interactive, CancellationToken::create(), gate.task()));
+    QVERIFY(gate.started.tryAcquire(1, s_timeout));
+    QVERIFY(scheduler.submit(TaskPriority::Background, {}, log.task(u"background1"_s)));
+    QVERIFY(scheduler.submit(TaskPriority::Batch, {}, log.task(u"batch1"_s)));
+    QVERIFY(scheduler.submit(TaskPriority::Interactive, {}, log.task(u"interactive1"_s)));
+    QVERIFY(scheduler.submit(TaskPriority::Background, {}, log.task(u"background2"_s)));
+    QVERIFY(scheduler.submit(TaskPriority::Batch, {}, log.task(u"batch2"_s)));
+    QVERIFY(scheduler.submit(TaskPriority::Interactive, {}, log.task(u"interactive2"_s)));
+    gate.opened.release();
+    scheduler.waitForDone();
+    // Most urgent first, first come first served within the same class.
+    QCOMPARE(log.names(), (QStringList{ u"interactive1"_s, u"interactive2"_s, u"batch1"_s, u"batch2"_s, u"background1"_s, u"background2"_s }));
+}
+
+void TaskSchedulerTest::reservedInteractiveWorker() {
+    Gate gate{};
+    QSemaphore interactiveDone{};
+    TaskScheduler scheduler{ TaskSchedulerOptions{ 2, 16, RejectionPolicy::RejectNew } };
+    QVERIFY(scheduler.submit(TaskPriority::Batch, CancellationToken::create(), gate.task()));
+    QVERIFY(scheduler.submit(TaskPriority::Background, CancellationToken::create(), gate.task()));
+    QVERIFY(gate.started.tryAcquire(1, s_timeout));
+    // The second worker is idle, yet it must not pick up the background task...
+    QVERIFY(scheduler.submit(TaskPriority::Interactive, {}, [&interactiveDone](const CancellationToken&, AnalysisWorkspace&){
+        interactiveDone.release();
+    }));
+    // ... because it's kept for this one, which runs although the first worker is still blocked.
+    QVERIFY(interactiveDone.tryAcquire(1, s_timeout));
+    QCOMPARE(gate.started.available(), 0);
+    // Once the batch task is done, it's the background task's turn.
+    gate.opened.release();
+    QVERIFY(gate.started.tryAcquire(1, s_timeout));
+    gate.opened.release();
+    scheduler.waitForDone();
+}
+
+void TaskSchedulerTest::rejectNew() {
+    Gate gate{};
+    RunLog log{};
+    TaskScheduler scheduler{ TaskSchedulerOptions{ 1, 2, RejectionPolicy::RejectNew } };
+    QVERIFY(scheduler.submit(TaskPriority::Batch, CancellationToken::create(), gate.task()));
+    QVERIFY(gate.started.tryAcquire(1, s_timeout));
+    QVERIFY(scheduler.submit(TaskPriority::Background, {}, log.task(u"background"_s)));
+    QVERIFY(scheduler.submit(TaskPriority::Batch, {}, log.task(u"batch"_s)));
+    // The queue is full, even the most urgent task is refused and nothing queued is touched.
+    const CancellationToken rejectedToken{ CancellationToken::create() };
+    QVERIFY(!scheduler.submit(TaskPriority::Interactive, rejectedToken, log.task(u"interactive"_s)));
+    QVERIFY(!rejectedToken.isCancelled());
+    gate.opened.release();
+    scheduler.waitForDone();
+    QCOMPARE(log.names(), (QStringList{ u"batch"_s, u"background"_s }));
+}
+
+void TaskSchedulerTest::cancelLowest() {
+    Gate gate{};
+    RunLog log{};
+    TaskScheduler scheduler{ TaskSchedulerOptions{ 1, 2, RejectionPolicy::CancelLowest } };
+    QVERIFY(scheduler.submit(TaskPriority::Interactive, CancellationToken::create(), gate.task()));
+    QVERIFY(gate.started.tryAcquire(1, s_timeout));
+    const CancellationToken backgroundToken{ CancellationToken::create() };
+    const CancellationToken batchToken1{ CancellationToken::create() };
+    QVERIFY(scheduler.submit(TaskPriority::Background, backgroundToken, log.task(u"background"_s)));
+    QVERIFY(scheduler.submit(TaskPriority::Batch, batchToken1, log.task(u"batch1"_s)));
+    // The least urgent queued task makes room for a more urgent one.
+    QVERIFY(scheduler.submit(TaskPriority::Interactive, {}, log.task(u"interactive"_s)));
+    QVERIFY(backgroundToken.isCancelled());
+    QVERIFY(!batchToken1.isCancelled());
+    // Now a batch task is the least urgent one queued: a less urgent task is refused...
+    const CancellationToken rejectedToken{ CancellationToken::create() };
+    QVERIFY(!scheduler.submit(TaskPriority::Background, rejectedToken, log.task(u"rejected"_s)));
+    QVERIFY(!rejectedToken.isCancelled());
+    QVERIFY(!batchToken1.isCancelled());
+    // ... while one of the same class replaces the oldest one.
+    QVERIFY(scheduler.submit(TaskPriority::Batch, {}, log.task(u"batch2"_s)));
+    QVERIFY(batchToken1.isCancelled());
+    gate.opened.release();
+    scheduler.waitForDone();
+    QCOMPARE(log.names(), (QStringList{ u"interactive"_s, u"batch2"_s }));
+}
+
+void TaskSchedulerTest::cancelledTaskIsDropped() {
+    Gate gate{};
+    RunLog log{};
+    TaskScheduler scheduler{ TaskSchedulerOptions{ 1, 16, RejectionPolicy::RejectNew } };
+    QVERIFY(scheduler.submit(TaskPriority::Interactive, CancellationToken::create(), gate.task()));
+    QVERIFY(gate.started.tryAcquire(1, s_timeout));
+    const CancellationToken cancelledToken{ CancellationToken::create() };
+    QVERIFY(scheduler.submit(TaskPriority::Interactive, cancelledToken, log.task(u"cancelled"_s)));
+    QVERIFY(scheduler.submit(TaskPriority::Batch, {}, log.task(u"batch"_s)));
+    cancelledToken.cancel();
+    gate.opened.release();
+    scheduler.waitForDone();
+    QCOMPARE(log.names(), QStringList{ u"batch"_s });
+    // Waiting must not hang when the only queued task has been cancelled instead of having run.
+    const CancellationToken lastToken{ CancellationToken::create() };
+    QVERIFY(scheduler.submit(TaskPriority::Interactive, CancellationToken::create(), gate.task()));
+    QVERIFY(gate.started.tryAcquire(1, s_timeout));
+    QVERIFY(scheduler.submit(TaskPriority::Background, lastToken, log.task(u"last"_s)));
+    lastToken.cancel();
+    gate.opened.release();
+    scheduler.waitForDone();
+    QCOMPARE(log.names(), QStringList{ u"batch"_s });
+}
+
+QTEST_GUILESS_MAIN(TaskSchedulerTest)
+
+#include "tst_taskscheduler.moc"
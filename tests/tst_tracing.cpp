@@ -0,0 +1,152 @@
+#include "tracing.h"
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QTest>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace Qt::StringLiterals;
+
+// Timestamps are written in microseconds with nanosecond precision, allow for the rounding.
+static constexpr const qreal s_epsilon{ 0.01 };
+
+struct Span final {
+    QString name{};
+    qreal start{ 0 };
+    qreal end{ 0 };
+};
+
+// One outer span with two inner ones after each other, plus one more inside the second.
+static inline void recordNestedSpans(const qint64 argument) {
+    const TraceSpan outer{ "Outer", argument };
+    {
+        const TraceSpan inner{ "Inner" };
+    }
+    {
+        const TraceSpan inner{ "Inner" };
+        const TraceSpan innermost{ "Innermost" };
+    }
+}
+
+class TracingTest final : public QObject {
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void threadBuffersAreReused();
+    void writtenTraceIsValid();
+
+private:
+    // Parses the trace file, the current test fails if it is malformed.
+    void readTrace(const QString& filePath, QHash<qint64, QList<Span>>& spanMap, QHash<qint64, QString>& threadNameMap);
+
+    QTemporaryDir m_directory{};
+};
+
+void TracingTest::initTestCase() {
+    QVERIFY(m_directory.isValid());
+    enableTracing();
+    QVERIFY(isTracingEnabled());
+}
+
+void TracingTest::threadBuffersAreReused() {
+    recordNestedSpans(0);
+    const qsizetype bufferCount{ traceBufferCount() };
+    // Threads that start one after the other take over the buffer of the previous one. std::thread, because
+    // "join()" returns only once the thread has really gone, including its thread local data.
+    for (qint64 index{ 1 }; index <= 16; ++index) {
+        std::thread thread([index](){ recordNestedSpans(index); });
+        thread.join();
+    }
+    QCOMPARE(traceBufferCount(), bufferCount + 1);
+    // Several threads at the same time need a buffer each, but no more than that.
+    std::vector<std::thread> threadList{};
+    for (qint64 index{ 17 }; index <= 20; ++index) {
+        threadList.emplace_back([index](){ recordNestedSpans(index); });
+    }
+    for (auto&& thread : threadList) {
+        thread.join();
+    }
+    QVERIFY(traceBufferCount() <= bufferCount + qsizetype(threadList.size()));
+}
+
+void TracingTest::writtenTraceIsValid() {
+    const QString filePath{ m_directory.filePath(u"trace.json"_s) };
+    QVERIFY(writeTrace(filePath));
+    QHash<qint64, QList<Span>> spanMap{};
+    QHash<qint64, QString> threadNameMap{};
+    readTrace(filePath, spanMap, threadNameMap);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    // The main thread and the 20 threads of the previous test, each with its own id although they have shared
+    // buffers, and all their spans are still there.
+    QCOMPARE(spanMap.size(), qsizetype(21));
+    for (auto it{ spanMap.begin() }; it != spanMap.end(); ++it) {
+        QVERIFY2(threadNameMap.contains(it.key()), qPrintable(u"Thread %1 has no name."_s.arg(it.key())));
+        QList<Span>& spanList{ it.value() };
+        QCOMPARE(spanList.size(), qsizetype(4));
+        // Within each thread, spans are either disjoint or one contains the other.
+        std::sort(spanList.begin(), spanList.end(), [](const Span& lhs, const Span& rhs){
+            return lhs.start < rhs.start || (lhs.start == rhs.start && lhs.end > rhs.end);
+        });
+        QList<Span> stack{};
+        for (auto&& span : std::as_const(spanList)) {
+            while (!stack.isEmpty() && stack.constLast().end <= span.start + s_epsilon) {
+                stack.removeLast();
+            }
+            if (!stack.isEmpty()) {
+                QVERIFY2(span.end <= stack.constLast().end + s_epsilon,
+                         qPrintable(u"%1 overlaps %2 on thread %3."_s.arg(span.name, stack.constLast().name).arg(it.key())));
+            }
+            stack.append(span);
+        }
+    }
+}
+
+void TracingTest::readTrace(const QString& filePath, QHash<qint64, QList<Span>>& spanMap, QHash<qint64, QString>& threadNameMap) {
+    QFile file(filePath);
+    QVERIFY(file.open(QFile::ReadOnly));
+    QJsonParseError error{};
+    const QJsonDocument document{ QJsonDocument::fromJson(file.readAll(), &error) };
+    QVERIFY2(error.error == QJsonParseError::NoError, qPrintable(error.errorString()));
+    QVERIFY(document.isObject());
+    const QJsonValue eventValue{ document.object().value(u"traceEvents"_s) };
+    QVERIFY(eventValue.isArray());
+    const QJsonArray eventArray{ eventValue.toArray() };
+    QVERIFY(!eventArray.isEmpty());
+    for (auto&& value : eventArray) {
+        QVERIFY(value.isObject());
+        const QJsonObject object{ value.toObject() };
+        QVERIFY(object.value(u"name"_s).isString());
+        QVERIFY(object.value(u"pid"_s).isDouble());
+        QVERIFY(object.value(u"tid"_s).isDouble());
+        const QString phase{ object.value(u"ph"_s).toString() };
+        const qint64 threadId{ object.value(u"tid"_s).toInteger() };
+        if (phase == u"M"_s) {
+            QCOMPARE(object.value(u"name"_s).toString(), u"thread_name"_s);
+            const QString threadName{ object.value(u"args"_s).toObject().value(u"name"_s).toString() };
+            QVERIFY(!threadName.isEmpty());
+            QVERIFY(!threadNameMap.contains(threadId));
+            threadNameMap.insert(threadId, threadName);
+            continue;
+        }
+        QCOMPARE(phase, u"X"_s);
+        QVERIFY(object.value(u"ts"_s).isDouble());
+        QVERIFY(object.value(u"dur"_s).isDouble());
+        const qreal start{ object.value(u"ts"_s).toDouble() };
+        const qreal duration{ object.value(u"dur"_s).toDouble() };
+        QVERIFY(start >= 0);
+        QVERIFY(duration >= 0);
+        spanMap[threadId].append(Span{ object.value(u"name"_s).toString(), start, start + duration });
+    }
+}
+
+QTEST_GUILESS_MAIN(TracingTest)
+
+#include "tst_tracing.moc"
@@ -0,0 +1,192 @@
+#include "tracing.h"
+#include <QCoreApplication>
+#include <QDeadlineTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QMutex>
+#include <QThread>
+#include <QDebug>
+#include <memory>
+#include <vector>
+
+using namespace Qt::StringLiterals;
+
+namespace {
+
+struct TraceEvent final {
+    const char* name{ nullptr };
+    qint64 argument{ -1 };
+    qint64 startTime{ 0 }; // Nanoseconds since tracing has been enabled.
+    qint64 duration{ 0 }; // Nanoseconds.
+    int threadId{ 0 }; // A buffer outlives its thread and is reused by later ones, so each span knows its own.
+};
+
+// 2.5 MiB per buffer, enough for several minutes of k-means iterations. Once full, the oldest spans are overwritten.
+static constexpr const qsizetype TRACE_BUFFER_CAPACITY{ 65536 };
+// Thread ids are never reused, so the names of the oldest threads are forgotten eventually. Their spans (if any
+// are left) show up under their bare ids then.
+static constexpr const qsizetype TRACE_THREAD_NAME_CAPACITY{ 4096 };
+
+struct ThreadTraceBuffer final {
+    QMutex mutex{}; // Only ever contended while the trace is being written.
+    std::vector<TraceEvent> eventList{};
+    quint64 writeCount{ 0 }; // Total number of spans recorded, "eventList" holds the last ones of them.
+};
+
+// Buffers are never freed: once its thread has finished, a buffer goes to "freeBufferList" and the next thread
+// that starts recording takes it over. There are therefore never more buffers than threads recording at the
+// same time, however many short-lived threads come and go.
+struct TraceRegistry final {
+    QMutex mutex{};
+    // Nanoseconds on the monotonic clock, which all the processes on the machine share, so that the traces of
+    // several of them (eg. the shard workers and their coordinator) can be lined up.
+    qint64 startTime{ 0 };
+    std::vector<std::shared_ptr<ThreadTraceBuffer>> bufferList{};
+    std::vector<std::shared_ptr<ThreadTraceBuffer>> freeBufferList{};
+    QMap<int, QString> threadNameMap{};
+    int lastThreadId{ 0 };
+};
+
+[[nodiscard]] TraceRegistry& traceRegistry() {
+    static TraceRegistry registry{};
+    return registry;
+}
+
+// The buffer of the current thread, handed back to the registry when the thread finishes.
+struct TraceBufferLease final {
+    std::shared_ptr<ThreadTraceBuffer> buffer{};
+    int threadId{ 0 };
+
+    ~TraceBufferLease() {
+        if (buffer) {
+            TraceRegistry& registry{ traceRegistry() };
+            const QMutexLocker locker(&registry.mutex);
+            registry.freeBufferList.push_back(std::move(buffer));
+        }
+    }
+};
+
+thread_local TraceBufferLease t_traceBufferLease{};
+
+[[nodiscard]] const TraceBufferLease& currentTraceBufferLease() {
+    if (Q_LIKELY(t_traceBufferLease.buffer)) {
+        return t_traceBufferLease;
+    }
+    const QThread* thread{ QThread::currentThread() };
+    QString threadName{ thread->objectName() };
+    if (threadName.isEmpty() && QCoreApplication::instance() && thread == QCoreApplication::instance()->thread()) {
+        threadName = u"MainThread"_s;
+    }
+    TraceRegistry& registry{ traceRegistry() };
+    const QMutexLocker locker(&registry.mutex);
+    if (registry.freeBufferList.empty()) {
+        auto buffer{ std::make_shared<ThreadTraceBuffer>() };
+        buffer->eventList.resize(TRACE_BUFFER_CAPACITY);
+        registry.bufferList.push_back(buffer);
+        t_traceBufferLease.buffer = std::move(buffer);
+    } else {
+        t_traceBufferLease.buffer = std::move(registry.freeBufferList.back());
+        registry.freeBufferList.pop_back();
+    }
+    t_traceBufferLease.threadId = ++registry.lastThreadId;
+    if (threadName.isEmpty()) {
+        threadName = u"Thread%1"_s.arg(t_traceBufferLease.threadId);
+    }
+    registry.threadNameMap.insert(t_traceBufferLease.threadId, threadName);
+    if (registry.threadNameMap.size() > TRACE_THREAD_NAME_CAPACITY) {
+        registry.threadNameMap.erase(registry.threadNameMap.begin());
+    }
+    return t_traceBufferLease;
+}
+
+} // namespace
+
+void enableTracing() {
+    TraceRegistry& registry{ traceRegistry() };
+    const QMutexLocker locker(&registry.mutex);
+    if (isTracingEnabled()) {
+        return;
+    }
+    registry.startTime = QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs();
+    // Released after the start time has been set, "traceTimestamp()" is only called once this is seen.
+    g_isTracingEnabled.store(true, std::memory_order_release);
+}
+
+qint64 traceTimestamp() {
+    return QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs() - traceRegistry().startTime;
+}
+
+void recordTraceSpan(const char* name, const qint64 argument, const qint64 startTime) {
+    Q_ASSERT(name);
+    const qint64 endTime{ traceTimestamp() };
+    const TraceBufferLease& lease{ currentTraceBufferLease() };
+    ThreadTraceBuffer& buffer{ *lease.buffer };
+    const QMutexLocker locker(&buffer.mutex);
+    buffer.eventList[buffer.writeCount % TRACE_BUFFER_CAPACITY] = TraceEvent{ name, argument, startTime, endTime - startTime, lease.threadId };
+    ++buffer.writeCount;
+}
+
+bool writeTrace(const QString& filePath) {
+    Q_ASSERT(!filePath.isEmpty());
+    if (!isTracingEnabled()) {
+        return false;
+    }
+    std::vector<std::shared_ptr<ThreadTraceBuffer>> bufferList{};
+    QMap<int, QString> threadNameMap{};
+    qint64 startTime{ 0 };
+    {
+        TraceRegistry& registry{ traceRegistry() };
+        const QMutexLocker locker(&registry.mutex);
+        bufferList = registry.bufferList;
+        threadNameMap = registry.threadNameMap;
+        startTime = registry.startTime;
+    }
+    const qint64 processId{ QCoreApplication::applicationPid() };
+    QJsonArray eventArray{};
+    // Lets the viewers show the thread names instead of bare numbers.
+    for (auto it{ threadNameMap.cbegin() }; it != threadNameMap.cend(); ++it) {
+        eventArray.append(QJsonObject{
+            { u"name"_s, u"thread_name"_s }, { u"ph"_s, u"M"_s }, { u"pid"_s, processId }, { u"tid"_s, it.key() },
+            { u"args"_s, QJsonObject{ { u"name"_s, it.value() } } }
+        });
+    }
+    quint64 overwrittenCount{ 0 };
+    for (auto&& buffer : std::as_const(bufferList)) {
+        const QMutexLocker locker(&buffer->mutex);
+        const quint64 count{ qMin(buffer->writeCount, quint64(TRACE_BUFFER_CAPACITY)) };
+        overwrittenCount += buffer->writeCount - count;
+        for (quint64 index{ buffer->writeCount - count }; index < buffer->writeCount; ++index) {
+            const TraceEvent& event{ buffer->eventList[index % TRACE_BUFFER_CAPACITY] };
+            // Complete ("X") events, the timestamps are in microseconds.
+            QJsonObject object{
+                { u"name"_s, QString::fromLatin1(event.name) }, { u"ph"_s, u"X"_s }, { u"pid"_s, processId }, { u"tid"_s, event.threadId },
+                { u"ts"_s, qreal(event.startTime) / qreal(1000) }, { u"dur"_s, qreal(event.duration) / qreal(1000) }
+            };
+            if (event.argument >= 0) {
+                object.insert(u"args"_s, QJsonObject{ { u"value"_s, event.argument } });
+            }
+            eventArray.append(object);
+        }
+    }
+    QFile file(filePath);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        qWarning().noquote() << "Cannot write the trace file:" << file.errorString();
+        return false;
+    }
+    // The viewers ignore "otherData", it's there to line this trace up with those of other processes.
+    const QJsonObject otherData{ { u"startTime"_s, qreal(startTime) / qreal(1000) } };
+    file.write(QJsonDocument(QJsonObject{ { u"traceEvents"_s, eventArray }, { u"displayTimeUnit"_s, u"ms"_s }, { u"otherData"_s, otherData } }).toJson(QJsonDocument::Compact));
+    // Tracing has been asked for explicitly, always output.
+    qInfo().noquote() << "Trace written to" << filePath << ':' << eventArray.size() << "event(s) from" << threadNameMap.size()
+                      << "thread(s)," << overwrittenCount << "span(s) overwritten.";
+    return true;
+}
+
+qsizetype traceBufferCount() {
+    TraceRegistry& registry{ traceRegistry() };
+    const QMutexLocker locker(&registry.mutex);
+    return qsizetype(registry.bufferList.size());
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <QtGlobal>
+#include <QString>
+#include <atomic>
+
+// A minimal tracer: scoped spans are recorded into per-thread ring buffers (reused once their thread has
+// finished) and exported as Chrome trace JSON, which can be opened with "chrome://tracing" or
+// https://ui.perfetto.dev. Off by default, a disabled span only costs one atomic load.
+
+inline std::atomic_bool g_isTracingEnabled{ false };
+
+[[nodiscard]] inline bool isTracingEnabled() {
+    return g_isTracingEnabled.load(std::memory_order_acquire);
+}
+
+// Starts recording, there is no way back. Call it early, spans which already began are not recorded.
+extern void enableTracing();
+
+// Writes everything recorded so far. Threads may keep recording meanwhile, but the spans they are in
+// the middle of are not part of the output. The timestamps are relative to "otherData.startTime", the
+// moment tracing was enabled on the machine's monotonic clock (microseconds).
+[[nodiscard]] extern bool writeTrace(const QString& filePath);
+
+// How many span buffers have been allocated so far. Finished threads hand theirs over to new ones, so this is
+// the most threads that have been recording at the same time.
+[[nodiscard]] extern qsizetype traceBufferCount();
+
+// Internal use only.
+[[nodiscard]] extern qint64 traceTimestamp();
+extern void recordTraceSpan(const char* name, const qint64 argument, const qint64 startTime);
+
+// Records the time between its construction and its destruction on the current thread. "name" is stored as-is,
+// it MUST be a string literal. "argument" (if not negative) shows up as the "value" of the span, eg. an iteration
+// index.
+class TraceSpan final {
+    Q_DISABLE_COPY_MOVE(TraceSpan)
+
+public:
+    explicit TraceSpan(const char* name, const qint64 argument = -1) {
+        if (Q_UNLIKELY(isTracingEnabled())) {
+            m_name = name;
+            m_argument = argument;
+            m_startTime = traceTimestamp();
+        }
+    }
+
+    ~TraceSpan() {
+        if (Q_UNLIKELY(m_name)) {
+            recordTraceSpan(m_name, m_argument, m_startTime);
+        }
+    }
+
+private:
+    const char* m_name{ nullptr }; // Null if tracing was disabled when the span began.
+    qint64 m_argument{ -1 };
+    qint64 m_startTime{ 0 };
+};